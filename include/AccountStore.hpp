@@ -0,0 +1,60 @@
+#ifndef ACCOUNT_STORE_HPP
+# define ACCOUNT_STORE_HPP
+
+# include "OpenHashMap.hpp"
+# include <string>
+# include <stdint.h>
+
+// Registered accounts: casefolded name to crypt(3) password hash.
+//
+// Files live next to each other:
+//   <path>.index   open-addressing table plus records, mapped read-only
+//   <path>.log     registrations appended since the index was built
+//
+// Opening maps the index without reading it and replays only the log into
+// an in-memory overlay, so startup does not grow with the number of
+// indexed accounts. A lookup checks the overlay, then probes the mapped
+// table. compact() folds the log into a fresh index offline (ircserv
+// --compact-accounts). An open store holds an exclusive flock on the log,
+// so a second server or a compaction refuses to touch files in use.
+//
+// A registration is fdatasync'd before create() reports it, so an account
+// that was confirmed to its user survives a crash.
+class AccountStore {
+public:
+    explicit AccountStore(const std::string& path);
+    ~AccountStore();
+
+    bool    open();
+    void    close();
+    bool    isOpen() const;
+
+    bool    find(const std::string& name, std::string& hash) const;  // Any case
+    bool    exists(const std::string& name) const;
+    bool    create(const std::string& name, const std::string& hash);  // False if taken or not durable
+    size_t  size() const;
+
+    static bool compact(const std::string& path);
+
+private:
+    enum RecordType {
+        REC_REGISTER = 1
+    };
+
+    std::string             _path;
+    const unsigned char*    _index;         // Mapped index, NULL when there is none
+    size_t                  _index_size;
+    uint64_t                _slot_count;    // Power of two
+    uint64_t                _indexed;       // Accounts in the index
+    OpenHashMap<std::string> _overlay;      // Accounts from the log
+    int                     _log_fd;
+
+    bool    mapIndex();
+    bool    replayLog();
+    bool    findIndexed(const std::string& key, uint32_t h, std::string& hash) const;
+
+    AccountStore(const AccountStore& other);
+    AccountStore& operator=(const AccountStore& other);
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef CASE_MAPPING_HPP
+# define CASE_MAPPING_HPP
+
+# include <string>
+
+// RFC 1459 casemapping: ASCII letters plus {}|~ as the lowercase forms of
+// []\^. Nick and channel lookups compare folded keys.
+//
+// Everything here is locale-independent. Bulk work runs through kernels
+// chosen once at startup: AVX2 or SSE2 on x86 when the CPU has them,
+// 256-entry tables otherwise. Strings shorter than one vector, and the
+// tail of longer ones, always take the table path.
+class CaseMapping {
+public:
+    static char         toLower(char c);
+    static std::string  fold(const std::string& text);
+    static void         foldInPlace(std::string& text);
+    static void         upperAsciiInPlace(std::string& text);  // Command names
+    static bool         equals(const std::string& a, const std::string& b);
+
+    // Wildcard match with '*' and '?', case-insensitive
+    static bool         match(const std::string& mask, const std::string& text);
+    static bool         hasWildcards(const std::string& mask);
+
+    // Validation: number of bytes from 'from' that are nickname characters
+    // (letters, digits, '-', '_') or allowed in a channel name (anything but
+    // space, ',', ':' and BEL)
+    static bool         isLetter(char c);
+    static size_t       spanNickname(const std::string& text, size_t from);
+    static size_t       spanChannelName(const std::string& text, size_t from);
+
+    static const char*  kernelName();  // "avx2", "sse2" or "scalar"
+    // Tests and benchmarks: switch to a named kernel if this CPU runs it.
+    // Not thread-safe; call before any other thread uses CaseMapping.
+    static bool         useKernel(const std::string& name);
+
+private:
+    CaseMapping() {}
+};
+
+#endif
@@ -3,19 +3,30 @@
 
 # include "common.hpp"
 # include "Client.hpp"
+# include "MessageHistory.hpp"
+# include "NamesCache.hpp"
 # include <string>
 # include <vector>
 # include <map>
 # include <ctime>
 
 class Server;  // Forward declaration
+class ChannelStore;
+class FanoutPool;
+struct MemoryStats;
 
 class Channel {
 private:
     std::string             _name;
+    std::string             _folded_name;   // Registry key
+    uint32_t                _name_hash;     // Cached hash of the key
+    Channel*                _registry_prev; // Creation order, kept by ChannelRegistry
+    Channel*                _registry_next;
     std::string             _topic;
     std::string             _topicSetter;
     time_t                  _topicTime;
+    time_t                  _created;
+    std::string             _founder;   // Account of the creator, empty if it had none
     std::string             _password;
     std::vector<Client*>    _clients;
     std::vector<Client*>    _operators;
@@ -23,9 +34,19 @@ private:
     bool                    _invite_only;
     bool                    _topic_restricted;
     size_t                  _user_limit;
+    int                     _text_policy;   // TextPolicy bits, modes +U and +S
     std::vector<Client*>    _invited_clients;
     std::vector<std::string> _ban_list;  // List of banned masks
     Server*                 _server;
+    ChannelStore*           _store;  // Journal for persistent state, may be NULL
+    HistoryRing             _history;
+    NamesCache              _names;
+    MessageHistory*         _history_budget;  // Server-wide cap, may be NULL
+
+    std::string nameEntry(Client* client) const;
+    FanoutPool* fanoutFor() const;
+
+    friend class ChannelRegistry;
 
     // Private copy constructor and assignment operator to prevent copying
     Channel(const Channel& other);
@@ -37,9 +58,12 @@ public:
 
     // Getters
     const std::string&          getName() const;
+    const std::string&          getFoldedName() const;
+    uint32_t                    getNameHash() const;
     const std::string&          getTopic() const;
     const std::string&          getTopicSetter() const;
     time_t                      getTopicTime() const;
+    time_t                      getCreationTime() const;
     const std::string&          getPassword() const;
     const std::vector<Client*>& getClients() const;
     const std::vector<Client*>& getOperators() const;
@@ -47,11 +71,14 @@ public:
     bool                        isInviteOnly() const;
     bool                        isTopicRestricted() const;
     size_t                      getUserLimit() const;
+    int                         getTextPolicy() const;
+    const std::string&          getFounder() const;
     bool                        hasKey() const;
     const std::string&          getKey() const;
     const std::vector<std::string>& getBanList() const;
     bool                        isBanned(const std::string& mask) const;
     bool                        isVoiced(Client* client) const;
+    const std::vector<Client*>& getInvitedClients() const;
 
     // Setters
     void setTopic(const std::string& topic, Client* client);
@@ -59,7 +86,11 @@ public:
     void setInviteOnly(bool status);
     void setTopicRestricted(bool status);
     void setUserLimit(size_t limit);
+    void setTextPolicy(int policy);
+    void setFounder(const std::string& account);
     void setKey(const std::string& key);
+    void restoreTopic(const std::string& topic, const std::string& setter, time_t when);
+    void applyTopic(const std::string& topic, const std::string& setter);
 
     // Client operations
     void addClient(Client* client);
@@ -68,6 +99,8 @@ public:
     void addOperator(Client* client);
     void removeOperator(Client* client);
     bool isOperator(Client* client) const;
+    void refreshName(Client* client);  // After a nick or prefix change
+    const std::vector<std::string>& getNamesChunks() const;
 
     // Voice operations
     void addVoice(Client* client);
@@ -83,10 +116,21 @@ public:
     void removeInvite(Client* client);
     bool isInvited(Client* client) const;
 
-    // Message broadcasting
-    void broadcast(const std::string& message, Client* exclude = NULL);
+    // Message broadcasting. Remote members are reached with one copy per
+    // server link; from_link is the link the message arrived on, if any.
+    void broadcast(const std::string& message, Client* exclude = NULL, Client* from_link = NULL);
+    void broadcastLocal(const std::string& message, Client* exclude = NULL);
+
+    // Recent PRIVMSG/NOTICE lines for CHATHISTORY
+    void addHistory(const SharedLine& line);
+    const HistoryRing& getHistory() const;
+
+    // Adds the record, member and ban lists, topic and history
+    void accountMemory(MemoryStats& stats) const;
 
     void setServer(Server* server);
+    void setStore(ChannelStore* store);
+    void setHistory(MessageHistory* budget);
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef CHANNEL_REGISTRY_HPP
+# define CHANNEL_REGISTRY_HPP
+
+# include "OpenHashMap.hpp"
+
+class Channel;
+
+// Every channel, found by casefolded name through an open-addressing table
+// and walked in creation order through a list threaded through the
+// channels themselves. Registering and dropping a channel are O(1) in
+// both structures, and a walk can stop at any channel and resume from it
+// later (see LIST).
+class ChannelRegistry {
+public:
+    ChannelRegistry();
+
+    Channel*    find(const std::string& name) const;   // Any case
+    void        insert(Channel* channel);               // Name must be free
+    void        erase(Channel* channel);
+    void        clear();                                // Does not delete channels
+    size_t      size() const;
+    size_t      memoryUsage() const;
+
+    Channel*        first() const;
+    static Channel* next(const Channel* channel);
+    static Channel* prev(const Channel* channel);
+
+private:
+    OpenHashMap<Channel*>   _table;
+    Channel*                _head;
+    Channel*                _tail;
+
+    ChannelRegistry(const ChannelRegistry& other);
+    ChannelRegistry& operator=(const ChannelRegistry& other);
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef CHANNEL_STORE_HPP
+# define CHANNEL_STORE_HPP
+
+# include "common.hpp"
+# include <stdint.h>
+# include <ctime>
+
+class Channel;
+class ChannelRegistry;
+
+// Durable channel state: a binary snapshot plus append-only journals.
+//
+// Files live next to each other:
+//   <path>                 snapshot, covers every journal below its generation
+//   <path>.journal.<gen>   mutations recorded since that snapshot
+//
+// Compaction encodes a fresh snapshot in memory, then forks a child that
+// only writes, syncs and renames it into place, while the parent keeps
+// appending to the next journal generation. The process has threads, so
+// the child never allocates or takes a lock. A compactor still running
+// after CHANNEL_COMPACT_TIMEOUT is killed and the journals stay.
+class ChannelStore {
+public:
+    // Persisted subset of a channel; membership is never stored. The
+    // founder alone does not make a channel worth keeping.
+    struct State {
+        std::string                 topic;
+        std::string                 topic_setter;
+        time_t                      topic_time;
+        std::string                 key;
+        bool                        invite_only;
+        bool                        topic_restricted;
+        size_t                      user_limit;
+        int                         text_policy;
+        std::vector<std::string>    bans;
+        std::string                 founder;
+
+        State();
+        bool isDefault() const;
+    };
+
+    ChannelStore(const std::string& path);
+    ~ChannelStore();
+
+    // Read the snapshot (via mmap) and replay journals on top of it
+    bool    load(std::map<std::string, State>& out);
+    // Start appending to a fresh journal generation
+    bool    open();
+    void    close();
+    bool    isOpen() const;
+
+    // Journal records
+    void    logTopic(const std::string& channel, const std::string& topic,
+                     const std::string& setter, time_t when);
+    void    logKey(const std::string& channel, const std::string& key);
+    void    logUserLimit(const std::string& channel, size_t limit);
+    void    logInviteOnly(const std::string& channel, bool status);
+    void    logTopicRestricted(const std::string& channel, bool status);
+    void    logTextPolicy(const std::string& channel, int policy);
+    void    logBan(const std::string& channel, const std::string& mask, bool add);
+    void    logFounder(const std::string& channel, const std::string& account);
+    void    logDrop(const Channel& channel);
+
+    // Background compaction
+    bool    needsCompaction() const;
+    void    compact(const ChannelRegistry& channels);
+    void    reap();
+
+    static State stateOf(const Channel& channel);
+
+private:
+    enum RecordType {
+        REC_TOPIC = 1,
+        REC_KEY,
+        REC_LIMIT,
+        REC_INVITE_ONLY,
+        REC_TOPIC_RESTRICTED,
+        REC_BAN_ADD,
+        REC_BAN_DEL,
+        REC_DROP,
+        REC_TEXT_POLICY,
+        REC_FOUNDER
+    };
+
+    std::string _path;
+    int         _journal_fd;
+    uint64_t    _generation;        // Generation currently appended to
+    uint64_t    _snapshot_generation;
+    size_t      _journal_bytes;
+    pid_t       _compactor;
+    uint64_t    _compact_generation;
+    uint64_t    _compact_started;   // Monotonic ms
+    std::string _compact_tmp;
+
+    std::string journalPath(uint64_t generation) const;
+    uint64_t    snapshotGeneration() const;
+    void        append(const std::string& record);
+    bool        loadSnapshot(std::map<std::string, State>& out);
+    size_t      replayJournal(uint64_t generation, std::map<std::string, State>& out);
+    void        removeJournalsBelow(uint64_t generation);
+    static std::string encodeSnapshot(const ChannelRegistry& channels, uint64_t next_generation);
+    static void writeSnapshot(const char* tmp, const char* path, const std::string& data);
+
+    ChannelStore(const ChannelStore& other);
+    ChannelStore& operator=(const ChannelStore& other);
+};
+
+#endif
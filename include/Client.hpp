@@ -3,20 +3,69 @@
 
 # include "common.hpp"
 # include "DynamicBuffer.hpp"
+# include "TimerWheel.hpp"
+# include <set>
 
 class Channel;
+class ListQuery;
+struct MemoryStats;
+
+// IRCv3 capabilities a client may enable with CAP REQ
+enum ClientCap {
+    CAP_SASL = 1,
+    CAP_BATCH = 2,
+    CAP_MESSAGE_TAGS = 4,      // msgid on CHATHISTORY lines
+    CAP_SERVER_TIME = 8
+};
 
 class Client {
 private:
     int         _fd;
+    uint64_t    _id;            // Unique per process, unlike fds
     std::string _nickname;
     std::string _username;
     std::string _realname;
     std::string _hostname;
+    struct sockaddr_storage _address;
     bool        _authenticated;
     bool        _registered;
+    bool        _oper;          // Authenticated with OPER
+    bool        _auth_pending;  // Credential check running, input on hold
+    bool        _runnable;      // On the run queue, reads paused
+    bool        _closing;       // Disconnected, waiting for the teardown phase
+    std::string _close_reason;
+    std::string _account;       // Logged-in account, empty when none
+    int         _caps;          // ClientCap bits
+    bool        _cap_negotiating;  // Between CAP LS/REQ and CAP END
+    bool        _sasl_started;  // AUTHENTICATE mechanism accepted
+    std::string _sasl_payload;  // Base64 chunks received so far
+    bool        _server_link;   // Connection is a peer server, not a user
+    Client*     _uplink;        // Link a remote user is reached through
+    std::string _server_name;   // Home server (users) or peer name (links)
+    time_t      _signon;        // Nick timestamp used to settle collisions
     DynamicBuffer _buffer;
     std::vector<Channel*> _channels;
+    uint64_t    _visit_epoch;   // Last fan-out that reached this client
+    ListQuery*  _list_query;    // LIST still being streamed, owned
+    std::string _sendq;         // Bytes the socket would not take yet
+    bool        _sendq_exceeded;
+    bool        _fanout_pending;    // A sender thread owns the socket
+
+    static std::set<Client*> _blocked;  // Queues that need POLLOUT or a kill
+    static uint64_t _last_id;
+    static void*    _pool;          // Freed records, linked through their first bytes
+    static size_t   _pool_size;
+    static size_t   _sendq_limit;       // Bytes queued before a client is dropped
+    static size_t   _sendq_link_limit;
+
+    // Keepalive state
+    Timer       _registration_timer;
+    Timer       _ping_timer;
+    uint64_t    _last_activity;
+    uint64_t    _ping_sent;
+    std::string _ping_token;
+    bool        _ping_pending;
+    long        _lag;
 
     // Private copy constructor and assignment operator to prevent copying
     Client(const Client& other);
@@ -26,33 +75,108 @@ public:
     Client(int fd);
     ~Client();
 
+    // Records are recycled through a small free list rather than the heap
+    static void*    operator new(size_t size);
+    static void     operator delete(void* ptr);
+    static size_t   pooledCount();
+    static void     releasePool();
+
     // Getters
     int         getFd() const;
+    uint64_t    getId() const;
     const std::string& getNickname() const;
     const std::string& getUsername() const;
     const std::string& getRealname() const;
     const std::string& getHostname() const;
+    const struct sockaddr_storage& getAddress() const;
     bool        isAuthenticated() const;
     bool        isRegistered() const;
+    bool        isOper() const;
+    bool        isAuthPending() const;
+    bool        isRunnable() const;
+    bool        isClosing() const;
+    const std::string& getCloseReason() const;
+    const std::string& getAccount() const;
+    int         getCaps() const;
+    bool        isCapNegotiating() const;
+    bool        isSaslStarted() const;
+    std::string& getSaslPayload();
     DynamicBuffer& getBuffer();
     const std::vector<Channel*>& getChannels() const;
+    Timer&      getRegistrationTimer();
+    Timer&      getPingTimer();
+    uint64_t    getLastActivity() const;
+    uint64_t    getPingSent() const;
+    bool        isPingPending() const;
+    long        getLag() const;
+    bool        isServerLink() const;
+    bool        isRemote() const;
+    Client*     getUplink() const;
+    const std::string& getServerName() const;
+    time_t      getSignon() const;
 
     // Setters
     void        setNickname(const std::string& nickname);
     void        setUsername(const std::string& username);
     void        setRealname(const std::string& realname);
     void        setHostname(const std::string& hostname);
+    void        setAddress(const struct sockaddr_storage& address);
+    void        setServerLink(bool status);
+    void        setUplink(Client* uplink);
+    void        setServerName(const std::string& name);
+    void        setSignon(time_t signon);
     void        setAuthenticated(bool status);
     void        setRegistered(bool status);
+    void        setOper(bool status);
+    void        setAuthPending(bool status);
+    void        setRunnable(bool status);
+    void        setClosing(const std::string& reason);
+    void        setAccount(const std::string& account);
+    void        setCaps(int caps);
+    void        setCapNegotiating(bool status);
+    void        setSaslStarted(bool status);  // Clearing it drops the payload too
+    void        setLastActivity(uint64_t now);
+
+    // Keepalive
+    const std::string& startPing(uint64_t now);
+    bool        handlePong(const std::string& token, uint64_t now);
+    void        clearPing();
 
     // Channel operations
     void        joinChannel(Channel* channel);
     void        leaveChannel(Channel* channel);
+    void        reserveChannels(size_t additional);
+
+    // True the first time a given fan-out epoch reaches this client
+    bool        markVisited(uint64_t epoch);
     bool        isInChannel(const Channel* channel) const;
 
+    // LIST in progress; setListQuery takes ownership and drops any previous one
+    ListQuery*  getListQuery() const;
+    void        setListQuery(ListQuery* query);
+
     // Message handling
     bool        appendToBuffer(const char* data, size_t len);
     void        sendMessage(const std::string& message);
+    void        sendRaw(const std::string& line);  // Routed via the uplink for remote users
+    size_t      writeDirect(const std::string& line) const;  // Socket only; bytes done with
+    void        queueRemainder(const std::string& line, size_t sent);
+
+    // Held by a FanoutPool job: output queues up and stays unflushed
+    bool        isFanoutPending() const;
+    void        setFanoutPending(bool pending);
+    void        finishFanout(const std::string& line, size_t sent);  // Rest goes first in the queue
+
+    // Output queue
+    bool        flushSendQueue();   // False on a hard socket error
+    size_t      getSendQueueSize() const;
+    const std::string& getSendQueue() const;
+    bool        isSendQueueExceeded() const;
+    static void setSendQueueLimits(size_t user, size_t link);  // Checked as queues grow
+    static void collectBlocked(std::vector<Client*>& out);
+
+    // Adds this client's record, input buffer and output queue
+    void        accountMemory(MemoryStats& stats) const;
 };
 
 #endif 
\ No newline at end of file
@@ -8,27 +8,65 @@
 class CommandHandler {
 private:
     Server& _server;
+    std::string _dummy_hash;    // Checked for unknown SASL accounts and OPER names so they take as long as known ones
 
     // Command handlers
     void handlePass(Client* client, const std::vector<std::string>& params);
     void handleNick(Client* client, const std::vector<std::string>& params);
     void handleUser(Client* client, const std::vector<std::string>& params);
     void handleQuit(Client* client, const std::vector<std::string>& params);
+    void handlePing(Client* client, const std::vector<std::string>& params);
+    void handlePong(Client* client, const std::vector<std::string>& params);
     
     // Channel command handlers
     void handleJoin(Client* client, const std::vector<std::string>& params);
     void handlePart(Client* client, const std::vector<std::string>& params);
     void handlePrivmsg(Client* client, const std::vector<std::string>& params);
+    void handleNotice(Client* client, const std::vector<std::string>& params);
+    void handleChathistory(Client* client, const std::vector<std::string>& params);
     void handleNames(Client* client, const std::vector<std::string>& params);
     void handleKick(Client* client, const std::vector<std::string>& params);
     void handleTopic(Client* client, const std::vector<std::string>& params);
     void handleInvite(Client* client, const std::vector<std::string>& params);
     void handleMode(Client* client, const std::vector<std::string>& params);
+    void handleList(Client* client, const std::vector<std::string>& params);
+
+    // User query handlers
+    void handleWho(Client* client, const std::vector<std::string>& params);
+    void handleWhois(Client* client, const std::vector<std::string>& params);
+
+    // Operator commands
+    void handleOper(Client* client, const std::vector<std::string>& params);
+    void handleStats(Client* client, const std::vector<std::string>& params);
+    void handleProfile(Client* client, const std::vector<std::string>& params);
+
+    // Capabilities and accounts
+    void handleCap(Client* client, const std::vector<std::string>& params);
+    void handleAuthenticate(Client* client, const std::vector<std::string>& params);
+    void handleRegister(Client* client, const std::vector<std::string>& params);
 
     // Helper functions
+    bool dispatch(Client* client, const std::string& command, const std::vector<std::string>& params);
+    void completeRegistration(Client* client);
+    void tryCompleteRegistration(Client* client);
+    bool mayUseNickname(Client* client, const std::string& nickname);
+    void finishRegister(Client* client, const CredentialPool::Result& result);
+    void logIn(Client* client, const std::string& account);
+    void appendNames(std::string& out, Client* client, Channel* channel);
+    void joinChannel(Client* client, const std::string& channel_name, const std::string& provided_key,
+                     std::string& out, std::string& links);
+    void partChannel(Client* client, Channel* channel, const std::string& reason,
+                     std::string& out, std::string& links);
+    std::string whoRow(Client* client, Client* user, Channel* channel);
+    void appendWhois(std::string& out, Client* client, Client* user);
+    void verifyCredential(Client* client, CredentialKind kind, const std::string& name,
+                          const std::string& secret, const std::string& expected);
+    void deliverMessage(Client* client, const std::vector<std::string>& params, const std::string& command);
     std::vector<std::string> splitMessage(const std::string& message);
     bool isValidNickname(const std::string& nickname);
     bool isValidChannelName(const std::string& channel);
+    std::vector<std::string> splitList(const std::string& list, bool keep_empty = false);
+    std::string formatReply(Client* client, int code, const std::string& message);
     void sendReply(Client* client, int code, const std::string& message);
     void broadcastToChannel(const std::string& channel_name, const std::string& message, Client* exclude = NULL);
 
@@ -41,6 +79,8 @@ public:
     CommandHandler& operator=(const CommandHandler& other);
 
     void handleCommand(Client* client, const std::string& message);
+    bool continueList(Client* client);  // True once the LIST is complete
+    void finishCredential(Client* client, const CredentialPool::Result& result);
 };
 
 #endif 
\ No newline at end of file
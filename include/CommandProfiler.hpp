@@ -0,0 +1,89 @@
+#ifndef COMMAND_PROFILER_HPP
+# define COMMAND_PROFILER_HPP
+
+# include <string>
+# include <map>
+# include <stdint.h>
+
+// Per-command CPU cost, aggregated by command name and client class.
+//
+// CYCLES reads the timestamp counter around each handler (a monotonic
+// nanosecond clock off x86). COUNTERS adds a perf_event_open group of
+// retired instructions, cache misses and branch misses for this thread,
+// read with one syscall at each end. When OFF the dispatcher checks
+// isEnabled() and nothing else runs.
+class CommandProfiler {
+public:
+    enum Mode {
+        PROFILE_OFF,
+        PROFILE_CYCLES,
+        PROFILE_COUNTERS
+    };
+
+    enum ClientClass {
+        CLASS_UNREGISTERED,
+        CLASS_USER,
+        CLASS_OPERATOR,
+        CLASS_COUNT
+    };
+
+    enum Counter {
+        COUNTER_INSTRUCTIONS,
+        COUNTER_CACHE_MISSES,
+        COUNTER_BRANCH_MISSES,
+        COUNTER_COUNT
+    };
+
+    struct Sample {
+        uint64_t    cycles;
+        uint64_t    counters[COUNTER_COUNT];
+        bool        counted;    // counters holds a valid reading
+    };
+
+    struct Totals {
+        uint64_t    calls;
+        uint64_t    cycles;
+        uint64_t    max_cycles;
+        uint64_t    counters[COUNTER_COUNT];
+
+        Totals();
+    };
+
+    struct Entry {
+        Totals      by_class[CLASS_COUNT];
+    };
+
+    typedef std::map<std::string, Entry> Table;
+
+    CommandProfiler();
+    ~CommandProfiler();
+
+    // COUNTERS falls back to CYCLES (and returns false) when the kernel
+    // refuses perf events
+    bool        setMode(Mode mode);
+    Mode        getMode() const;
+    bool        isEnabled() const { return _mode != PROFILE_OFF; }
+
+    void        begin(Sample& sample) const;
+    void        end(const Sample& sample, const std::string& command, ClientClass client_class);
+    void        reset();
+
+    const Table& getTable() const;
+    static const char* modeName(Mode mode);
+    static const char* className(ClientClass client_class);
+
+private:
+    Mode        _mode;
+    int         _group_fd;      // Instruction counter, leader of the group
+    int         _member_fds[COUNTER_COUNT - 1];
+    Table       _table;
+
+    bool        openCounters();
+    void        closeCounters();
+    bool        readCounters(uint64_t* values) const;
+
+    CommandProfiler(const CommandProfiler& other);
+    CommandProfiler& operator=(const CommandProfiler& other);
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef CONNECTION_THROTTLE_HPP
+# define CONNECTION_THROTTLE_HPP
+
+# include "common.hpp"
+# include <stdint.h>
+
+// Per-address admission control applied at accept time.
+// IPv4 peers are tracked per /32 and IPv6 peers per /64, so a host cannot
+// sidestep the limits by rotating through its own prefix. Each entry keeps
+// the number of live connections and a GCRA token bucket for connect rate.
+class ConnectionThrottle {
+public:
+    struct Key {
+        unsigned char family;
+        unsigned char bytes[8];
+
+        bool operator<(const Key& other) const;
+    };
+
+    enum Verdict {
+        ACCEPT,
+        TOO_MANY_CLONES,
+        THROTTLED
+    };
+
+    ConnectionThrottle();
+    ~ConnectionThrottle();
+
+    static Key  keyFor(const struct sockaddr_storage& addr);
+
+    Verdict     admit(const Key& key, uint64_t now);
+    void        release(const Key& key);
+    void        track(const Key& key);  // Count a connection without rate checks
+    void        setLimits(size_t max_clones, size_t burst, uint64_t interval);
+
+    // Drop entries with no live connections and a full bucket
+    size_t      collect(uint64_t now);
+    size_t      size() const;
+
+private:
+    struct Entry {
+        uint32_t    connections;
+        uint64_t    tat;            // GCRA theoretical arrival time (ms)
+    };
+
+    std::map<Key, Entry> _entries;
+    size_t      _max_clones;
+    size_t      _burst;
+    uint64_t    _interval;          // ms
+
+    ConnectionThrottle(const ConnectionThrottle& other);
+    ConnectionThrottle& operator=(const ConnectionThrottle& other);
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef CREDENTIAL_POOL_HPP
+# define CREDENTIAL_POOL_HPP
+
+# include <string>
+# include <vector>
+# include <deque>
+# include <pthread.h>
+# include <stdint.h>
+
+enum CredentialKind {
+    CREDENTIAL_PASS,        // Server password, PASS
+    CREDENTIAL_OPER,        // Operator password, OPER
+    CREDENTIAL_SASL,        // Account password, AUTHENTICATE PLAIN
+    CREDENTIAL_REGISTER,    // Hash a new account password, REGISTER
+    CREDENTIAL_LINK         // Link password, PASS from a peer server
+};
+
+// Verifies hashed credentials (crypt(3) strings such as $6$, $2b$ or $y$)
+// and hashes new ones on a few worker threads so a slow hash never stalls the poll loop.
+// Requests wait in a bounded queue; finished checks are collected by the
+// loop when the notify fd, the read end of a self-pipe, turns readable.
+class CredentialPool {
+public:
+    struct Request {
+        uint64_t        client_id;  // Client::getId(), guards against fd reuse
+        int             fd;
+        CredentialKind  kind;
+        std::string     name;       // Oper or account name, empty for PASS
+        std::string     secret;
+        std::string     expected;   // Stored hash, unused for REGISTER
+        uint64_t        queued_ms;
+    };
+
+    struct Result {
+        uint64_t        client_id;
+        int             fd;
+        CredentialKind  kind;
+        std::string     name;
+        bool            ok;
+        std::string     hash;       // New hash, REGISTER only
+    };
+
+    struct Stats {
+        uint64_t    submitted;
+        uint64_t    completed;
+        uint64_t    rejected;       // Queue full
+        uint64_t    mismatches;
+        uint64_t    wait_ms;        // Total time spent queued
+        uint64_t    verify_ms;      // Total time spent hashing
+        size_t      max_depth;
+    };
+
+    CredentialPool(size_t workers, size_t max_queue);
+    ~CredentialPool();
+
+    bool    start();
+    void    stop();
+    int     getNotifyFd() const;
+
+    bool    submit(Request request);            // False when the queue is full
+    void    collect(std::vector<Result>& out);  // Finished checks, never blocks
+    void    drain(std::vector<Result>& out);    // Waits for every queued check
+
+    size_t  depth() const;                      // Queued plus in progress
+    size_t  getWorkerCount() const;
+    size_t  getMaxQueue() const;
+    Stats   getStats() const;
+
+    // Only strings in crypt(3) format are worth a worker
+    static bool isHashed(const std::string& expected);
+    static bool matches(const std::string& secret, const std::string& expected);
+    static std::string hash(const std::string& secret);  // SHA-512 crypt, random salt; empty on failure
+
+private:
+    size_t                  _worker_count;
+    size_t                  _max_queue;
+    std::vector<pthread_t>  _workers;
+    std::deque<Request>     _queue;
+    std::vector<Result>     _done;
+    size_t                  _busy;
+    bool                    _stopping;
+    int                     _pipe[2];
+    Stats                   _stats;
+    mutable pthread_mutex_t _mutex;
+    pthread_cond_t          _work;      // Signalled on submit and stop
+    pthread_cond_t          _idle;      // Signalled when a check finishes
+
+    static void*    workerMain(void* arg);
+    void            work();
+
+    CredentialPool(const CredentialPool& other);
+    CredentialPool& operator=(const CredentialPool& other);
+};
+
+#endif
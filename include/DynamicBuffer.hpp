@@ -5,29 +5,41 @@
 # include <string>   // for std::string
 # include <cstring>  // for std::memcpy, std::memmove
 
+// Input bytes held back for a client, normally a partial line. Storage is
+// allocated on the first append and handed back by release(), so an idle
+// connection holds none.
 class DynamicBuffer {
+public:
+    static const size_t DEFAULT_MAX_SIZE = 16384;
+
 private:
     static const size_t INITIAL_SIZE = 1024;
-    static const size_t MAX_SIZE = 16384; // 16KB max buffer size
 
     char*   _buffer;
     size_t  _size;
     size_t  _capacity;
 
+    // Shared by every buffer; a function static keeps the class header-only
+    static size_t& limit() {
+        static size_t max_size = DEFAULT_MAX_SIZE;
+        return max_size;
+    }
+
     void grow() {
-        size_t new_capacity = _capacity * 2;
-        if (new_capacity > MAX_SIZE)
-            new_capacity = MAX_SIZE;
+        size_t new_capacity = _capacity ? _capacity * 2 : INITIAL_SIZE;
+        if (new_capacity > maxSize())
+            new_capacity = maxSize();
         
         char* new_buffer = new char[new_capacity];
-        std::memcpy(new_buffer, _buffer, _size);
+        if (_size)
+            std::memcpy(new_buffer, _buffer, _size);
         delete[] _buffer;
         _buffer = new_buffer;
         _capacity = new_capacity;
     }
 
 public:
-    DynamicBuffer() : _buffer(new char[INITIAL_SIZE]), _size(0), _capacity(INITIAL_SIZE) {}
+    DynamicBuffer() : _buffer(NULL), _size(0), _capacity(0) {}
 
     ~DynamicBuffer() {
         delete[] _buffer;
@@ -41,7 +53,7 @@ public:
 
     // Append data to buffer
     bool append(const char* data, size_t len) {
-        if (_size + len > MAX_SIZE)
+        if (_size + len > maxSize())
             return false;
 
         while (_size + len > _capacity)
@@ -79,16 +91,68 @@ public:
         return false;
     }
 
+    // Makes room for at least len more bytes, within maxSize()
+    void reserve(size_t len) {
+        while (_capacity - _size < len && _capacity < maxSize())
+            grow();
+    }
+
+    // Free space after the held bytes, for reading in place; commit() what
+    // was written there
+    char* tail() {
+        return _buffer + _size;
+    }
+
+    void commit(size_t len) {
+        _size += len;
+    }
+
+    // Drop the first len bytes
+    void consume(size_t len) {
+        _size -= len;
+        if (_size)
+            std::memmove(_buffer, _buffer + len, _size);
+    }
+
     // Clear buffer
     void clear() {
         _size = 0;
     }
 
+    // Free the storage once nothing is held
+    void release() {
+        if (_size)
+            return;
+        delete[] _buffer;
+        _buffer = NULL;
+        _capacity = 0;
+    }
+
+    // Raw view of the buffered bytes
+    const char* data() const {
+        return _buffer;
+    }
+
     // Get current size
     size_t size() const {
         return _size;
     }
 
+    // Get allocated size
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    // Most bytes held for one client; a lower limit applies to the next
+    // append, bytes already held stay
+    static size_t maxSize() {
+        return limit();
+    }
+
+    static void setMaxSize(size_t size) {
+        limit() = size;
+    }
+
     // Get remaining capacity
     size_t remainingCapacity() const {
         return _capacity - _size;
@@ -0,0 +1,80 @@
+#ifndef FANOUT_POOL_HPP
+# define FANOUT_POOL_HPP
+
+# include "SharedLine.hpp"
+# include <string>
+# include <vector>
+# include <deque>
+# include <pthread.h>
+# include <stdint.h>
+
+class Client;
+
+// Sends one line to the local members of a very large channel on several
+// threads without making the loop wait for them. Recipients are sharded by
+// fd, so each sender thread always writes to the same connections; the
+// loop thread sends shard 0 itself and queues a job for each other shard.
+//
+// While a job holds a client, that client's socket belongs to the sender
+// thread: the loop queues any further output instead of writing, leaves
+// its send queue alone and keeps its record out of teardown. Finished jobs
+// come back through a self-pipe, as with CredentialPool; collect() then
+// puts whatever a socket would not take in front of the client's queue,
+// so nothing sent later can overtake the line. A client whose queue is
+// not empty, or that another job still holds, gets the line queued
+// straight away.
+class FanoutPool {
+public:
+    struct Stats {
+        uint64_t    fanouts;        // Lines delivered through the pool
+        uint64_t    recipients;
+        uint64_t    queued;         // Recipients left to their send queue
+    };
+
+    FanoutPool();
+    ~FanoutPool();
+
+    bool    start();                // Starts the configured threads, if any
+    void    stop();                 // Finishes queued jobs first
+
+    void    setThreadCount(size_t threads);    // Takes effect on start()
+    size_t  getThreadCount() const;
+    void    setThreshold(size_t members);
+    size_t  getThreshold() const;
+    bool    accepts(size_t members) const;     // Running and the channel is big enough
+    const Stats& getStats() const;
+
+    int     getNotifyFd() const;    // Readable when jobs have finished
+    void    deliver(const SharedLine& line, const std::vector<Client*>& targets);
+    void    collect();              // Hands finished jobs back to their clients
+    void    drain();                // Waits for every job, then collect()
+
+private:
+    struct Job {
+        SharedLine              line;       // Copied and freed by the loop thread only
+        std::vector<Client*>    targets;
+        std::vector<size_t>     sent;       // Bytes each socket took
+    };
+
+    size_t                  _thread_count;
+    size_t                  _threshold;
+    std::vector<pthread_t>  _threads;
+    std::vector<std::deque<Job*> > _queues; // One per thread
+    std::vector<Job*>       _finished;
+    size_t                  _started;       // Workers that picked their queue
+    size_t                  _busy;          // Jobs queued or being sent
+    bool                    _stopping;
+    int                     _pipe[2];
+    Stats                   _stats;
+    pthread_mutex_t         _mutex;
+    pthread_cond_t          _work;          // Signalled per job and on stop
+    pthread_cond_t          _idle;          // Signalled as jobs finish and workers start
+
+    static void*    workerMain(void* arg);
+    void            work();
+
+    FanoutPool(const FanoutPool& other);
+    FanoutPool& operator=(const FanoutPool& other);
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef LINK_MANAGER_HPP
+# define LINK_MANAGER_HPP
+
+# include "common.hpp"
+# include "TimerWheel.hpp"
+# include "CredentialPool.hpp"
+# include <set>
+
+class Server;
+class Client;
+class Channel;
+
+// Server-to-server linking.
+//
+// Servers form a spanning tree: every peer is reached through exactly one
+// directly connected link, and anything received on a link is forwarded
+// to all other links. A server name seen twice means a loop and the newer
+// link is dropped. Users on other servers are represented by Client
+// objects without a socket whose uplink is the link leading to them.
+//
+// Links have their own password: it goes out in clear, so it is never
+// the stored server password, which may be a hash. Incoming PASS is
+// checked against the accept value (a crypt hash or plain text) the same
+// way client PASS is, on the credential pool when hashed; the link's
+// SERVER line waits for the result.
+//
+// Peer protocol (RFC 2813 flavoured):
+//   PASS <password>
+//   SERVER <name> <hops> :<description>
+//   :<parent> SERVER <name> <hops> :<description>
+//   NICK <nick> <hops> <ts> <user> <host> <server> :<realname>
+//   :<server> NJOIN <channel> :[@|+]<nick>,...
+//   :<nick>[!user@host] NICK|JOIN|PART|PRIVMSG|NOTICE|MODE|TOPIC|KICK|INVITE|QUIT ...
+//   KILL <nick> :<reason>
+//   SQUIT <server> :<reason>
+class LinkManager {
+public:
+    struct Target {
+        std::string host;
+        int         port;
+        Client*     link;
+        Timer       retry;
+    };
+
+    LinkManager(Server& server);
+    ~LinkManager();
+
+    // Forget the network and close the link listener
+    void    clear();
+
+    // Configuration
+    bool    listen(int port, int backlog);  // The previous listener, if any, is the caller's to close
+    void    closeListener();
+    bool    adoptListener(int fd, int port);
+    void    addTarget(const std::string& host, int port);
+    void    setPassword(const std::string& password);   // Sent to peers
+    void    setAcceptPassword(const std::string& expected);  // Default: the sent one
+    const std::string& getPassword() const;
+    const std::string& getAcceptPassword() const;
+    void    connectAll();
+    int     getListenFd() const;
+    int     getListenPort() const;
+    const std::vector<Target*>& getTargets() const;
+
+    // Link connections
+    bool    isConnecting(Client* link) const;
+    void    finishConnect(Client* link);
+    void    handleRetry(Target* target);
+    void    handleLine(Client* link, const std::string& line);
+    void    finishCredential(Client* link, const CredentialPool::Result& result);
+    void    linkClosed(Client* link, const std::string& reason);
+
+    // Local events to share with the network
+    void    introduce(Client* client);
+    void    propagate(const std::string& line, Client* except = NULL);
+    void    clientQuit(Client* client, const std::string& reason);
+
+    Client* getRemoteClient(const std::string& nickname) const;
+
+private:
+    struct Message {
+        std::string                 prefix;
+        std::string                 command;
+        std::vector<std::string>    params;
+    };
+
+    struct RemoteServer {
+        Client*     via;        // Directly connected link leading there
+        std::string parent;     // Server that introduced it
+        int         hops;
+        std::string description;
+    };
+
+    Server&                             _server;
+    int                                 _listen_fd;
+    int                                 _listen_port;
+    std::string                         _password;
+    std::string                         _accept_password;
+    std::vector<Target*>                _targets;
+    std::set<Client*>                   _connecting;
+    std::set<Client*>                   _outgoing;
+    std::map<std::string, RemoteServer> _servers;
+    std::map<std::string, Client*>      _remote;
+    std::set<uint64_t>                  _silenced;  // Ids of local clients exiting without a QUIT
+
+    static Message  parse(const std::string& line);
+    static std::string prefixNick(const std::string& prefix);
+    static std::string userPrefix(Client* client);
+
+    void    sendLine(Client* link, const std::string& line);
+    void    sendHandshake(Client* link);
+    void    verifyPassword(Client* link, const std::string& secret);
+    void    sendBurst(Client* link);
+    void    completeHandshake(Client* link, const Message& msg);
+    void    dropLink(Client* link, const std::string& reason);
+
+    void    handleServer(Client* link, const Message& msg);
+    void    handleNickIntro(Client* link, const Message& msg, const std::string& line);
+    void    handleNickChange(Client* link, Client* user, const Message& msg, const std::string& line);
+    void    handleJoin(Client* link, Client* user, const Message& msg, const std::string& line);
+    void    handleNjoin(Client* link, const Message& msg, const std::string& line);
+    void    handlePart(Client* link, Client* user, const Message& msg, const std::string& line);
+    void    handleMessage(Client* link, Client* user, const Message& msg, const std::string& line);
+    void    handleMode(Client* link, const Message& msg, const std::string& line);
+    void    handleTopic(Client* link, const Message& msg, const std::string& line);
+    void    handleKick(Client* link, const Message& msg, const std::string& line);
+    void    handleInvite(Client* link, const Message& msg, const std::string& line);
+    void    handleKill(Client* link, const Message& msg);
+    void    handleSquit(Client* link, const Message& msg);
+
+    void    killClient(Client* victim, const std::string& reason, Client* except);
+    void    removeRemote(Client* user, const std::string& reason);
+    void    removeServer(const std::string& name, const std::string& reason);
+    void    connectTarget(Target* target);
+    void    scheduleRetry(Target* target);
+
+    LinkManager(const LinkManager& other);
+    LinkManager& operator=(const LinkManager& other);
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef LIST_QUERY_HPP
+# define LIST_QUERY_HPP
+
+# include <string>
+# include <vector>
+# include <ctime>
+
+class Channel;
+
+// A LIST request: ELIST filters plus how far through the channel registry
+// the reply has got. The cursor is the last channel visited, or NULL
+// before the first; Server moves it back a channel when the one it points
+// at is removed, so a listing resumed on a later tick always continues
+// right after what it already sent.
+//
+// Terms, as in the ELIST=CMNTU token:
+//   #chan, mask     channel name (M)      !mask       excluded names (N)
+//   >n, <n          member count (U)
+//   C>n, C<n        created more/less than n minutes ago (C)
+//   T>n, T<n        topic set more/less than n minutes ago (T)
+class ListQuery {
+public:
+    explicit ListQuery(time_t now);
+
+    bool    addTerm(const std::string& term);  // False when a condition is malformed
+    bool    matches(const Channel& channel) const;
+
+    // Only exact names were given: answer by lookup, no scan needed
+    bool    isLookupOnly() const;
+    const std::vector<std::string>& getMasks() const;
+
+    const Channel* getCursor() const;
+    void    setCursor(const Channel* channel);
+
+private:
+    time_t                      _now;
+    std::vector<std::string>    _masks;
+    std::vector<std::string>    _exclusions;
+    bool                        _wildcards;     // Some mask needs matching
+    bool                        _conditions;    // Some numeric filter is set
+    long                        _users_above;   // -1 when unset
+    long                        _users_below;
+    time_t                      _created_after; // 0 when unset
+    time_t                      _created_before;
+    time_t                      _topic_after;
+    time_t                      _topic_before;
+    const Channel*              _cursor;
+
+    static bool parseCount(const std::string& text, long& value);
+};
+
+#endif
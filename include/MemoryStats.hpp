@@ -0,0 +1,48 @@
+#ifndef MEMORY_STATS_HPP
+# define MEMORY_STATS_HPP
+
+# include <string>
+# include <vector>
+# include <cstddef>
+
+// Heap bytes per subsystem, gathered on demand by walking the live
+// structures (STATS z). Containers count their capacity, strings their
+// heap buffer and tree nodes an estimated allocator overhead, so totals
+// follow what malloc handed out rather than what is in use.
+struct MemoryStats {
+    enum Category {
+        MEM_CLIENTS,        // Client records, their names and channel lists
+        MEM_INPUT,          // Read buffers
+        MEM_SENDQ,          // Unsent output
+        MEM_CHANNELS,       // Channel records and names
+        MEM_MEMBERS,        // Member, operator, voice and invite lists, NAMES cache
+        MEM_BANS,
+        MEM_TOPICS,
+        MEM_HISTORY,        // Channel history lines
+        MEM_NICK_INDEX,
+        MEM_HOST_INDEX,
+        MEM_CHANNEL_INDEX,
+        MEM_COUNT
+    };
+
+    static const size_t NODE_OVERHEAD = 48;  // Tree node links plus malloc header
+
+    size_t  bytes[MEM_COUNT];
+    size_t  items[MEM_COUNT];
+
+    MemoryStats();
+
+    void    add(Category category, size_t size, size_t count);
+    size_t  total() const;
+
+    static const char*  name(Category category);
+    static size_t       stringBytes(const std::string& text);  // 0 while stored inline
+    static size_t       residentBytes();                       // RSS, 0 if unknown
+
+    template <typename T>
+    static size_t vectorBytes(const std::vector<T>& items) {
+        return items.capacity() * sizeof(T);
+    }
+};
+
+#endif
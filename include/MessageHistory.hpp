@@ -0,0 +1,82 @@
+#ifndef MESSAGE_HISTORY_HPP
+# define MESSAGE_HISTORY_HPP
+
+# include "SharedLine.hpp"
+# include <vector>
+# include <list>
+# include <map>
+# include <stdint.h>
+
+// Fixed-size ring of a channel's most recent messages, oldest first.
+// Message ids grow monotonically, so a ring is also sorted by msgid.
+class HistoryRing {
+public:
+    struct Entry {
+        SharedLine  line;
+        uint64_t    msgid;
+        uint64_t    time_ms;    // Wall clock, for the IRCv3 time tag
+    };
+
+    explicit HistoryRing(size_t capacity);
+
+    // Returns the bytes released by overwriting the oldest entry, if any
+    size_t  push(const Entry& entry);
+    // Returns the bytes released, 0 when empty
+    size_t  dropOldest();
+    void    clear();
+
+    size_t  size() const;
+    bool    empty() const;
+    size_t  bytes() const;
+    size_t  memoryUsage() const;    // Preallocated slots plus line buffers
+
+    // Windows of at most limit entries, in chronological order
+    void    latest(size_t limit, std::vector<const Entry*>& out) const;
+    void    before(uint64_t msgid, size_t limit, std::vector<const Entry*>& out) const;
+    void    after(uint64_t msgid, size_t limit, std::vector<const Entry*>& out) const;
+
+    static size_t cost(const Entry& entry);
+
+private:
+    std::vector<Entry>  _entries;
+    size_t              _start;     // Index of the oldest entry
+    size_t              _count;
+    size_t              _bytes;
+
+    const Entry&    at(size_t i) const;  // i-th oldest
+};
+
+// Server-wide budget for channel history. Rings are kept in order of last
+// activity; when the budget is exceeded the least recently active
+// channels lose their oldest lines first.
+class MessageHistory {
+public:
+    explicit MessageHistory(size_t max_bytes);
+
+    void    record(HistoryRing& ring, const SharedLine& line);
+    void    forget(HistoryRing& ring);
+
+    size_t  bytes() const;
+    size_t  maxBytes() const;
+
+    static std::string formatTime(uint64_t time_ms);
+    static std::string formatMsgid(uint64_t msgid);
+    static bool        parseMsgid(const std::string& token, uint64_t& msgid);
+
+private:
+    typedef std::list<HistoryRing*> RingList;
+
+    RingList                                _lru;       // Least recently active first
+    std::map<HistoryRing*, RingList::iterator> _position;
+    size_t                                  _max_bytes;
+    size_t                                  _bytes;
+    uint64_t                                _next_msgid;
+
+    void    touch(HistoryRing& ring);
+    void    enforceBudget();
+
+    MessageHistory(const MessageHistory& other);
+    MessageHistory& operator=(const MessageHistory& other);
+};
+
+#endif
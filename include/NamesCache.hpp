@@ -0,0 +1,43 @@
+#ifndef NAMES_CACHE_HPP
+# define NAMES_CACHE_HPP
+
+# include <string>
+# include <vector>
+# include <map>
+
+class Client;
+
+// A channel's NAMES list kept ready to send: space separated "[@|+]nick"
+// entries packed into chunks small enough for one 353 line each. Joins,
+// parts and prefix changes edit a single chunk instead of rebuilding the
+// whole list; chunks are repacked only once churn leaves them sparse.
+class NamesCache {
+public:
+    explicit NamesCache(size_t chunk_bytes);
+
+    void    add(Client* client, const std::string& entry);
+    void    update(Client* client, const std::string& entry);
+    void    remove(Client* client);
+    void    clear();
+
+    // May contain empty chunks; callers skip them
+    const std::vector<std::string>& chunks() const;
+    size_t  memoryUsage() const;
+
+private:
+    struct Slot {
+        size_t      chunk;
+        std::string entry;
+    };
+
+    std::vector<std::string>    _chunks;
+    std::map<Client*, Slot>     _slots;
+    size_t                      _chunk_bytes;
+    size_t                      _bytes;         // Sum of entry lengths plus separators
+
+    void        append(Slot& slot);
+    void        repack();
+    static bool eraseToken(std::string& chunk, const std::string& token);
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef OPEN_HASH_MAP_HPP
+# define OPEN_HASH_MAP_HPP
+
+# include <string>
+# include <vector>
+# include <stdint.h>
+# include "MemoryStats.hpp"
+
+// String-keyed hash table with open addressing and linear probing. Each
+// slot caches its key's hash so probes compare integers before strings and
+// growth never rehashes a key. Erased slots become tombstones that are
+// reused by inserts and dropped on the next resize.
+//
+// Iterate with capacity()/occupied(i)/keyAt(i)/valueAt(i); the order is
+// unspecified and changes when the table grows.
+template <typename V>
+class OpenHashMap {
+public:
+    OpenHashMap() : _slots(MIN_CAPACITY), _size(0), _used(0) {}
+
+    static uint32_t hash(const std::string& key) {
+        uint32_t h = 2166136261u;  // FNV-1a
+        for (size_t i = 0; i < key.size(); ++i) {
+            h ^= static_cast<unsigned char>(key[i]);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    V* find(const std::string& key) {
+        return find(key, hash(key));
+    }
+
+    const V* find(const std::string& key) const {
+        return find(key, hash(key));
+    }
+
+    // The overloads taking h let callers that keep the key's hash skip it
+    V* find(const std::string& key, uint32_t h) {
+        size_t index;
+        return lookup(key, h, index) ? &_slots[index].value : NULL;
+    }
+
+    const V* find(const std::string& key, uint32_t h) const {
+        size_t index;
+        return lookup(key, h, index) ? &_slots[index].value : NULL;
+    }
+
+    // Inserts or overwrites; returns true when the key was new
+    bool insert(const std::string& key, const V& value) {
+        return insert(key, hash(key), value);
+    }
+
+    bool insert(const std::string& key, uint32_t h, const V& value) {
+        size_t index;
+        if (lookup(key, h, index)) {
+            _slots[index].value = value;
+            return false;
+        }
+        if ((_used + 1) * 4 > _slots.size() * 3) {
+            resize((_size + 1) * 2);  // Also sweeps tombstones
+            lookup(key, h, index);
+        }
+        Slot& slot = _slots[index];
+        if (slot.state == EMPTY)
+            ++_used;
+        slot.state = FULL;
+        slot.hash = h;
+        slot.key = key;
+        slot.value = value;
+        ++_size;
+        return true;
+    }
+
+    bool erase(const std::string& key) {
+        return erase(key, hash(key));
+    }
+
+    bool erase(const std::string& key, uint32_t h) {
+        size_t index;
+        if (!lookup(key, h, index))
+            return false;
+        Slot& slot = _slots[index];
+        slot.state = DELETED;
+        slot.key.clear();
+        slot.value = V();
+        --_size;
+        return true;
+    }
+
+    void clear() {
+        std::vector<Slot>(MIN_CAPACITY).swap(_slots);
+        _size = 0;
+        _used = 0;
+    }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    // Slot array plus out-of-line key storage
+    size_t memoryUsage() const {
+        size_t total = _slots.capacity() * sizeof(Slot);
+        for (size_t i = 0; i < _slots.size(); ++i)
+            total += MemoryStats::stringBytes(_slots[i].key);
+        return total;
+    }
+
+    size_t capacity() const { return _slots.size(); }
+    bool occupied(size_t i) const { return _slots[i].state == FULL; }
+    const std::string& keyAt(size_t i) const { return _slots[i].key; }
+    V& valueAt(size_t i) { return _slots[i].value; }
+    const V& valueAt(size_t i) const { return _slots[i].value; }
+
+private:
+    enum State { EMPTY, FULL, DELETED };
+    static const size_t MIN_CAPACITY = 16;
+
+    struct Slot {
+        std::string key;
+        V           value;
+        uint32_t    hash;
+        uint8_t     state;
+
+        Slot() : value(), hash(0), state(EMPTY) {}
+    };
+
+    std::vector<Slot>   _slots;     // Capacity is always a power of two
+    size_t              _size;      // FULL slots
+    size_t              _used;      // FULL plus DELETED slots
+
+    // Finds key, or the slot an insert should use (first tombstone seen,
+    // else the terminating empty slot)
+    bool lookup(const std::string& key, uint32_t h, size_t& index) const {
+        size_t mask = _slots.size() - 1;
+        size_t i = h & mask;
+        size_t tombstone = _slots.size();
+        while (true) {
+            const Slot& slot = _slots[i];
+            if (slot.state == EMPTY) {
+                index = tombstone < _slots.size() ? tombstone : i;
+                return false;
+            }
+            if (slot.state == DELETED) {
+                if (tombstone == _slots.size())
+                    tombstone = i;
+            } else if (slot.hash == h && slot.key == key) {
+                index = i;
+                return true;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    void resize(size_t wanted) {
+        size_t capacity = MIN_CAPACITY;
+        while (capacity * 3 < wanted * 4)
+            capacity *= 2;
+
+        std::vector<Slot> old(capacity);
+        old.swap(_slots);
+        _used = _size;
+        size_t mask = capacity - 1;
+        for (size_t i = 0; i < old.size(); ++i) {
+            if (old[i].state != FULL)
+                continue;
+            size_t j = old[i].hash & mask;
+            while (_slots[j].state != EMPTY)
+                j = (j + 1) & mask;
+            _slots[j].state = FULL;
+            _slots[j].hash = old[i].hash;
+            _slots[j].key.swap(old[i].key);
+            _slots[j].value = old[i].value;
+        }
+    }
+
+    OpenHashMap(const OpenHashMap& other);
+    OpenHashMap& operator=(const OpenHashMap& other);
+};
+
+#endif
@@ -2,28 +2,108 @@
 # define SERVER_HPP
 
 # include "common.hpp"
+# include "TimerWheel.hpp"
+# include "ConnectionThrottle.hpp"
+# include "ChannelStore.hpp"
+# include "LinkManager.hpp"
+# include "MessageHistory.hpp"
+# include "OpenHashMap.hpp"
+# include "ChannelRegistry.hpp"
+# include "CommandProfiler.hpp"
+# include "CredentialPool.hpp"
+# include "AccountStore.hpp"
+# include "FanoutPool.hpp"
+# include "ServerConfig.hpp"
+# include <deque>
 
 class Client;
 class Channel;
 class CommandHandler;
+class StateWriter;
+class StateReader;
+struct MemoryStats;
 
 class Server {
+public:
+    // Client input reads (STATS r)
+    struct ReadStats {
+        uint64_t    events;         // POLLIN on a connection
+        uint64_t    reads;          // readv calls that returned data
+        uint64_t    bytes;
+        uint64_t    budget_stops;   // Events that ended with input possibly left
+        size_t      max_read;       // Most bytes from one readv
+        size_t      max_reads;      // Most readv calls in one event
+    };
+
 private:
     static Server* _instance;  // Add static pointer to instance
+    static volatile sig_atomic_t _upgrade_requested;
+    static volatile sig_atomic_t _reload_requested;
+    static volatile sig_atomic_t _shutdown_requested;
     int                         _socket_fd;
-    int                         _port;
+    ServerConfig                _config;
+    std::string                 _config_path;  // Read again on SIGHUP, empty when none
     std::string                 _password;
     std::vector<pollfd>        _poll_fds;
     std::map<int, Client*>     _clients;
-    std::map<std::string, Channel*> _channels;
+    ChannelRegistry            _channels;
     CommandHandler*            _command_handler;
-    static const std::string   _hostname;
+    TimerWheel                 _timers;
+    ConnectionThrottle         _throttle;
+    Timer                      _throttle_gc_timer;
+    ChannelStore               _store;
+    Timer                      _store_timer;
+    LinkManager                _links;
+    MessageHistory             _history;
+    std::string                _hostname;
+    std::string                _executable;
+    uint64_t                   _peer_epoch;
+    int                        _text_policy;  // TextPolicy bits for all message text
+    std::map<std::string, std::string> _opers;  // OPER name to password
+    CommandProfiler            _profiler;
+    CredentialPool             _credentials;
+    AccountStore               _accounts;
+    FanoutPool                 _fanout;
+
+    // User indexes shared by local and remote users
+    OpenHashMap<Client*>       _nicks;  // Casefolded nickname
+    std::multimap<std::string, Client*> _hosts;  // Reversed casefolded host
+    std::set<int>              _listings;  // Clients with a LIST in progress
+    std::deque<std::pair<int, uint64_t> > _run_queue;  // fd and id of clients with lines left
+    std::vector<Client*>       _teardown;  // Closing clients, freed by reapClients()
+    char                       _recv_buffer[RECV_BUFFER_SIZE];  // Shared by every read
+    ReadStats                  _read_stats;
 
     // Private member functions
     bool    setupSocket();
-    void    handleNewConnection();
+    static int openListener(int port, int backlog);
+    void    replacePollFd(int old_fd, int new_fd);
+    void    applyLimits();
+    void    reloadConfig();
+    void    initialize();
+    void    loadChannels();
+    void    handleNewConnection(int listen_fd);
     void    handleClientMessage(int client_fd);
-    void    removeClient(int client_fd);
+    bool    takeInput(Client* client, size_t held, size_t size);
+    bool    processLines(Client* client, size_t& quantum);
+    size_t  quantumFor(const Client* client) const;
+    bool    consumeLines(Client* client, const char* data, size_t size, size_t& used, size_t& quantum);
+    void    applyCredentialResults(const std::vector<CredentialPool::Result>& results);
+    void    removeClient(int client_fd, const std::string& reason = "Connection closed");
+    void    reapClients();
+    void    runTimers();
+    void    handleTimer(Timer* timer);
+    void    handlePingTimer(Client* client);
+    void    addPollFd(int fd);
+    void    serviceSendQueues();
+    bool    serviceListings();
+    bool    serviceRunQueue();
+    void    schedule(Client* client);
+
+    // Binary upgrade (Upgrade.cpp)
+    bool    upgrade();
+    void    serializeState(StateWriter& out, std::vector<int>& fds) const;
+    void    restoreState(StateReader& in, const std::vector<int>& fds);
 
     void clearPollFds() {
         std::vector<pollfd>().swap(_poll_fds);  // Force deallocation
@@ -39,11 +119,25 @@ public:
 
     static void setInstance(Server* server) { _instance = server; }  // Add setter
     static Server* getInstance() { return _instance; }  // Add getter
+    static void requestUpgrade() { _upgrade_requested = 1; }  // Async-signal-safe
+    static void requestReload() { _reload_requested = 1; }    // Async-signal-safe
+    static void requestShutdown() { _shutdown_requested = 1; }  // Async-signal-safe
 
     // Public member functions
     bool    start();
     void    run();
     void    stop();
+    bool    resume(int handoff_fd);
+    void    setExecutable(const std::string& path);
+    void    setConfigPath(const std::string& path);
+    void    configure(const ServerConfig& config);  // Before start() or between loop turns
+    const ServerConfig& getConfig() const;
+    void    setHostname(const std::string& name);
+    void    setTextPolicy(int policy);
+    void    addOper(const std::string& name, const std::string& password);
+    bool    findOper(const std::string& name, std::string& password) const;
+    bool    hasOpers() const;
+    bool    hasHashedOpers() const;  // Any OPER password is a crypt hash
 
     // Channel operations
     Channel* createChannel(const std::string& name);
@@ -51,11 +145,45 @@ public:
     void    removeChannel(const std::string& name);
     void    broadcastToChannel(const std::string& channel_name, const std::string& message, Client* exclude = NULL);
 
+    // Connection lifecycle
+    void    onClientRegistered(Client* client);
+    void    disconnectClient(Client* client, const std::string& reason);
+    Client* addConnection(int fd, const struct sockaddr_storage& addr,
+                          const std::string& hostname, bool server_link);
+    void    setPollEvents(int fd, short events);  // POLLIN stays off while runnable
+    void    setPollInput(int fd, bool enabled);
+    void    sendToPeers(Client* client, const SharedLine& line, bool include_self);
+    void    leaveAllChannels(Client* client);
+    void    dropInvites(Client* client);      // Before the record is freed or reused
+    void    startListing(Client* client);
+
+    // Server links
+    LinkManager&    getLinks();
+    void    propagate(const std::string& line, Client* except = NULL);
+    TimerWheel&     getTimers();
+    CommandProfiler& getProfiler();
+    CredentialPool& getCredentials();
+    const ReadStats& getReadStats() const;
+    AccountStore&   getAccounts();
+    FanoutPool&     getFanout();
+
+    // User indexes
+    void    indexUser(Client* client);
+    void    renameUser(Client* client, const std::string& old_nickname);
+    void    unindexUser(Client* client);
+    const OpenHashMap<Client*>& getNickIndex() const;
+    size_t  findByHostSuffix(const std::string& suffix, std::vector<Client*>& out, size_t limit) const;
+
+    // Walks every client, channel and index (STATS z)
+    void    accountMemory(MemoryStats& stats) const;
+
     // Getters
     const std::string&  getPassword() const;
-    const std::map<std::string, Channel*>& getChannels() const;
+    const ChannelRegistry& getChannels() const;
+    const std::map<int, Client*>& getClients() const;
     Client* getClientByNickname(const std::string& nickname) const;
     const std::string& getHostname() const;
+    int     getTextPolicy() const;
 };
 
 #endif 
\ No newline at end of file
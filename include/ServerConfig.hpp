@@ -0,0 +1,49 @@
+#ifndef SERVER_CONFIG_HPP
+# define SERVER_CONFIG_HPP
+
+# include "common.hpp"
+# include <stdint.h>
+
+class StateWriter;
+class StateReader;
+
+// Listeners and limits an operator can tune without a rebuild. Values
+// start at the compile-time defaults; a file given with --config
+// overrides them and is read again on SIGHUP.
+//
+// The file holds one "key = value" per line, '#' starts a comment. Keys
+// left out keep their current value; an unknown key or a value out of
+// range rejects the whole file.
+struct ServerConfig {
+    size_t      port;
+    size_t      link_port;              // 0: no link listener
+    size_t      listen_backlog;
+    size_t      max_clients;            // Local user connections, 0 for no limit
+    size_t      max_clones_per_host;
+    size_t      connect_burst;          // Connects a host may make back to back
+    size_t      connect_interval;       // ms per connect once the burst is spent
+    size_t      input_buffer_max;       // Bytes held for one client's unrun lines
+    size_t      read_budget;            // Reads per client per poll wakeup
+    size_t      command_quantum;        // Lines run per client per loop turn
+    size_t      sendq_max;
+    size_t      sendq_link_max;
+    size_t      registration_timeout;   // ms
+    size_t      ping_interval;          // ms
+    size_t      ping_timeout;           // ms
+    size_t      nick_length;
+    size_t      channel_length;
+    size_t      log_level;              // Logger::Level; the file takes its name
+    size_t      fanout_threads;
+    size_t      fanout_threshold;
+    size_t      max_targets;            // PRIVMSG/NOTICE recipients, WHOIS nicks
+
+    ServerConfig();
+
+    bool    load(const std::string& path);  // False leaves every value as it was
+    std::string changedKeys(const ServerConfig& other) const;  // Comma separated
+
+    void    write(StateWriter& out) const;
+    void    read(StateReader& in);
+};
+
+#endif
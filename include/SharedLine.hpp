@@ -0,0 +1,34 @@
+#ifndef SHARED_LINE_HPP
+# define SHARED_LINE_HPP
+
+# include <string>
+# include <cstddef>
+
+// Immutable, reference-counted protocol line. Copies share one buffer so a
+// line can sit in several queues and history rings without duplication.
+class SharedLine {
+public:
+    SharedLine();
+    explicit SharedLine(const std::string& text);
+    SharedLine(const SharedLine& other);
+    SharedLine& operator=(const SharedLine& other);
+    ~SharedLine();
+
+    const std::string&  str() const;
+    const char*         data() const;
+    size_t              size() const;
+    bool                empty() const;
+    size_t              refs() const;
+
+private:
+    struct Body {
+        std::string text;
+        size_t      refs;
+    };
+
+    Body*   _body;
+
+    void    release();
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef STATE_CODEC_HPP
+# define STATE_CODEC_HPP
+
+# include <string>
+# include <cstddef>
+# include <stdint.h>
+
+// Little-endian binary encoding used to persist and hand off server state.
+class StateWriter {
+private:
+    std::string _buffer;
+
+public:
+    StateWriter();
+
+    void    putU8(uint8_t value);
+    void    putU32(uint32_t value);
+    void    putU64(uint64_t value);
+    void    putString(const std::string& value);
+    void    putBytes(const void* data, size_t len);
+
+    const std::string& data() const;
+    void    clear();
+};
+
+// Bounds-checked reader over a borrowed buffer.
+// Throws std::runtime_error when the input is truncated.
+class StateReader {
+private:
+    const unsigned char*    _data;
+    size_t                  _size;
+    size_t                  _pos;
+
+    void    require(size_t len) const;
+
+public:
+    StateReader(const void* data, size_t size);
+
+    uint8_t     getU8();
+    uint32_t    getU32();
+    uint64_t    getU64();
+    std::string getString();
+    void        getBytes(void* out, size_t len);
+
+    bool    atEnd() const;
+    size_t  position() const;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef TEXT_FILTER_HPP
+# define TEXT_FILTER_HPP
+
+# include <string>
+
+// Message text policies, set server-wide and per channel (+U, +S)
+enum TextPolicy {
+    TEXT_UTF8ONLY = 1,  // Reject text that is not valid UTF-8
+    TEXT_SCRUB = 2      // Strip NUL, BEL and CR from text
+};
+
+// Checks on inbound message text, run once per line before fan-out so
+// every target's policy is answered from the same scan.
+//
+// With AVX2 the UTF-8 check is the branch-free lookup-table validator
+// (Keiser & Lemire), 32 bytes per step with an all-ASCII shortcut; other
+// CPUs use a scalar validator that skips ASCII a word at a time.
+class TextFilter {
+public:
+    struct Scan {
+        bool    utf8;       // Valid UTF-8
+        bool    controls;   // Contains a byte TEXT_SCRUB removes
+    };
+
+    static Scan         scan(const std::string& text);
+    static bool         isUtf8(const std::string& text);
+    static std::string  scrub(const std::string& text);
+
+    static const char*  kernelName();  // "avx2" or "scalar"
+    // Tests and benchmarks: switch to a named kernel if this CPU runs it.
+    // Not thread-safe; call before any other thread uses TextFilter.
+    static bool         useKernel(const std::string& name);
+
+private:
+    TextFilter() {}
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef TIMER_WHEEL_HPP
+# define TIMER_WHEEL_HPP
+
+# include <cstddef>
+# include <stdint.h>
+
+// Intrusive timer node. Owners embed one Timer per purpose so that arming
+// and cancelling never allocate and cost O(1).
+struct Timer {
+    Timer*      prev;
+    Timer*      next;
+    uint64_t    expires;    // Absolute tick
+    int         kind;
+    void*       owner;
+
+    Timer() : prev(NULL), next(NULL), expires(0), kind(0), owner(NULL) {}
+    bool isArmed() const { return next != NULL; }
+};
+
+// Hierarchical hashed timer wheel (four levels of 64 slots).
+// Level 0 covers the next 64 ticks one slot per tick; each higher level
+// covers 64 times the span of the one below and is cascaded down lazily.
+class TimerWheel {
+public:
+    static const uint64_t TICK_MS = 100;
+
+    TimerWheel();
+    ~TimerWheel();
+
+    static uint64_t monotonicMs();
+
+    void    arm(Timer* timer, uint64_t delay_ms);
+    void    cancel(Timer* timer);
+
+    // Move every timer due at now_ms to the expired list, then pop them
+    // one by one. Cancelling a timer still on the expired list is safe.
+    void    advance(uint64_t now_ms);
+    Timer*  popExpired();
+
+    // Milliseconds until the wheel needs servicing, or -1 when idle.
+    int     msUntilNext(uint64_t now_ms) const;
+    size_t  size() const;
+
+private:
+    static const unsigned LEVELS = 4;
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned SLOTS = 1 << SLOT_BITS;
+    static const unsigned SLOT_MASK = SLOTS - 1;
+
+    Timer       _slots[LEVELS][SLOTS];  // Sentinels of circular lists
+    Timer       _expired;
+    uint64_t    _tick;                  // Next tick to process
+    size_t      _count;
+
+    void    place(Timer* timer);
+    void    cascade(unsigned level, unsigned index);
+    static void link(Timer* head, Timer* timer);
+    static void unlink(Timer* timer);
+
+    TimerWheel(const TimerWheel& other);
+    TimerWheel& operator=(const TimerWheel& other);
+};
+
+#endif
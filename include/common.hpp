@@ -18,19 +18,110 @@
 # include <poll.h>
 # include <signal.h>
 
-# define MAX_CLIENTS 100
+// Defaults below marked (config) can be changed at run time, see ServerConfig
+# define MAX_CLIENTS 0              // Local user connections, 0 for no limit (config)
+# define LISTEN_BACKLOG 5           // (config)
 # define BUFFER_SIZE 512
+# define RECV_BUFFER_SIZE 16384     // One per server; clients only keep partial lines
+# define RECV_READ_BUDGET 4         // Reads per client per poll wakeup (config)
+# define COMMAND_QUANTUM 8          // Lines run per client per loop turn (config)
+# define CLIENT_POOL_MAX 256        // Freed client records kept for reuse
+
+// Channel fan-out on sender threads (off unless threads are configured)
+# define FANOUT_THRESHOLD 1000      // Local members before a line goes to the pool (config)
+# define FANOUT_MAX_THREADS 16
 # define SERVER_NAME "ft_irc"
 # define SERVER_VERSION "1.0"
+# define MAX_TARGETS 20  // Default for ServerConfig::max_targets
+# define NICK_LENGTH 9              // (config)
+# define CHANNEL_LENGTH 50          // (config)
+# define NAMES_CHUNK_BYTES 350  // Leaves room for the 353 prefix within 512 bytes
+
+// Output queues (bytes, config)
+# define MAX_SENDQ (1 << 20)
+# define MAX_SENDQ_LINK (16 << 20)  // Bursts carry every user and channel
+
+// WHO/WHOIS
+# define WHO_MAX_ROWS 200
+# define WHOIS_MAX_MATCHES 10
+# define WHO_SENDQ_SOFT (64 << 10)  // Stop a listing once the reader falls this far behind
+
+// LIST streaming
+# define LIST_SENDQ_SOFT (16 << 10)  // Resume once the queue drains below this
+# define LIST_SCAN_BUDGET 512       // Channels examined per client per tick
+
+// Credential verification
+# define CREDENTIAL_WORKERS 2
+# define CREDENTIAL_QUEUE_MAX 64    // Checks waiting for a worker before PASS is refused
+# define RPL_TRYAGAIN 263
+
+// Accounts and SASL
+# define ACCOUNT_STORE_PATH "ircserv.accounts"
+# define ACCOUNT_PASSWORD_MIN 8
+# define SASL_CHUNK 400             // AUTHENTICATE payload line; a full one means more follows
+# define SASL_PAYLOAD_MAX 1200      // Base64 bytes for one PLAIN exchange
+
+// Keepalive (milliseconds, config)
+# define REGISTRATION_TIMEOUT 60000
+# define PING_INTERVAL 120000
+# define PING_TIMEOUT 60000
+
+// Per-host connection limits (config)
+# define MAX_CLONES_PER_HOST 10
+# define CONNECT_BURST 10
+# define CONNECT_INTERVAL 1000
+# define THROTTLE_GC_INTERVAL 60000
+
+// Channel persistence
+# define CHANNEL_STORE_PATH "ircserv.channels"
+# define CHANNEL_COMPACT_BYTES (1 << 20)
+# define CHANNEL_STORE_INTERVAL 5000
+# define CHANNEL_COMPACT_TIMEOUT 60000  // ms before a compactor is killed
+
+// Channel history
+# define HISTORY_LENGTH 100
+# define HISTORY_MAX_BYTES (8 << 20)
+# define CHATHISTORY_LIMIT 100
+
+// Server links
+# define LINK_RETRY_INTERVAL 30000
+
+// Timer kinds dispatched by Server::handleTimer
+enum TimerKind {
+    TIMER_REGISTRATION,
+    TIMER_PING,
+    TIMER_THROTTLE_GC,
+    TIMER_STORE_MAINTENANCE,
+    TIMER_LINK_RETRY
+};
 
 // IRC Reply Codes
 # define RPL_WELCOME 001
+# define RPL_ISUPPORT 005
 # define RPL_TOPIC 332
 # define RPL_NOTOPIC 331
 # define RPL_NAMREPLY 353
 # define RPL_ENDOFNAMES 366
 # define RPL_INVITING 341
+# define RPL_LISTSTART 321
+# define RPL_LIST 322
+# define RPL_LISTEND 323
 # define RPL_CHANNELMODEIS 324
+# define RPL_WHOISUSER 311
+# define RPL_WHOISSERVER 312
+# define RPL_ENDOFWHO 315
+# define RPL_WHOISIDLE 317
+# define RPL_ENDOFWHOIS 318
+# define RPL_WHOISCHANNELS 319
+# define RPL_WHOREPLY 352
+# define RPL_STATSCOMMANDS 212
+# define RPL_ENDOFSTATS 219
+# define RPL_STATSDEBUG 249
+# define RPL_YOUREOPER 381
+# define RPL_WHOISACCOUNT 330
+# define RPL_LOGGEDIN 900
+# define RPL_SASLSUCCESS 903
+# define RPL_SASLMECHS 908
 
 // IRC Error Codes
 # define ERR_NOSUCHNICK 401
@@ -42,11 +133,13 @@
 # define ERR_TOOMANYTARGETS 407
 # define ERR_NOSUCHSERVICE 408
 # define ERR_NOORIGIN 409
+# define ERR_INVALIDCAPCMD 410
 # define ERR_NORECIPIENT 411
 # define ERR_NOTEXTTOSEND 412
 # define ERR_NOTOPLEVEL 413
 # define ERR_WILDTOPLEVEL 414
 # define ERR_BADMASK 415
+# define ERR_TOOMANYMATCHES 416
 # define ERR_UNKNOWNCOMMAND 421
 # define ERR_NOMOTD 422
 # define ERR_NOADMININFO 423
@@ -88,5 +181,9 @@
 # define ERR_USERSDONTMATCH 502
 # define ERR_INVALIDKEY 525
 # define ERR_INVALIDMODEPARAM 696
+# define ERR_SASLFAIL 904
+# define ERR_SASLTOOLONG 905
+# define ERR_SASLABORTED 906
+# define ERR_SASLALREADY 907
 
 #endif 
\ No newline at end of file
@@ -2,13 +2,23 @@
 #include "../../include/Client.hpp"
 #include "../../include/Logger.hpp"
 #include "../../include/Server.hpp"
+#include "../../include/ChannelStore.hpp"
+#include "../../include/CaseMapping.hpp"
+#include "../../include/OpenHashMap.hpp"
+#include "../../include/MemoryStats.hpp"
 #include <algorithm>  // for std::find
 
 Channel::Channel(const std::string& name)
-    : _name(name), _topic(""), _invite_only(false), _topic_restricted(false), _user_limit(0), _server(NULL) {
+    : _name(name), _folded_name(CaseMapping::fold(name)),
+      _name_hash(OpenHashMap<Channel*>::hash(_folded_name)), _registry_prev(NULL), _registry_next(NULL),
+      _topic(""), _topicTime(0), _created(time(NULL)), _invite_only(false), _topic_restricted(false), _user_limit(0), _text_policy(0), _server(NULL), _store(NULL),
+      _history(HISTORY_LENGTH), _names(NAMES_CHUNK_BYTES), _history_budget(NULL) {
 }
 
 Channel::~Channel() {
+    if (_history_budget)
+        _history_budget->forget(_history);
+
     // Remove all clients from the channel
     _clients.clear();
     _operators.clear();
@@ -19,6 +29,14 @@ const std::string& Channel::getName() const {
     return _name;
 }
 
+const std::string& Channel::getFoldedName() const {
+    return _folded_name;
+}
+
+uint32_t Channel::getNameHash() const {
+    return _name_hash;
+}
+
 const std::string& Channel::getTopic() const {
     return _topic;
 }
@@ -31,6 +49,10 @@ time_t Channel::getTopicTime() const {
     return _topicTime;
 }
 
+time_t Channel::getCreationTime() const {
+    return _created;
+}
+
 const std::string& Channel::getPassword() const {
     return _password;
 }
@@ -55,6 +77,14 @@ size_t Channel::getUserLimit() const {
     return _user_limit;
 }
 
+int Channel::getTextPolicy() const {
+    return _text_policy;
+}
+
+const std::string& Channel::getFounder() const {
+    return _founder;
+}
+
 bool Channel::hasKey() const {
     return !_password.empty();
 }
@@ -71,6 +101,10 @@ bool Channel::isVoiced(Client* client) const {
     return std::find(_voiced_clients.begin(), _voiced_clients.end(), client) != _voiced_clients.end();
 }
 
+const std::vector<Client*>& Channel::getInvitedClients() const {
+    return _invited_clients;
+}
+
 // Setters
 void Channel::setTopic(const std::string& topic, Client* client) {
     if (_topic_restricted && !isOperator(client)) {
@@ -88,6 +122,8 @@ void Channel::setTopic(const std::string& topic, Client* client) {
     _topic = topic;
     _topicSetter = client->getNickname();
     _topicTime = time(NULL);
+    if (_store)
+        _store->logTopic(_name, _topic, _topicSetter, _topicTime);
     
     // Broadcast topic change to channel
     std::string topicMsg = ":";
@@ -101,33 +137,72 @@ void Channel::setTopic(const std::string& topic, Client* client) {
     topicMsg += " :";
     topicMsg += topic;
     topicMsg += "\r\n";
-    broadcast(topicMsg);
+    broadcastLocal(topicMsg);
+    if (_server)
+        _server->propagate(topicMsg);
+}
+
+// Reinstates a topic without announcing it (state handoff and replay)
+void Channel::restoreTopic(const std::string& topic, const std::string& setter, time_t when) {
+    _topic = topic;
+    _topicSetter = setter;
+    _topicTime = when;
+}
+
+// Topic change decided elsewhere (a peer server): persist, don't announce
+void Channel::applyTopic(const std::string& topic, const std::string& setter) {
+    _topic = topic;
+    _topicSetter = setter;
+    _topicTime = time(NULL);
+    if (_store)
+        _store->logTopic(_name, _topic, _topicSetter, _topicTime);
 }
 
 void Channel::setPassword(const std::string& password) {
-    _password = password;
+    setKey(password);
 }
 
 void Channel::setInviteOnly(bool invite_only) {
     _invite_only = invite_only;
+    if (_store)
+        _store->logInviteOnly(_name, invite_only);
 }
 
 void Channel::setTopicRestricted(bool status) {
     _topic_restricted = status;
+    if (_store)
+        _store->logTopicRestricted(_name, status);
+}
+
+void Channel::setTextPolicy(int policy) {
+    _text_policy = policy;
+    if (_store)
+        _store->logTextPolicy(_name, policy);
+}
+
+void Channel::setFounder(const std::string& account) {
+    _founder = account;
+    if (_store)
+        _store->logFounder(_name, account);
 }
 
 void Channel::setUserLimit(size_t limit) {
     _user_limit = limit;
+    if (_store)
+        _store->logUserLimit(_name, limit);
 }
 
 void Channel::setKey(const std::string& key) {
     _password = key;
+    if (_store)
+        _store->logKey(_name, key);
 }
 
 // Client operations
 void Channel::addClient(Client* client) {
     if (!hasClient(client)) {
         _clients.push_back(client);
+        _names.add(client, nameEntry(client));
         Logger::debug("Added client " + client->getNickname() + " to channel " + _name);
     }
 }
@@ -136,11 +211,13 @@ void Channel::removeClient(Client* client) {
     for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
         if (*it == client) {
             _clients.erase(it);
+            _names.remove(client);
             Logger::debug("Removed client " + client->getNickname() + " from channel " + _name);
             break;
         }
     }
     removeOperator(client);
+    removeVoice(client);
     removeInvite(client);
 }
 
@@ -155,6 +232,7 @@ bool Channel::hasClient(Client* client) const {
 void Channel::addOperator(Client* client) {
     if (!isOperator(client)) {
         _operators.push_back(client);
+        refreshName(client);
         Logger::debug("Added operator " + client->getNickname() + " to channel " + _name);
     }
 }
@@ -163,12 +241,30 @@ void Channel::removeOperator(Client* client) {
     for (std::vector<Client*>::iterator it = _operators.begin(); it != _operators.end(); ++it) {
         if (*it == client) {
             _operators.erase(it);
+            refreshName(client);
             Logger::debug("Removed operator " + client->getNickname() + " from channel " + _name);
             break;
         }
     }
 }
 
+// NAMES entry: highest prefix first, as in RPL_NAMREPLY
+std::string Channel::nameEntry(Client* client) const {
+    if (isOperator(client))
+        return "@" + client->getNickname();
+    if (isVoiced(client))
+        return "+" + client->getNickname();
+    return client->getNickname();
+}
+
+void Channel::refreshName(Client* client) {
+    _names.update(client, nameEntry(client));
+}
+
+const std::vector<std::string>& Channel::getNamesChunks() const {
+    return _names.chunks();
+}
+
 bool Channel::isOperator(Client* client) const {
     for (std::vector<Client*>::const_iterator it = _operators.begin(); it != _operators.end(); ++it) {
         if (*it == client)
@@ -204,27 +300,106 @@ bool Channel::isInvited(Client* client) const {
 }
 
 // Message broadcasting
-void Channel::broadcast(const std::string& message, Client* exclude) {
+void Channel::broadcast(const std::string& message, Client* exclude, Client* from_link) {
+    std::vector<Client*> links;
+    FanoutPool* fanout = fanoutFor();
+    std::vector<Client*> locals;
+
     // Send to all clients in the channel, including the sender unless excluded
     for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (*it != exclude) {
-            send((*it)->getFd(), message.c_str(), message.length(), 0);
+        if (*it == exclude)
+            continue;
+        if ((*it)->isRemote()) {
+            // Remote members share one copy per link; never echo back upstream
+            Client* uplink = (*it)->getUplink();
+            if (uplink != from_link && std::find(links.begin(), links.end(), uplink) == links.end())
+                links.push_back(uplink);
+            continue;
         }
+        if (fanout)
+            locals.push_back(*it);
+        else
+            (*it)->sendRaw(message);
     }
+    if (fanout)
+        fanout->deliver(SharedLine(message), locals);
+    for (std::vector<Client*>::iterator it = links.begin(); it != links.end(); ++it)
+        (*it)->sendRaw(message);
+
     // If the sender is excluded, send to them too (for their own messages)
-    if (exclude && hasClient(exclude)) {
-        send(exclude->getFd(), message.c_str(), message.length(), 0);
+    if (exclude && !exclude->isRemote() && hasClient(exclude)) {
+        exclude->sendRaw(message);
     }
 }
 
+void Channel::broadcastLocal(const std::string& message, Client* exclude) {
+    FanoutPool* fanout = fanoutFor();
+    std::vector<Client*> locals;
+    for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        if (*it == exclude || (*it)->isRemote())
+            continue;
+        if (fanout)
+            locals.push_back(*it);
+        else
+            (*it)->sendRaw(message);
+    }
+    if (fanout)
+        fanout->deliver(SharedLine(message), locals);
+}
+
+// The sender pool, when this channel is big enough to be worth splitting
+FanoutPool* Channel::fanoutFor() const {
+    if (!_server || !_server->getFanout().accepts(_clients.size()))
+        return NULL;
+    return &_server->getFanout();
+}
+
 void Channel::setServer(Server* server) {
     _server = server;
 }
 
+void Channel::setStore(ChannelStore* store) {
+    _store = store;
+}
+
+void Channel::setHistory(MessageHistory* budget) {
+    _history_budget = budget;
+}
+
+void Channel::addHistory(const SharedLine& line) {
+    if (_history_budget)
+        _history_budget->record(_history, line);
+}
+
+const HistoryRing& Channel::getHistory() const {
+    return _history;
+}
+
+void Channel::accountMemory(MemoryStats& stats) const {
+    stats.add(MemoryStats::MEM_CHANNELS, sizeof(Channel) + MemoryStats::stringBytes(_name)
+              + MemoryStats::stringBytes(_folded_name) + MemoryStats::stringBytes(_password), 1);
+
+    size_t members = MemoryStats::vectorBytes(_clients) + MemoryStats::vectorBytes(_operators)
+                   + MemoryStats::vectorBytes(_voiced_clients) + MemoryStats::vectorBytes(_invited_clients)
+                   + _names.memoryUsage();
+    stats.add(MemoryStats::MEM_MEMBERS, members, _clients.size());
+
+    size_t bans = MemoryStats::vectorBytes(_ban_list);
+    for (size_t i = 0; i < _ban_list.size(); ++i)
+        bans += MemoryStats::stringBytes(_ban_list[i]);
+    stats.add(MemoryStats::MEM_BANS, bans, _ban_list.size());
+
+    stats.add(MemoryStats::MEM_TOPICS, MemoryStats::stringBytes(_topic) + MemoryStats::stringBytes(_topicSetter),
+              _topic.empty() ? 0 : 1);
+    stats.add(MemoryStats::MEM_HISTORY, _history.memoryUsage(), _history.size());
+}
+
 // Ban operations
 void Channel::addBan(const std::string& mask) {
     if (!isBanned(mask)) {
         _ban_list.push_back(mask);
+        if (_store)
+            _store->logBan(_name, mask, true);
         Logger::debug("Added ban mask " + mask + " to channel " + _name);
     }
 }
@@ -233,6 +408,8 @@ void Channel::removeBan(const std::string& mask) {
     for (std::vector<std::string>::iterator it = _ban_list.begin(); it != _ban_list.end(); ++it) {
         if (*it == mask) {
             _ban_list.erase(it);
+            if (_store)
+                _store->logBan(_name, mask, false);
             Logger::debug("Removed ban mask " + mask + " from channel " + _name);
             break;
         }
@@ -271,6 +448,7 @@ const std::vector<std::string>& Channel::getBanList() const {
 void Channel::addVoice(Client* client) {
     if (!isVoiced(client)) {
         _voiced_clients.push_back(client);
+        refreshName(client);
     }
 }
 
@@ -278,5 +456,6 @@ void Channel::removeVoice(Client* client) {
     std::vector<Client*>::iterator it = std::find(_voiced_clients.begin(), _voiced_clients.end(), client);
     if (it != _voiced_clients.end()) {
         _voiced_clients.erase(it);
+        refreshName(client);
     }
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "../../include/ChannelRegistry.hpp"
+#include "../../include/Channel.hpp"
+#include "../../include/CaseMapping.hpp"
+
+ChannelRegistry::ChannelRegistry() : _head(NULL), _tail(NULL) {
+}
+
+Channel* ChannelRegistry::find(const std::string& name) const {
+    Channel* const* channel = _table.find(CaseMapping::fold(name));
+    return channel ? *channel : NULL;
+}
+
+void ChannelRegistry::insert(Channel* channel) {
+    _table.insert(channel->getFoldedName(), channel->getNameHash(), channel);
+    channel->_registry_prev = _tail;
+    channel->_registry_next = NULL;
+    if (_tail)
+        _tail->_registry_next = channel;
+    else
+        _head = channel;
+    _tail = channel;
+}
+
+void ChannelRegistry::erase(Channel* channel) {
+    if (!_table.erase(channel->getFoldedName(), channel->getNameHash()))
+        return;
+    if (channel->_registry_prev)
+        channel->_registry_prev->_registry_next = channel->_registry_next;
+    else
+        _head = channel->_registry_next;
+    if (channel->_registry_next)
+        channel->_registry_next->_registry_prev = channel->_registry_prev;
+    else
+        _tail = channel->_registry_prev;
+    channel->_registry_prev = NULL;
+    channel->_registry_next = NULL;
+}
+
+void ChannelRegistry::clear() {
+    _table.clear();
+    _head = NULL;
+    _tail = NULL;
+}
+
+size_t ChannelRegistry::size() const {
+    return _table.size();
+}
+
+size_t ChannelRegistry::memoryUsage() const {
+    return _table.memoryUsage();
+}
+
+Channel* ChannelRegistry::first() const {
+    return _head;
+}
+
+Channel* ChannelRegistry::next(const Channel* channel) {
+    return channel->_registry_next;
+}
+
+Channel* ChannelRegistry::prev(const Channel* channel) {
+    return channel->_registry_prev;
+}
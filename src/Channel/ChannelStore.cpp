@@ -0,0 +1,500 @@
+#include "../../include/ChannelStore.hpp"
+#include "../../include/Channel.hpp"
+#include "../../include/ChannelRegistry.hpp"
+#include "../../include/Logger.hpp"
+#include "../../include/StateCodec.hpp"
+#include "../../include/TimerWheel.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+const uint32_t SNAPSHOT_MAGIC = 0x49524353;  // "IRCS"
+const uint32_t SNAPSHOT_VERSION = 2;       // 2 adds the founder
+
+// Read-only private mapping of a whole file
+class MappedFile {
+private:
+    void*   _data;
+    size_t  _size;
+
+    MappedFile(const MappedFile& other);
+    MappedFile& operator=(const MappedFile& other);
+
+public:
+    MappedFile(const std::string& path) : _data(NULL), _size(0) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, st.st_size, MADV_SEQUENTIAL);
+                _data = data;
+                _size = st.st_size;
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (_data)
+            munmap(_data, _size);
+    }
+
+    const void* data() const { return _data; }
+    size_t size() const { return _size; }
+};
+
+bool fileExists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+bool writeAll(int fd, const std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t n = write(fd, data.data() + offset, data.size() - offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        offset += n;
+    }
+    return true;
+}
+
+}
+
+ChannelStore::State::State()
+    : topic_time(0), invite_only(false), topic_restricted(false), user_limit(0), text_policy(0) {
+}
+
+bool ChannelStore::State::isDefault() const {
+    return topic.empty() && key.empty() && !invite_only && !topic_restricted
+        && user_limit == 0 && text_policy == 0 && bans.empty();
+}
+
+ChannelStore::ChannelStore(const std::string& path)
+    : _path(path), _journal_fd(-1), _generation(0), _snapshot_generation(1),
+      _journal_bytes(0), _compactor(0), _compact_generation(0), _compact_started(0) {
+}
+
+ChannelStore::~ChannelStore() {
+    close();
+}
+
+std::string ChannelStore::journalPath(uint64_t generation) const {
+    std::ostringstream path;
+    path << _path << ".journal." << generation;
+    return path.str();
+}
+
+ChannelStore::State ChannelStore::stateOf(const Channel& channel) {
+    State state;
+    state.topic = channel.getTopic();
+    state.topic_setter = channel.getTopicSetter();
+    state.topic_time = channel.getTopicTime();
+    state.key = channel.getKey();
+    state.invite_only = channel.isInviteOnly();
+    state.topic_restricted = channel.isTopicRestricted();
+    state.user_limit = channel.getUserLimit();
+    state.text_policy = channel.getTextPolicy();
+    state.bans = channel.getBanList();
+    state.founder = channel.getFounder();
+    return state;
+}
+
+bool ChannelStore::loadSnapshot(std::map<std::string, State>& out) {
+    MappedFile file(_path);
+    if (!file.data())
+        return !fileExists(_path);
+
+    StateReader in(file.data(), file.size());
+    uint32_t magic = in.getU32();
+    uint32_t version = in.getU32();
+    if (magic != SNAPSHOT_MAGIC || version < 1 || version > SNAPSHOT_VERSION)
+        throw std::runtime_error("unrecognized snapshot format");
+    _snapshot_generation = in.getU64();
+
+    uint32_t count = in.getU32();
+    for (uint32_t i = 0; i < count; ++i) {
+        State& state = out[in.getString()];
+        state.topic = in.getString();
+        state.topic_setter = in.getString();
+        state.topic_time = static_cast<time_t>(in.getU64());
+        state.key = in.getString();
+        uint8_t flags = in.getU8();
+        state.invite_only = flags & 1;
+        state.topic_restricted = flags & 2;
+        state.text_policy = flags >> 2;  // Older snapshots leave these bits clear
+        state.user_limit = in.getU32();
+        uint32_t bans = in.getU32();
+        state.bans.reserve(bans);
+        for (uint32_t b = 0; b < bans; ++b)
+            state.bans.push_back(in.getString());
+        if (version >= 2)
+            state.founder = in.getString();
+    }
+    return true;
+}
+
+size_t ChannelStore::replayJournal(uint64_t generation, std::map<std::string, State>& out) {
+    MappedFile file(journalPath(generation));
+    if (!file.data())
+        return 0;
+
+    const unsigned char* base = static_cast<const unsigned char*>(file.data());
+    size_t offset = 0;
+    while (file.size() - offset >= 4) {
+        StateReader header(base + offset, 4);
+        uint32_t length = header.getU32();
+        if (length > file.size() - offset - 4)
+            break;  // Torn tail from a crash mid-append
+
+        StateReader in(base + offset + 4, length);
+        uint8_t type = in.getU8();
+        std::string name = in.getString();
+        if (type == REC_DROP) {
+            out.erase(name);
+        } else {
+            State& state = out[name];
+            switch (type) {
+                case REC_TOPIC:
+                    state.topic = in.getString();
+                    state.topic_setter = in.getString();
+                    state.topic_time = static_cast<time_t>(in.getU64());
+                    break;
+                case REC_KEY:
+                    state.key = in.getString();
+                    break;
+                case REC_LIMIT:
+                    state.user_limit = in.getU32();
+                    break;
+                case REC_INVITE_ONLY:
+                    state.invite_only = in.getU8() != 0;
+                    break;
+                case REC_TOPIC_RESTRICTED:
+                    state.topic_restricted = in.getU8() != 0;
+                    break;
+                case REC_TEXT_POLICY:
+                    state.text_policy = in.getU8();
+                    break;
+                case REC_FOUNDER:
+                    state.founder = in.getString();
+                    break;
+                case REC_BAN_ADD: {
+                    std::string mask = in.getString();
+                    if (std::find(state.bans.begin(), state.bans.end(), mask) == state.bans.end())
+                        state.bans.push_back(mask);
+                    break;
+                }
+                case REC_BAN_DEL: {
+                    std::string mask = in.getString();
+                    state.bans.erase(std::remove(state.bans.begin(), state.bans.end(), mask), state.bans.end());
+                    break;
+                }
+                default:
+                    throw std::runtime_error("unknown journal record");
+            }
+        }
+        offset += 4 + length;
+    }
+    return offset;
+}
+
+bool ChannelStore::load(std::map<std::string, State>& out) {
+    try {
+        if (!loadSnapshot(out))
+            return false;
+
+        _generation = _snapshot_generation - 1;
+        _journal_bytes = 0;
+        while (fileExists(journalPath(_generation + 1))) {
+            ++_generation;
+            _journal_bytes += replayJournal(_generation, out);
+        }
+    }
+    catch (const std::exception& e) {
+        Logger::error("Failed to load channel state from " + _path + ": " + e.what());
+        return false;
+    }
+
+    // Channels whose state went back to defaults carry nothing worth keeping
+    std::map<std::string, State>::iterator it = out.begin();
+    while (it != out.end()) {
+        if (it->second.isDefault())
+            out.erase(it++);
+        else
+            ++it;
+    }
+
+    removeJournalsBelow(_snapshot_generation);
+    return true;
+}
+
+uint64_t ChannelStore::snapshotGeneration() const {
+    MappedFile file(_path);
+    if (!file.data())
+        return 1;
+    try {
+        StateReader in(file.data(), file.size());
+        uint32_t magic = in.getU32();
+        uint32_t version = in.getU32();
+        if (magic == SNAPSHOT_MAGIC && version >= 1 && version <= SNAPSHOT_VERSION)
+            return in.getU64();
+    }
+    catch (const std::exception&) {
+    }
+    return 1;
+}
+
+bool ChannelStore::open() {
+    if (_journal_fd >= 0)
+        return true;
+
+    // Opened without a load (binary upgrade): find where the snapshot ends
+    if (_generation == 0) {
+        _snapshot_generation = snapshotGeneration();
+        _generation = _snapshot_generation - 1;
+    }
+
+    // Never append behind a possibly torn tail: always begin a new generation
+    while (fileExists(journalPath(_generation + 1)))
+        ++_generation;
+    ++_generation;
+
+    _journal_fd = ::open(journalPath(_generation).c_str(),
+                         O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (_journal_fd < 0) {
+        Logger::error("Failed to open channel journal: " + std::string(strerror(errno)));
+        return false;
+    }
+    return true;
+}
+
+void ChannelStore::close() {
+    if (_journal_fd >= 0) {
+        ::close(_journal_fd);
+        _journal_fd = -1;
+    }
+}
+
+bool ChannelStore::isOpen() const {
+    return _journal_fd >= 0;
+}
+
+void ChannelStore::append(const std::string& record) {
+    if (_journal_fd < 0)
+        return;
+
+    StateWriter framed;
+    framed.putU32(static_cast<uint32_t>(record.size()));
+    framed.putBytes(record.data(), record.size());
+    if (!writeAll(_journal_fd, framed.data())) {
+        Logger::error("Channel journal write failed, persistence disabled: " + std::string(strerror(errno)));
+        close();
+        return;
+    }
+    _journal_bytes += framed.data().size();
+}
+
+void ChannelStore::logTopic(const std::string& channel, const std::string& topic,
+                            const std::string& setter, time_t when) {
+    StateWriter record;
+    record.putU8(REC_TOPIC);
+    record.putString(channel);
+    record.putString(topic);
+    record.putString(setter);
+    record.putU64(static_cast<uint64_t>(when));
+    append(record.data());
+}
+
+void ChannelStore::logKey(const std::string& channel, const std::string& key) {
+    StateWriter record;
+    record.putU8(REC_KEY);
+    record.putString(channel);
+    record.putString(key);
+    append(record.data());
+}
+
+void ChannelStore::logUserLimit(const std::string& channel, size_t limit) {
+    StateWriter record;
+    record.putU8(REC_LIMIT);
+    record.putString(channel);
+    record.putU32(static_cast<uint32_t>(limit));
+    append(record.data());
+}
+
+void ChannelStore::logInviteOnly(const std::string& channel, bool status) {
+    StateWriter record;
+    record.putU8(REC_INVITE_ONLY);
+    record.putString(channel);
+    record.putU8(status ? 1 : 0);
+    append(record.data());
+}
+
+void ChannelStore::logTopicRestricted(const std::string& channel, bool status) {
+    StateWriter record;
+    record.putU8(REC_TOPIC_RESTRICTED);
+    record.putString(channel);
+    record.putU8(status ? 1 : 0);
+    append(record.data());
+}
+
+void ChannelStore::logTextPolicy(const std::string& channel, int policy) {
+    StateWriter record;
+    record.putU8(REC_TEXT_POLICY);
+    record.putString(channel);
+    record.putU8(static_cast<uint8_t>(policy));
+    append(record.data());
+}
+
+void ChannelStore::logBan(const std::string& channel, const std::string& mask, bool add) {
+    StateWriter record;
+    record.putU8(add ? REC_BAN_ADD : REC_BAN_DEL);
+    record.putString(channel);
+    record.putString(mask);
+    append(record.data());
+}
+
+void ChannelStore::logFounder(const std::string& channel, const std::string& account) {
+    StateWriter record;
+    record.putU8(REC_FOUNDER);
+    record.putString(channel);
+    record.putString(account);
+    append(record.data());
+}
+
+void ChannelStore::logDrop(const Channel& channel) {
+    // Default-state channels never reach the snapshot, nothing to retract
+    if (stateOf(channel).isDefault())
+        return;
+    StateWriter record;
+    record.putU8(REC_DROP);
+    record.putString(channel.getName());
+    append(record.data());
+}
+
+bool ChannelStore::needsCompaction() const {
+    return _journal_fd >= 0 && _compactor == 0 && _journal_bytes >= CHANNEL_COMPACT_BYTES;
+}
+
+void ChannelStore::compact(const ChannelRegistry& channels) {
+    if (_journal_fd < 0 || _compactor != 0)
+        return;
+
+    // Later mutations go to the next generation, which the snapshot excludes
+    uint64_t covered = _generation;
+    close();
+    if (!open())
+        return;
+    _journal_bytes = 0;
+
+    // Everything that allocates happens before the fork
+    std::string data = encodeSnapshot(channels, covered + 1);
+    std::ostringstream tmp;
+    tmp << _path << ".tmp." << getpid();
+    _compact_tmp = tmp.str();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        Logger::error("Channel compaction fork failed: " + std::string(strerror(errno)));
+        return;
+    }
+    if (pid == 0)
+        writeSnapshot(_compact_tmp.c_str(), _path.c_str(), data);
+
+    _compactor = pid;
+    _compact_generation = covered + 1;
+    _compact_started = TimerWheel::monotonicMs();
+    Logger::debug("Started channel state compaction");
+}
+
+void ChannelStore::reap() {
+    if (_compactor == 0)
+        return;
+
+    int status;
+    pid_t pid = waitpid(_compactor, &status, WNOHANG);
+    if (pid == 0) {
+        if (TimerWheel::monotonicMs() - _compact_started < CHANNEL_COMPACT_TIMEOUT)
+            return;
+        // Stuck, most likely on a hung disk: the journals still hold everything
+        kill(_compactor, SIGKILL);
+        pid = waitpid(_compactor, &status, 0);
+        unlink(_compact_tmp.c_str());
+        Logger::error("Channel state compaction timed out and was killed");
+        _compactor = 0;
+        return;
+    }
+
+    _compactor = 0;
+    if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        Logger::error("Channel state compaction failed");
+        return;
+    }
+    _snapshot_generation = _compact_generation;
+    removeJournalsBelow(_snapshot_generation);
+    Logger::debug("Channel state compaction finished");
+}
+
+void ChannelStore::removeJournalsBelow(uint64_t generation) {
+    // Generations are contiguous, so stop at the first gap below the cutoff
+    for (uint64_t gen = generation; gen > 1; --gen) {
+        if (unlink(journalPath(gen - 1).c_str()) < 0)
+            break;
+    }
+}
+
+std::string ChannelStore::encodeSnapshot(const ChannelRegistry& channels, uint64_t next_generation) {
+    uint32_t count = 0;
+    for (Channel* channel = channels.first(); channel; channel = ChannelRegistry::next(channel)) {
+        if (!stateOf(*channel).isDefault())
+            ++count;
+    }
+
+    StateWriter out;
+    out.putU32(SNAPSHOT_MAGIC);
+    out.putU32(SNAPSHOT_VERSION);
+    out.putU64(next_generation);
+    out.putU32(count);
+
+    for (Channel* channel = channels.first(); channel; channel = ChannelRegistry::next(channel)) {
+        State state = stateOf(*channel);
+        if (state.isDefault())
+            continue;
+        out.putString(channel->getName());
+        out.putString(state.topic);
+        out.putString(state.topic_setter);
+        out.putU64(static_cast<uint64_t>(state.topic_time));
+        out.putString(state.key);
+        out.putU8((state.invite_only ? 1 : 0) | (state.topic_restricted ? 2 : 0) | (state.text_policy << 2));
+        out.putU32(static_cast<uint32_t>(state.user_limit));
+        out.putU32(static_cast<uint32_t>(state.bans.size()));
+        for (size_t b = 0; b < state.bans.size(); ++b)
+            out.putString(state.bans[b]);
+        out.putString(state.founder);
+    }
+    return out.data();
+}
+
+// Runs in the forked child: system calls only, then _exit
+void ChannelStore::writeSnapshot(const char* tmp, const char* path, const std::string& data) {
+    int fd = ::open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        _exit(1);
+    bool ok = writeAll(fd, data) && fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        _exit(1);
+    }
+    _exit(0);
+}
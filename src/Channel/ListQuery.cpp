@@ -0,0 +1,101 @@
+#include "../../include/ListQuery.hpp"
+#include "../../include/Channel.hpp"
+#include "../../include/CaseMapping.hpp"
+
+ListQuery::ListQuery(time_t now)
+    : _now(now), _wildcards(false), _conditions(false), _users_above(-1), _users_below(-1),
+      _created_after(0), _created_before(0), _topic_after(0), _topic_before(0), _cursor(NULL) {
+}
+
+bool ListQuery::addTerm(const std::string& term) {
+    if (term.empty())
+        return true;
+
+    char kind = term[0];
+    if (kind == '!') {
+        _exclusions.push_back(term.substr(1));
+        _wildcards = true;
+        return true;
+    }
+
+    long value;
+    if (kind == '>' || kind == '<') {
+        if (!parseCount(term.substr(1), value))
+            return false;
+        (kind == '>' ? _users_above : _users_below) = value;
+        _conditions = true;
+        return true;
+    }
+
+    if ((kind == 'C' || kind == 'T') && term.size() > 1 && (term[1] == '>' || term[1] == '<')) {
+        if (!parseCount(term.substr(2), value))
+            return false;
+        // "More than n minutes ago" is an upper bound on the timestamp
+        time_t when = _now - static_cast<time_t>(value) * 60;
+        if (kind == 'C')
+            (term[1] == '>' ? _created_before : _created_after) = when;
+        else
+            (term[1] == '>' ? _topic_before : _topic_after) = when;
+        _conditions = true;
+        return true;
+    }
+
+    _masks.push_back(term);
+    if (CaseMapping::hasWildcards(term))
+        _wildcards = true;
+    return true;
+}
+
+bool ListQuery::matches(const Channel& channel) const {
+    const std::string& name = channel.getName();
+    if (!_masks.empty()) {
+        bool found = false;
+        for (size_t i = 0; i < _masks.size() && !found; ++i)
+            found = CaseMapping::match(_masks[i], name);
+        if (!found)
+            return false;
+    }
+    for (size_t i = 0; i < _exclusions.size(); ++i) {
+        if (CaseMapping::match(_exclusions[i], name))
+            return false;
+    }
+
+    long users = static_cast<long>(channel.getClients().size());
+    if ((_users_above >= 0 && users <= _users_above) || (_users_below >= 0 && users >= _users_below))
+        return false;
+
+    time_t created = channel.getCreationTime();
+    if ((_created_after && created <= _created_after) || (_created_before && created >= _created_before))
+        return false;
+
+    // Channels that never had a topic fail any topic condition
+    time_t topic = channel.getTopicTime();
+    if ((_topic_after || _topic_before) && topic == 0)
+        return false;
+    if ((_topic_after && topic <= _topic_after) || (_topic_before && topic >= _topic_before))
+        return false;
+    return true;
+}
+
+bool ListQuery::isLookupOnly() const {
+    return !_masks.empty() && !_wildcards && !_conditions;
+}
+
+const std::vector<std::string>& ListQuery::getMasks() const {
+    return _masks;
+}
+
+const Channel* ListQuery::getCursor() const {
+    return _cursor;
+}
+
+void ListQuery::setCursor(const Channel* channel) {
+    _cursor = channel;
+}
+
+bool ListQuery::parseCount(const std::string& text, long& value) {
+    if (text.empty() || text.size() > 9 || text.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    value = std::atol(text.c_str());
+    return true;
+}
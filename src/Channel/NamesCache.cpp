@@ -0,0 +1,98 @@
+#include "../../include/NamesCache.hpp"
+#include "../../include/MemoryStats.hpp"
+
+NamesCache::NamesCache(size_t chunk_bytes) : _chunk_bytes(chunk_bytes), _bytes(0) {
+}
+
+void NamesCache::add(Client* client, const std::string& entry) {
+    if (_slots.count(client)) {
+        update(client, entry);
+        return;
+    }
+    Slot& slot = _slots[client];
+    slot.entry = entry;
+    append(slot);
+    _bytes += entry.size() + 1;
+}
+
+void NamesCache::update(Client* client, const std::string& entry) {
+    std::map<Client*, Slot>::iterator it = _slots.find(client);
+    if (it == _slots.end() || it->second.entry == entry)
+        return;
+
+    Slot& slot = it->second;
+    eraseToken(_chunks[slot.chunk], slot.entry);
+    _bytes += entry.size();
+    _bytes -= slot.entry.size();
+    slot.entry = entry;
+    append(slot);
+}
+
+void NamesCache::remove(Client* client) {
+    std::map<Client*, Slot>::iterator it = _slots.find(client);
+    if (it == _slots.end())
+        return;
+
+    eraseToken(_chunks[it->second.chunk], it->second.entry);
+    _bytes -= it->second.entry.size() + 1;
+    _slots.erase(it);
+
+    // Parts leave holes; repack once the chunks are less than half full
+    if (_chunks.size() > 1 && _chunks.size() > 2 * (_bytes / _chunk_bytes + 1))
+        repack();
+}
+
+void NamesCache::clear() {
+    _chunks.clear();
+    _slots.clear();
+    _bytes = 0;
+}
+
+const std::vector<std::string>& NamesCache::chunks() const {
+    return _chunks;
+}
+
+size_t NamesCache::memoryUsage() const {
+    size_t total = MemoryStats::vectorBytes(_chunks);
+    for (size_t i = 0; i < _chunks.size(); ++i)
+        total += MemoryStats::stringBytes(_chunks[i]);
+    for (std::map<Client*, Slot>::const_iterator it = _slots.begin(); it != _slots.end(); ++it)
+        total += MemoryStats::NODE_OVERHEAD + sizeof(*it) + MemoryStats::stringBytes(it->second.entry);
+    return total;
+}
+
+void NamesCache::append(Slot& slot) {
+    if (_chunks.empty() || _chunks.back().size() + 1 + slot.entry.size() > _chunk_bytes)
+        _chunks.push_back(std::string());
+
+    std::string& chunk = _chunks.back();
+    if (!chunk.empty())
+        chunk += ' ';
+    chunk += slot.entry;
+    slot.chunk = _chunks.size() - 1;
+}
+
+void NamesCache::repack() {
+    _chunks.clear();
+    for (std::map<Client*, Slot>::iterator it = _slots.begin(); it != _slots.end(); ++it)
+        append(it->second);
+}
+
+bool NamesCache::eraseToken(std::string& chunk, const std::string& token) {
+    std::string::size_type pos = 0;
+    while ((pos = chunk.find(token, pos)) != std::string::npos) {
+        std::string::size_type end = pos + token.size();
+        bool starts = pos == 0 || chunk[pos - 1] == ' ';
+        bool ends = end == chunk.size() || chunk[end] == ' ';
+        if (starts && ends) {
+            // Take one adjoining separator with the token
+            if (end < chunk.size())
+                chunk.erase(pos, token.size() + 1);
+            else
+                chunk.erase(pos > 0 ? pos - 1 : pos, token.size() + (pos > 0 ? 1 : 0));
+            return true;
+        }
+        pos = end;
+    }
+    return false;
+}
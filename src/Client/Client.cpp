@@ -1,14 +1,36 @@
 #include "../../include/Client.hpp"
 #include "../../include/Channel.hpp"
 #include "../../include/Logger.hpp"
+#include "../../include/ListQuery.hpp"
+#include "../../include/MemoryStats.hpp"
 #include <sys/socket.h>
 #include <unistd.h>
+#include <sstream>
+
+std::set<Client*> Client::_blocked;
+uint64_t Client::_last_id = 0;
+void* Client::_pool = NULL;
+size_t Client::_pool_size = 0;
+size_t Client::_sendq_limit = MAX_SENDQ;
+size_t Client::_sendq_link_limit = MAX_SENDQ_LINK;
 
 Client::Client(int fd)
-    : _fd(fd), _authenticated(false), _registered(false) {
+    : _fd(fd), _id(++_last_id), _authenticated(false), _registered(false), _oper(false), _auth_pending(false), _runnable(false), _closing(false),
+      _caps(0), _cap_negotiating(false), _sasl_started(false),
+      _server_link(false), _uplink(NULL), _signon(0),
+      _visit_epoch(0), _list_query(NULL), _sendq_exceeded(false), _fanout_pending(false),
+      _last_activity(0), _ping_sent(0), _ping_pending(false), _lag(-1) {
+    std::memset(&_address, 0, sizeof(_address));
+    _registration_timer.kind = TIMER_REGISTRATION;
+    _registration_timer.owner = this;
+    _ping_timer.kind = TIMER_PING;
+    _ping_timer.owner = this;
 }
 
 Client::~Client() {
+    _blocked.erase(this);
+    delete _list_query;
+
     // Leave all channels
     for (std::vector<Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
         (*it)->removeClient(this);
@@ -16,11 +38,50 @@ Client::~Client() {
     _channels.clear();
 }
 
+void* Client::operator new(size_t size) {
+    if (size != sizeof(Client) || !_pool)
+        return ::operator new(size);
+    void* record = _pool;
+    _pool = *static_cast<void**>(record);
+    --_pool_size;
+    return record;
+}
+
+// A pooled record's first bytes link it to the next one
+void Client::operator delete(void* ptr) {
+    if (!ptr)
+        return;
+    if (_pool_size >= CLIENT_POOL_MAX) {
+        ::operator delete(ptr);
+        return;
+    }
+    *static_cast<void**>(ptr) = _pool;
+    _pool = ptr;
+    ++_pool_size;
+}
+
+size_t Client::pooledCount() {
+    return _pool_size;
+}
+
+void Client::releasePool() {
+    while (_pool) {
+        void* next = *static_cast<void**>(_pool);
+        ::operator delete(_pool);
+        _pool = next;
+    }
+    _pool_size = 0;
+}
+
 // Getters
 int Client::getFd() const {
     return _fd;
 }
 
+uint64_t Client::getId() const {
+    return _id;
+}
+
 const std::string& Client::getNickname() const {
     return _nickname;
 }
@@ -41,6 +102,46 @@ bool Client::isRegistered() const {
     return _registered;
 }
 
+bool Client::isOper() const {
+    return _oper;
+}
+
+bool Client::isAuthPending() const {
+    return _auth_pending;
+}
+
+bool Client::isRunnable() const {
+    return _runnable;
+}
+
+bool Client::isClosing() const {
+    return _closing;
+}
+
+const std::string& Client::getCloseReason() const {
+    return _close_reason;
+}
+
+const std::string& Client::getAccount() const {
+    return _account;
+}
+
+int Client::getCaps() const {
+    return _caps;
+}
+
+bool Client::isCapNegotiating() const {
+    return _cap_negotiating;
+}
+
+bool Client::isSaslStarted() const {
+    return _sasl_started;
+}
+
+std::string& Client::getSaslPayload() {
+    return _sasl_payload;
+}
+
 DynamicBuffer& Client::getBuffer() {
     return _buffer;
 }
@@ -53,6 +154,54 @@ const std::string& Client::getHostname() const {
     return _hostname;
 }
 
+const struct sockaddr_storage& Client::getAddress() const {
+    return _address;
+}
+
+Timer& Client::getRegistrationTimer() {
+    return _registration_timer;
+}
+
+Timer& Client::getPingTimer() {
+    return _ping_timer;
+}
+
+uint64_t Client::getLastActivity() const {
+    return _last_activity;
+}
+
+uint64_t Client::getPingSent() const {
+    return _ping_sent;
+}
+
+bool Client::isPingPending() const {
+    return _ping_pending;
+}
+
+long Client::getLag() const {
+    return _lag;
+}
+
+bool Client::isServerLink() const {
+    return _server_link;
+}
+
+bool Client::isRemote() const {
+    return _uplink != NULL;
+}
+
+Client* Client::getUplink() const {
+    return _uplink;
+}
+
+const std::string& Client::getServerName() const {
+    return _server_name;
+}
+
+time_t Client::getSignon() const {
+    return _signon;
+}
+
 // Setters
 void Client::setNickname(const std::string& nickname) {
     _nickname = nickname;
@@ -74,10 +223,91 @@ void Client::setRegistered(bool status) {
     _registered = status;
 }
 
+void Client::setOper(bool status) {
+    _oper = status;
+}
+
+void Client::setAuthPending(bool status) {
+    _auth_pending = status;
+}
+
+void Client::setRunnable(bool status) {
+    _runnable = status;
+}
+
+void Client::setClosing(const std::string& reason) {
+    _closing = true;
+    _close_reason = reason;
+}
+
+void Client::setAccount(const std::string& account) {
+    _account = account;
+}
+
+void Client::setCaps(int caps) {
+    _caps = caps;
+}
+
+void Client::setCapNegotiating(bool status) {
+    _cap_negotiating = status;
+}
+
+void Client::setSaslStarted(bool status) {
+    _sasl_started = status;
+    if (!status)
+        std::string().swap(_sasl_payload);
+}
+
 void Client::setHostname(const std::string& hostname) {
     _hostname = hostname;
 }
 
+void Client::setAddress(const struct sockaddr_storage& address) {
+    _address = address;
+}
+
+void Client::setServerLink(bool status) {
+    _server_link = status;
+}
+
+void Client::setUplink(Client* uplink) {
+    _uplink = uplink;
+}
+
+void Client::setServerName(const std::string& name) {
+    _server_name = name;
+}
+
+void Client::setSignon(time_t signon) {
+    _signon = signon;
+}
+
+void Client::setLastActivity(uint64_t now) {
+    _last_activity = now;
+}
+
+// Keepalive
+const std::string& Client::startPing(uint64_t now) {
+    std::ostringstream token;
+    token << now;
+    _ping_token = token.str();
+    _ping_sent = now;
+    _ping_pending = true;
+    return _ping_token;
+}
+
+bool Client::handlePong(const std::string& token, uint64_t now) {
+    if (!_ping_pending || token != _ping_token)
+        return false;
+    _lag = static_cast<long>(now - _ping_sent);
+    _ping_pending = false;
+    return true;
+}
+
+void Client::clearPing() {
+    _ping_pending = false;
+}
+
 // Channel operations
 void Client::joinChannel(Channel* channel) {
     if (!channel || isInChannel(channel))
@@ -85,6 +315,17 @@ void Client::joinChannel(Channel* channel) {
     _channels.push_back(channel);
 }
 
+void Client::reserveChannels(size_t additional) {
+    _channels.reserve(_channels.size() + additional);
+}
+
+bool Client::markVisited(uint64_t epoch) {
+    if (_visit_epoch == epoch)
+        return false;
+    _visit_epoch = epoch;
+    return true;
+}
+
 void Client::leaveChannel(Channel* channel) {
     if (!channel)
         return;
@@ -114,6 +355,127 @@ bool Client::appendToBuffer(const char* data, size_t len) {
 }
 
 void Client::sendMessage(const std::string& message) {
-    std::string full_message = message + "\r\n";
-    send(_fd, full_message.c_str(), full_message.length(), 0);
-} 
\ No newline at end of file
+    sendRaw(message + "\r\n");
+}
+
+// Writes straight to the socket while nothing is queued; whatever the
+// kernel does not take waits in _sendq for POLLOUT. A queue past its limit
+// is marked and the server drops the connection before the next poll.
+void Client::sendRaw(const std::string& line) {
+    if (line.empty())
+        return;
+    if (_uplink) {
+        _uplink->sendRaw(line);
+        return;
+    }
+    if (_sendq_exceeded)
+        return;
+
+    size_t sent = _sendq.empty() && !_fanout_pending ? writeDirect(line) : 0;
+    if (sent < line.size())
+        queueRemainder(line, sent);
+}
+
+// Touches nothing but the socket, so fan-out threads may call it
+size_t Client::writeDirect(const std::string& line) const {
+    ssize_t n = send(_fd, line.data(), line.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        return line.size();  // The read side reports the dead socket
+    return n > 0 ? n : 0;
+}
+
+// Queues what the socket did not take, or marks the queue exceeded
+void Client::queueRemainder(const std::string& line, size_t sent) {
+    size_t limit = _server_link ? _sendq_link_limit : _sendq_limit;
+    if (_sendq.size() + line.size() - sent > limit) {
+        _sendq_exceeded = true;
+        _blocked.insert(this);
+        return;
+    }
+    if (_sendq.empty())
+        _blocked.insert(this);
+    _sendq.append(line, sent, std::string::npos);
+}
+
+bool Client::isFanoutPending() const {
+    return _fanout_pending;
+}
+
+void Client::setFanoutPending(bool pending) {
+    _fanout_pending = pending;
+}
+
+// Anything queued while the sender thread had the socket came later, so
+// the unsent part of its line goes in front
+void Client::finishFanout(const std::string& line, size_t sent) {
+    _fanout_pending = false;
+    if (sent < line.size() && !_sendq_exceeded) {
+        size_t limit = _server_link ? _sendq_link_limit : _sendq_limit;
+        if (_sendq.size() + line.size() - sent > limit)
+            _sendq_exceeded = true;
+        else
+            _sendq.insert(0, line, sent, std::string::npos);
+    }
+    if (!_sendq.empty() || _sendq_exceeded)
+        _blocked.insert(this);
+}
+
+// Leaves the socket alone while a fan-out job holds it
+bool Client::flushSendQueue() {
+    if (_fanout_pending)
+        return true;
+    while (!_sendq.empty()) {
+        ssize_t n = send(_fd, _sendq.data(), _sendq.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        _sendq.erase(0, n);
+    }
+    std::string().swap(_sendq);
+    return true;
+}
+
+size_t Client::getSendQueueSize() const {
+    return _sendq.size();
+}
+
+ListQuery* Client::getListQuery() const {
+    return _list_query;
+}
+
+void Client::setListQuery(ListQuery* query) {
+    if (query != _list_query)
+        delete _list_query;
+    _list_query = query;
+}
+
+const std::string& Client::getSendQueue() const {
+    return _sendq;
+}
+
+void Client::setSendQueueLimits(size_t user, size_t link) {
+    _sendq_limit = user;
+    _sendq_link_limit = link;
+}
+
+bool Client::isSendQueueExceeded() const {
+    return _sendq_exceeded;
+}
+
+void Client::collectBlocked(std::vector<Client*>& out) {
+    out.assign(_blocked.begin(), _blocked.end());
+    _blocked.clear();
+} 
+
+void Client::accountMemory(MemoryStats& stats) const {
+    size_t record = sizeof(Client) + MemoryStats::vectorBytes(_channels)
+                  + MemoryStats::stringBytes(_nickname) + MemoryStats::stringBytes(_username)
+                  + MemoryStats::stringBytes(_realname) + MemoryStats::stringBytes(_hostname)
+                  + MemoryStats::stringBytes(_server_name) + MemoryStats::stringBytes(_ping_token)
+                  + MemoryStats::stringBytes(_account) + MemoryStats::stringBytes(_sasl_payload);
+    stats.add(MemoryStats::MEM_CLIENTS, record, 1);
+    stats.add(MemoryStats::MEM_INPUT, _buffer.capacity(), _buffer.capacity() ? 1 : 0);
+    stats.add(MemoryStats::MEM_SENDQ, MemoryStats::stringBytes(_sendq), _sendq.empty() ? 0 : 1);
+}
@@ -1,9 +1,86 @@
 #include "../../include/CommandHandler.hpp"
 #include "../../include/Logger.hpp"
 #include "../../include/Channel.hpp"
+#include "../../include/CaseMapping.hpp"
+#include "../../include/ListQuery.hpp"
+#include "../../include/TextFilter.hpp"
+#include "../../include/MemoryStats.hpp"
 #include <sstream>
+#include <algorithm>
 
-CommandHandler::CommandHandler(Server& server) : _server(server) {}
+std::string numberToString(size_t number);
+
+namespace {
+
+// Standard alphabet with padding; false on anything else
+bool decodeBase64(const std::string& in, std::string& out) {
+    static const std::string alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    if (in.size() % 4 != 0)
+        return false;
+    out.clear();
+    uint32_t bits = 0;
+    size_t count = 0;
+    size_t padding = 0;
+    for (size_t i = 0; i < in.size(); ++i) {
+        size_t value = 0;
+        if (in[i] == '=') {
+            if (i + 2 < in.size())
+                return false;
+            ++padding;
+        } else {
+            value = alphabet.find(in[i]);
+            if (value == std::string::npos || padding)
+                return false;
+        }
+        bits = (bits << 6) | static_cast<uint32_t>(value);
+        if (++count == 4) {
+            out += static_cast<char>((bits >> 16) & 0xFF);
+            out += static_cast<char>((bits >> 8) & 0xFF);
+            out += static_cast<char>(bits & 0xFF);
+            bits = 0;
+            count = 0;
+        }
+    }
+    out.resize(out.size() - padding);
+    return true;
+}
+
+struct Capability {
+    const char* name;
+    int         bit;
+};
+
+// In the order CAP LS lists them
+const Capability CAPABILITIES[] = {
+    { "batch", CAP_BATCH },
+    { "message-tags", CAP_MESSAGE_TAGS },
+    { "sasl", CAP_SASL },
+    { "server-time", CAP_SERVER_TIME }
+};
+const size_t CAPABILITY_COUNT = sizeof(CAPABILITIES) / sizeof(CAPABILITIES[0]);
+
+int capabilityBit(const std::string& name) {
+    for (size_t i = 0; i < CAPABILITY_COUNT; ++i) {
+        if (name == CAPABILITIES[i].name)
+            return CAPABILITIES[i].bit;
+    }
+    return 0;
+}
+
+const char* credentialCommand(CredentialKind kind) {
+    switch (kind) {
+    case CREDENTIAL_OPER:     return "OPER";
+    case CREDENTIAL_SASL:     return "AUTHENTICATE";
+    case CREDENTIAL_REGISTER: return "REGISTER";
+    default:                  return "PASS";
+    }
+}
+
+}  // namespace
+
+CommandHandler::CommandHandler(Server& server)
+    : _server(server), _dummy_hash(CredentialPool::hash("*")) {}
 
 CommandHandler::~CommandHandler() {}
 
@@ -63,42 +140,29 @@ std::vector<std::string> CommandHandler::splitMessage(const std::string& message
 }
 
 bool CommandHandler::isValidNickname(const std::string& nickname) {
-    if (nickname.empty() || nickname.length() > 9)
-        return false;
-
-    // First character must be a letter
-    if (!isalpha(nickname[0]))
+    if (nickname.empty() || nickname.length() > _server.getConfig().nick_length)
         return false;
 
-    // Rest can be letters, digits, or special characters
-    for (std::string::const_iterator it = nickname.begin() + 1; it != nickname.end(); ++it) {
-        if (!isalnum(*it) && *it != '-' && *it != '_')
-            return false;
-    }
-
-    return true;
+    // First character must be a letter; the rest letters, digits, '-' or '_'
+    return CaseMapping::isLetter(nickname[0])
+        && CaseMapping::spanNickname(nickname, 1) == nickname.size() - 1;
 }
 
 bool CommandHandler::isValidChannelName(const std::string& channel) {
-    if (channel.empty() || channel.length() > 50)
+    if (channel.empty() || channel.length() > _server.getConfig().channel_length)
         return false;
     
     // Channel names must start with # or &
     if (channel[0] != '#' && channel[0] != '&')
         return false;
     
-    // Check for invalid characters
-    for (std::string::const_iterator it = channel.begin() + 1; it != channel.end(); ++it) {
-        if (*it == ' ' || *it == ',' || *it == ':' || *it == 7)
-            return false;
-    }
-    
-    return true;
+    // No space, comma, colon or BEL
+    return CaseMapping::spanChannelName(channel, 1) == channel.size() - 1;
 }
 
-void CommandHandler::sendReply(Client* client, int code, const std::string& message) {
+std::string CommandHandler::formatReply(Client* client, int code, const std::string& message) {
     std::string prefix = ":";
-    prefix += SERVER_NAME;
+    prefix += _server.getHostname();
     prefix += " ";
     
     std::ostringstream code_str;
@@ -106,11 +170,25 @@ void CommandHandler::sendReply(Client* client, int code, const std::string& mess
     code_str.fill('0');
     code_str << code;
     
-    std::string reply = prefix + code_str.str() + " " + 
-                       (client->getNickname().empty() ? "*" : client->getNickname()) +
-                       " " + message + "\r\n";
-    
-    send(client->getFd(), reply.c_str(), reply.length(), 0);
+    return prefix + code_str.str() + " " + 
+           (client->getNickname().empty() ? "*" : client->getNickname()) +
+           " " + message + "\r\n";
+}
+
+void CommandHandler::sendReply(Client* client, int code, const std::string& message) {
+    client->sendRaw(formatReply(client, code, message));
+}
+
+// Comma separated list; positional lists (JOIN keys) keep empty slots
+std::vector<std::string> CommandHandler::splitList(const std::string& list, bool keep_empty) {
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (keep_empty || !item.empty())
+            items.push_back(item);
+    }
+    return items;
 }
 
 void CommandHandler::handlePass(Client* client, const std::vector<std::string>& params) {
@@ -124,7 +202,75 @@ void CommandHandler::handlePass(Client* client, const std::vector<std::string>&
         return;
     }
 
-    if (params[0] == _server.getPassword()) {
+    verifyCredential(client, CREDENTIAL_PASS, "", params[0], _server.getPassword());
+}
+
+// Plain passwords are compared here; hashes go to the credential pool and
+// the client's input waits until finishCredential runs
+void CommandHandler::verifyCredential(Client* client, CredentialKind kind, const std::string& name,
+                                      const std::string& secret, const std::string& expected) {
+    if (!CredentialPool::isHashed(expected)) {
+        CredentialPool::Result result;
+        result.client_id = client->getId();
+        result.fd = client->getFd();
+        result.kind = kind;
+        result.name = name;
+        result.ok = CredentialPool::matches(secret, expected);
+        finishCredential(client, result);
+        return;
+    }
+
+    CredentialPool::Request request;
+    request.client_id = client->getId();
+    request.fd = client->getFd();
+    request.kind = kind;
+    request.name = name;
+    request.secret = secret;
+    request.expected = expected;
+    if (!_server.getCredentials().submit(request)) {
+        Logger::warning("Credential queue full, refusing " + client->getHostname());
+        sendReply(client, RPL_TRYAGAIN, std::string(credentialCommand(kind))
+                  + " :Server load is temporarily too heavy. Please wait a while and try again.");
+        return;
+    }
+    client->setAuthPending(true);
+}
+
+void CommandHandler::finishCredential(Client* client, const CredentialPool::Result& result) {
+    const std::string& name = result.name;
+    bool ok = result.ok;
+    if (result.kind == CREDENTIAL_SASL) {
+        std::string hash;
+        ok = ok && _server.getAccounts().find(name, hash);  // Also fails the dummy check
+        if (!ok) {
+            Logger::warning("Failed SASL login as " + name + " from " + client->getHostname());
+            sendReply(client, ERR_SASLFAIL, ":SASL authentication failed");
+            return;
+        }
+        logIn(client, name);
+        sendReply(client, RPL_SASLSUCCESS, ":SASL authentication successful");
+        return;
+    }
+    if (result.kind == CREDENTIAL_REGISTER) {
+        finishRegister(client, result);
+        return;
+    }
+
+    if (result.kind == CREDENTIAL_OPER) {
+        std::string password;
+        ok = ok && _server.findOper(name, password);  // Also fails the dummy check
+        if (!ok) {
+            Logger::warning("Failed OPER attempt as " + name + " by " + client->getNickname());
+            sendReply(client, ERR_PASSWDMISMATCH, ":Password incorrect");
+            return;
+        }
+        client->setOper(true);
+        Logger::info(client->getNickname() + " is now an operator (" + name + ")");
+        sendReply(client, RPL_YOUREOPER, ":You are now an IRC operator");
+        return;
+    }
+
+    if (ok) {
         client->setAuthenticated(true);
         Logger::debug("Client authenticated successfully");
     } else {
@@ -151,22 +297,81 @@ void CommandHandler::handleNick(Client* client, const std::vector<std::string>&
         return;
     }
 
-    // Check if nickname is already in use
-    if (_server.getClientByNickname(nickname)) {
+    // Check if nickname is already in use; changing case of one's own is fine
+    Client* holder = _server.getClientByNickname(nickname);
+    if (holder && holder != client) {
         sendReply(client, ERR_NICKNAMEINUSE, nickname + " :Nickname is already in use");
         return;
     }
+    // Before registration the check waits until SASL had its chance
+    if (client->isRegistered() && !mayUseNickname(client, nickname)) {
+        sendReply(client, ERR_NICKNAMEINUSE, nickname + " :Nickname is registered to another account");
+        return;
+    }
 
+    std::string old_nickname = client->getNickname();
     client->setNickname(nickname);
+    _server.renameUser(client, old_nickname);
     Logger::debug("Client set nickname to: " + nickname);
 
-    // If the client has both nickname and username set, they are fully registered
-    if (!client->getUsername().empty()) {
-        client->setRegistered(true);
-        sendReply(client, RPL_WELCOME, ":Welcome to the Internet Relay Network " + 
-                                     client->getNickname() + "!" + 
-                                     client->getUsername() + "@" + SERVER_NAME);
+    if (client->isRegistered()) {
+        SharedLine nick_msg(":" + old_nickname + "!" + client->getUsername() + "@" + SERVER_NAME +
+                            " NICK " + nickname + "\r\n");
+        const std::vector<Channel*>& channels = client->getChannels();
+        for (size_t i = 0; i < channels.size(); ++i)
+            channels[i]->refreshName(client);
+        _server.sendToPeers(client, nick_msg, true);
+        _server.propagate(nick_msg.str());
+        return;
+    }
+
+    tryCompleteRegistration(client);
+}
+
+// Registered account names are reserved for whoever is logged in to them
+bool CommandHandler::mayUseNickname(Client* client, const std::string& nickname) {
+    AccountStore& accounts = _server.getAccounts();
+    return !accounts.isOpen() || CaseMapping::equals(client->getAccount(), nickname)
+        || !accounts.exists(nickname);
+}
+
+// Registration completes once NICK and USER are in and CAP negotiation, if
+// the client started one, has ended
+void CommandHandler::tryCompleteRegistration(Client* client) {
+    if (client->isRegistered() || client->isCapNegotiating()
+        || client->getNickname().empty() || client->getUsername().empty())
+        return;
+
+    if (!mayUseNickname(client, client->getNickname())) {
+        std::string nickname = client->getNickname();
+        sendReply(client, ERR_NICKNAMEINUSE, nickname + " :Nickname is registered to another account");
+        client->setNickname("");
+        _server.renameUser(client, nickname);
+        return;
     }
+    completeRegistration(client);
+}
+
+void CommandHandler::completeRegistration(Client* client) {
+    client->setRegistered(true);
+    sendReply(client, RPL_WELCOME, ":Welcome to the Internet Relay Network " + 
+                                 client->getNickname() + "!" + 
+                                 client->getUsername() + "@" + SERVER_NAME);
+
+    std::ostringstream isupport;
+    const size_t max_targets = _server.getConfig().max_targets;
+    isupport << "MAXTARGETS=" << max_targets
+             << " TARGMAX=PRIVMSG:" << max_targets << ",NOTICE:" << max_targets
+             << " CHATHISTORY=" << CHATHISTORY_LIMIT
+             << " NICKLEN=" << _server.getConfig().nick_length
+             << " CHANNELLEN=" << _server.getConfig().channel_length
+             << " ELIST=CMNTU SAFELIST CASEMAPPING=rfc1459";
+    if (_server.getTextPolicy() & TEXT_UTF8ONLY)
+        isupport << " UTF8ONLY";
+    isupport
+             << " :are supported by this server";
+    sendReply(client, RPL_ISUPPORT, isupport.str());
+    _server.onClientRegistered(client);
 }
 
 void CommandHandler::handleUser(Client* client, const std::vector<std::string>& params) {
@@ -189,22 +394,49 @@ void CommandHandler::handleUser(Client* client, const std::vector<std::string>&
     client->setRealname(params[3]);
     Logger::debug("Client set username to: " + params[0] + " and realname to: " + params[3]);
 
-    // If the client has both nickname and username set, they are fully registered
-    if (!client->getNickname().empty()) {
-        client->setRegistered(true);
-        sendReply(client, RPL_WELCOME, ":Welcome to the Internet Relay Network " + 
-                                     client->getNickname() + "!" + 
-                                     client->getUsername() + "@" + SERVER_NAME);
-    }
+    tryCompleteRegistration(client);
 }
 
 void CommandHandler::handleQuit(Client* client, const std::vector<std::string>& params) {
-    (void)client; // Silence unused parameter warning
     std::string quit_message = params.empty() ? "Client Quit" : params[0];
     Logger::info("Client quit: " + quit_message);
-    // The actual client removal will be handled by the Server class
+    // Peers are told once each while the server tears the connection down
+    _server.disconnectClient(client, "Quit: " + quit_message);
+}
+
+void CommandHandler::handlePing(Client* client, const std::vector<std::string>& params) {
+    if (params.empty()) {
+        sendReply(client, ERR_NOORIGIN, ":No origin specified");
+        return;
+    }
+
+    std::string pong_msg = ":";
+    pong_msg += _server.getHostname();
+    pong_msg += " PONG ";
+    pong_msg += _server.getHostname();
+    pong_msg += " :";
+    pong_msg += params[0];
+    pong_msg += "\r\n";
+    client->sendRaw(pong_msg);
+}
+
+void CommandHandler::handlePong(Client* client, const std::vector<std::string>& params) {
+    if (params.empty()) {
+        sendReply(client, ERR_NOORIGIN, ":No origin specified");
+        return;
+    }
+
+    // The token is the last parameter: "PONG <token>" or "PONG <server> :<token>"
+    if (client->handlePong(params.back(), TimerWheel::monotonicMs())) {
+        std::ostringstream lag;
+        lag << client->getLag();
+        Logger::debug("Lag for " + client->getNickname() + ": " + lag.str() + "ms");
+    }
 }
 
+// JOIN <channel>{,<channel>} [<key>{,<key>}] or JOIN 0. The whole list is
+// handled as one batch: replies for the joiner are gathered into a single
+// write and peers get one propagated buffer.
 void CommandHandler::handleJoin(Client* client, const std::vector<std::string>& params) {
     if (!client->isRegistered()) {
         sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
@@ -216,11 +448,31 @@ void CommandHandler::handleJoin(Client* client, const std::vector<std::string>&
         return;
     }
 
-    std::string channel_name = params[0];
-    std::string provided_key = params.size() > 1 ? params[1] : "";
-    
+    if (params[0] == "0") {
+        std::vector<Channel*> channels = client->getChannels();
+        std::string out, links;
+        for (size_t i = 0; i < channels.size(); ++i)
+            partChannel(client, channels[i], "Left all channels", out, links);
+        client->sendRaw(out);
+        _server.propagate(links);
+        return;
+    }
+
+    std::vector<std::string> names = splitList(params[0]);
+    std::vector<std::string> keys = params.size() > 1 ? splitList(params[1], true) : std::vector<std::string>();
+    client->reserveChannels(names.size());
+
+    std::string out, links;
+    for (size_t i = 0; i < names.size(); ++i)
+        joinChannel(client, names[i], i < keys.size() ? keys[i] : "", out, links);
+    client->sendRaw(out);
+    _server.propagate(links);
+}
+
+void CommandHandler::joinChannel(Client* client, const std::string& channel_name, const std::string& provided_key,
+                                 std::string& out, std::string& links) {
     if (!isValidChannelName(channel_name)) {
-        sendReply(client, ERR_NOSUCHCHANNEL, channel_name + " :No such channel");
+        out += formatReply(client, ERR_NOSUCHCHANNEL, channel_name + " :No such channel");
         return;
     }
 
@@ -230,42 +482,48 @@ void CommandHandler::handleJoin(Client* client, const std::vector<std::string>&
     if (!channel) {
         Logger::debug("Creating new channel " + channel_name);
         channel = _server.createChannel(channel_name);
-        // First user to join becomes operator
+        // First user to join becomes operator; a logged-in one also owns it across restarts
         channel->addOperator(client);
+        if (!client->getAccount().empty())
+            channel->setFounder(client->getAccount());
         if (!provided_key.empty()) {
             channel->setKey(provided_key);
+            links += ":" + _server.getHostname() + " MODE " + channel_name + " +k " + provided_key + "\r\n";
         }
+    } else if (channel->hasClient(client)) {
+        Logger::debug("Client " + client->getNickname() + " already in channel " + channel_name);
+        return; // Already in channel
+    } else if (channel->getClients().empty() && !channel->getFounder().empty()
+               && CaseMapping::equals(client->getAccount(), channel->getFounder())) {
+        // A channel restored from disk has no members; its founder gets it
+        // back past its modes, anyone else joins it like any other channel
+        channel->addOperator(client);
     } else {
         // Check if user is banned
         if (channel->isBanned(client)) {
-            sendReply(client, ERR_BANNEDFROMCHAN, channel_name + " :Cannot join channel (+b) - you are banned");
+            out += formatReply(client, ERR_BANNEDFROMCHAN, channel_name + " :Cannot join channel (+b) - you are banned");
             return;
         }
 
         // Check invite-only mode
         if (channel->isInviteOnly() && !channel->isInvited(client)) {
-            sendReply(client, ERR_INVITEONLYCHAN, channel_name + " :Cannot join channel (+i) - invite only");
+            out += formatReply(client, ERR_INVITEONLYCHAN, channel_name + " :Cannot join channel (+i) - invite only");
             return;
         }
         
         // Check channel key
         if (channel->hasKey() && (provided_key != channel->getKey())) {
-        sendReply(client, ERR_BADCHANNELKEY, channel_name + " :Cannot join channel (+k) - wrong channel key");
-        return;
+            out += formatReply(client, ERR_BADCHANNELKEY, channel_name + " :Cannot join channel (+k) - wrong channel key");
+            return;
         }
 
         // Check user limit
         if (channel->getUserLimit() > 0 && channel->getClients().size() >= channel->getUserLimit()) {
-            sendReply(client, ERR_CHANNELISFULL, channel_name + " :Cannot join channel (+l) - channel is full");
+            out += formatReply(client, ERR_CHANNELISFULL, channel_name + " :Cannot join channel (+l) - channel is full");
             return;
         }
     }
 
-    if (channel->hasClient(client)) {
-        Logger::debug("Client " + client->getNickname() + " already in channel " + channel_name);
-        return; // Already in channel
-    }
-
     // Format: :nick!user@host JOIN #channel
     std::string join_msg = ":";
     join_msg += client->getNickname();
@@ -277,58 +535,28 @@ void CommandHandler::handleJoin(Client* client, const std::vector<std::string>&
     join_msg += channel_name;
     join_msg += "\r\n";
     
-    // Send join message to all clients in the channel
-    channel->broadcast(join_msg);
+    // Send join message to all clients in the channel, and echo it to the joiner
+    channel->broadcastLocal(join_msg);
+    out += join_msg;
     
     // Add client to channel
     channel->addClient(client);
     client->joinChannel(channel);
-    
-    // Send NAMES list
-    std::string names_msg = ":";
-    names_msg += SERVER_NAME;
-    names_msg += " 353 ";
-    names_msg += client->getNickname();
-    names_msg += " = ";
-    names_msg += channel_name;
-    names_msg += " :";
-    
-    std::vector<Client*> clients = channel->getClients();
-    for (size_t i = 0; i < clients.size(); ++i) {
-        if (i > 0) names_msg += " ";
-        if (channel->isOperator(clients[i])) {
-            names_msg += "@";
-        }
-        names_msg += clients[i]->getNickname();
-    }
-    names_msg += "\r\n";
-    send(client->getFd(), names_msg.c_str(), names_msg.length(), 0);
-    
-    // Send end of NAMES list
-    std::string end_names_msg = ":";
-    end_names_msg += SERVER_NAME;
-    end_names_msg += " 366 ";
-    end_names_msg += client->getNickname();
-    end_names_msg += " ";
-    end_names_msg += channel_name;
-    end_names_msg += " :End of NAMES list\r\n";
-    send(client->getFd(), end_names_msg.c_str(), end_names_msg.length(), 0);
+
+    // Peers learn about channel operators through NJOIN
+    if (channel->isOperator(client))
+        links += ":" + _server.getHostname() + " NJOIN " + channel_name + " :@" + client->getNickname() + "\r\n";
+    else
+        links += join_msg;
     
     // If channel has a topic, send it
-    if (!channel->getTopic().empty()) {
-        std::string topic_msg = ":";
-        topic_msg += SERVER_NAME;
-        topic_msg += " 332 ";
-        topic_msg += client->getNickname();
-        topic_msg += " ";
-        topic_msg += channel_name;
-        topic_msg += " :";
-        topic_msg += channel->getTopic();
-        topic_msg += "\r\n";
-        send(client->getFd(), topic_msg.c_str(), topic_msg.length(), 0);
-    }
+    if (!channel->getTopic().empty())
+        out += formatReply(client, RPL_TOPIC, channel_name + " :" + channel->getTopic());
+
+    appendNames(out, client, channel);
 }
 
+// PART <channel>{,<channel>} [:<reason>]
 void CommandHandler::handlePart(Client* client, const std::vector<std::string>& params) {
     if (!client->isRegistered()) {
         sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
@@ -340,27 +568,36 @@ void CommandHandler::handlePart(Client* client, const std::vector<std::string>&
         return;
     }
 
-    std::string channel_name = params[0];
-    Channel* channel = _server.getChannel(channel_name);
-    
-    if (!channel) {
-        sendReply(client, ERR_NOSUCHCHANNEL, channel_name + " :No such channel");
-        return;
-    }
-
-    if (!channel->hasClient(client)) {
-        sendReply(client, ERR_NOTONCHANNEL, channel_name + " :You're not on that channel");
-        return;
-    }
+    std::vector<std::string> names = splitList(params[0]);
+    std::string reason = params.size() > 1 ? params[1] : "";
+    std::string out, links;
+    for (size_t i = 0; i < names.size(); ++i) {
+        Channel* channel = _server.getChannel(names[i]);
+        if (!channel)
+            out += formatReply(client, ERR_NOSUCHCHANNEL, names[i] + " :No such channel");
+        else if (!channel->hasClient(client))
+            out += formatReply(client, ERR_NOTONCHANNEL, names[i] + " :You're not on that channel");
+        else
+            partChannel(client, channel, reason, out, links);
+    }
+    client->sendRaw(out);
+    _server.propagate(links);
+}
 
+void CommandHandler::partChannel(Client* client, Channel* channel, const std::string& reason,
+                                 std::string& out, std::string& links) {
+    std::string channel_name = channel->getName();
     std::string part_msg = ":" + client->getNickname() + "!" + client->getUsername() + "@" + SERVER_NAME + 
                           " PART " + channel_name;
-    if (params.size() > 1)
-        part_msg += " :" + params[1];
+    if (!reason.empty())
+        part_msg += " :" + reason;
     part_msg += "\r\n";
     
-    channel->broadcast(part_msg);
+    channel->broadcastLocal(part_msg, client);
+    out += part_msg;
+    links += part_msg;
     channel->removeClient(client);
+    client->leaveChannel(channel);
 
     // If channel is empty, remove it
     if (channel->getClients().empty())
@@ -368,52 +605,201 @@ void CommandHandler::handlePart(Client* client, const std::vector<std::string>&
 }
 
 void CommandHandler::handlePrivmsg(Client* client, const std::vector<std::string>& params) {
+    deliverMessage(client, params, "PRIVMSG");
+}
+
+void CommandHandler::handleNotice(Client* client, const std::vector<std::string>& params) {
+    deliverMessage(client, params, "NOTICE");
+}
+
+// Shared by PRIVMSG and NOTICE. Targets are a comma list of channels and
+// nicks; the line is formatted once and only the target name differs per
+// recipient. NOTICE never generates error replies.
+void CommandHandler::deliverMessage(Client* client, const std::vector<std::string>& params,
+                                    const std::string& command) {
+    bool notice = command == "NOTICE";
     if (!client->isRegistered()) {
-        sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
+        if (!notice)
+            sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
         return;
     }
 
     if (params.empty()) {
-        sendReply(client, ERR_NEEDMOREPARAMS, "PRIVMSG :Not enough parameters");
+        if (!notice)
+            sendReply(client, ERR_NORECIPIENT, ":No recipient given (" + command + ")");
         return;
     }
 
     if (params.size() < 2) {
-        // No message provided
+        if (!notice)
+            sendReply(client, ERR_NOTEXTTOSEND, ":No text to send");
         return;
     }
 
-    std::string target = params[0];
-    std::string message = params[1];
+    // Split and drop repeated targets so nobody gets the same line twice;
+    // names that fold alike reach the same user or channel
+    std::vector<std::string> listed = splitList(params[0]);
+    std::vector<std::string> targets;
+    std::set<std::string> seen;
+    for (size_t i = 0; i < listed.size(); ++i) {
+        if (seen.insert(CaseMapping::fold(listed[i])).second)
+            targets.push_back(listed[i]);
+    }
 
-    if (target[0] == '#' || target[0] == '&') {
-        // Channel message
-        Channel* channel = _server.getChannel(target);
-        if (!channel) {
-            sendReply(client, ERR_NOSUCHCHANNEL, target + " :No such channel");
-            return;
-        }
+    if (targets.size() > _server.getConfig().max_targets) {
+        if (!notice)
+            sendReply(client, ERR_TOOMANYTARGETS, params[0] + " :Too many recipients");
+        return;
+    }
 
-        if (!channel->hasClient(client)) {
-            sendReply(client, ERR_CANNOTSENDTOCHAN, target + " :Cannot send to channel");
-            return;
+    // One scan answers every target's text policy; the server policy
+    // applies everywhere, channels can add to it with +U and +S
+    const int server_policy = _server.getTextPolicy();
+    const TextFilter::Scan scan = TextFilter::scan(params[1]);
+    if (!scan.utf8 && (server_policy & TEXT_UTF8ONLY)) {
+        if (!notice)
+            client->sendMessage(":" + _server.getHostname() + " FAIL " + command
+                                + " INVALID_UTF8 :Message rejected, text must be UTF-8");
+        return;
+    }
+
+    const std::string head = ":" + client->getNickname() + "!" + client->getUsername() + "@" + SERVER_NAME +
+                             " " + command + " ";
+    const std::string tail = " :" + params[1] + "\r\n";
+    std::string scrubbed_tail;  // Built on first use
+
+    for (std::vector<std::string>::const_iterator it = targets.begin(); it != targets.end(); ++it) {
+        const std::string& name = *it;
+        if (name[0] == '#' || name[0] == '&') {
+            Channel* channel = _server.getChannel(name);
+            if (!channel) {
+                if (!notice)
+                    sendReply(client, ERR_NOSUCHCHANNEL, name + " :No such channel");
+                continue;
+            }
+            if (!channel->hasClient(client)) {
+                if (!notice)
+                    sendReply(client, ERR_CANNOTSENDTOCHAN, name + " :Cannot send to channel");
+                continue;
+            }
+            int policy = server_policy | channel->getTextPolicy();
+            if (!scan.utf8 && (policy & TEXT_UTF8ONLY)) {
+                if (!notice)
+                    sendReply(client, ERR_CANNOTSENDTOCHAN, name + " :Cannot send to channel (+U)");
+                continue;
+            }
+            bool scrub = scan.controls && (policy & TEXT_SCRUB);
+            if (scrub && scrubbed_tail.empty())
+                scrubbed_tail = " :" + TextFilter::scrub(params[1]) + "\r\n";
+            SharedLine line(head + name + (scrub ? scrubbed_tail : tail));
+            channel->broadcast(line.str(), client); // Don't send to sender
+            channel->addHistory(line);
+        } else {
+            Client* target_client = _server.getClientByNickname(name);
+            if (!target_client) {
+                if (!notice)
+                    sendReply(client, ERR_NOSUCHNICK, name + " :No such nick/channel");
+                continue;
+            }
+            bool scrub = scan.controls && (server_policy & TEXT_SCRUB);
+            if (scrub && scrubbed_tail.empty())
+                scrubbed_tail = " :" + TextFilter::scrub(params[1]) + "\r\n";
+            target_client->sendRaw(head + name + (scrub ? scrubbed_tail : tail));
         }
+    }
+}
 
-        std::string msg = ":" + client->getNickname() + "!" + client->getUsername() + "@" + SERVER_NAME + 
-                         " PRIVMSG " + target + " :" + message + "\r\n";
-        channel->broadcast(msg, client); // Don't send to sender
-    } else {
-        // Private message to user
-        Client* target_client = _server.getClientByNickname(target);
-        if (!target_client) {
-            sendReply(client, ERR_NOSUCHNICK, target + " :No such nick/channel");
-            return;
+// CHATHISTORY LATEST <channel> <* | msgid=id> <limit>
+// CHATHISTORY BEFORE|AFTER <channel> msgid=<id> <limit>
+// Replayed lines carry the batch, time and msgid tags the client enabled
+// with CAP.
+void CommandHandler::handleChathistory(Client* client, const std::vector<std::string>& params) {
+    if (!client->isRegistered()) {
+        sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
+        return;
+    }
+
+    if (params.size() < 4) {
+        client->sendMessage(":" + _server.getHostname() + " FAIL CHATHISTORY NEED_MORE_PARAMS :Missing parameters");
+        return;
+    }
+
+    std::string subcommand = params[0];
+    CaseMapping::upperAsciiInPlace(subcommand);
+    const std::string& target = params[1];
+    const std::string& reference = params[2];
+
+    Channel* channel = _server.getChannel(target);
+    if (!channel || !channel->hasClient(client)) {
+        client->sendMessage(":" + _server.getHostname() + " FAIL CHATHISTORY INVALID_TARGET " + subcommand + " " + target
+                            + " :Messages could not be retrieved");
+        return;
+    }
+
+    int requested = std::atoi(params[3].c_str());
+    size_t limit = requested > 0 && requested < CHATHISTORY_LIMIT ? requested : CHATHISTORY_LIMIT;
+
+    uint64_t msgid = 0;
+    bool has_msgid = reference.compare(0, 6, "msgid=") == 0
+        && MessageHistory::parseMsgid(reference.substr(6), msgid);
+
+    std::vector<const HistoryRing::Entry*> entries;
+    const HistoryRing& history = channel->getHistory();
+    if (subcommand == "LATEST" && reference == "*")
+        history.latest(limit, entries);
+    else if (subcommand == "LATEST" && has_msgid)
+        history.after(msgid, limit, entries);  // Newest lines, stopping at the known one
+    else if (subcommand == "BEFORE" && has_msgid)
+        history.before(msgid, limit, entries);
+    else if (subcommand == "AFTER" && has_msgid)
+        history.after(msgid, limit, entries);
+    else {
+        client->sendMessage(":" + _server.getHostname() + " FAIL CHATHISTORY INVALID_PARAMS " + subcommand
+                            + " :Unknown subcommand or message reference");
+        return;
+    }
+
+    if (subcommand == "LATEST" && has_msgid && entries.size() == limit) {
+        // More than limit lines since the reference: keep the newest ones
+        entries.clear();
+        std::vector<const HistoryRing::Entry*> newest;
+        history.latest(limit, newest);
+        for (size_t i = 0; i < newest.size(); ++i) {
+            if (newest[i]->msgid > msgid)
+                entries.push_back(newest[i]);
         }
+    }
+
+    // Each tag only for a client that enabled its capability; without
+    // any, the lines are replayed as they were first sent
+    int caps = client->getCaps();
+    std::string batch = entries.empty() ? "0" : MessageHistory::formatMsgid(entries.front()->msgid);
+    if (caps & CAP_BATCH)
+        client->sendRaw(":" + _server.getHostname() + " BATCH +" + batch + " chathistory " + target + "\r\n");
+    for (size_t i = 0; i < entries.size(); ++i) {
+        std::string tags;
+        if (caps & CAP_BATCH)
+            tags += ";batch=" + batch;
+        if (caps & CAP_SERVER_TIME)
+            tags += ";time=" + MessageHistory::formatTime(entries[i]->time_ms);
+        if (caps & CAP_MESSAGE_TAGS)
+            tags += ";msgid=" + MessageHistory::formatMsgid(entries[i]->msgid);
+        client->sendRaw((tags.empty() ? "" : "@" + tags.substr(1) + " ") + entries[i]->line.str());
+    }
+    if (caps & CAP_BATCH)
+        client->sendRaw(":" + _server.getHostname() + " BATCH -" + batch + "\r\n");
+}
 
-        std::string msg = ":" + client->getNickname() + "!" + client->getUsername() + "@" + SERVER_NAME + 
-                         " PRIVMSG " + target + " :" + message + "\r\n";
-        send(target_client->getFd(), msg.c_str(), msg.length(), 0);
+// RPL_NAMREPLY lines straight from the channel's cached chunks
+void CommandHandler::appendNames(std::string& out, Client* client, Channel* channel) {
+    const std::string head = ":" + _server.getHostname() + " 353 " + client->getNickname()
+                             + " = " + channel->getName() + " :";
+    const std::vector<std::string>& chunks = channel->getNamesChunks();
+    for (std::vector<std::string>::const_iterator it = chunks.begin(); it != chunks.end(); ++it) {
+        if (!it->empty())
+            out += head + *it + "\r\n";
     }
+    out += formatReply(client, RPL_ENDOFNAMES, channel->getName() + " :End of NAMES list");
 }
 
 void CommandHandler::handleNames(Client* client, const std::vector<std::string>& params) {
@@ -435,39 +821,9 @@ void CommandHandler::handleNames(Client* client, const std::vector<std::string>&
         return;
     }
 
-    // Build names list
-    std::string names_list;
-    const std::vector<Client*>& clients = channel->getClients();
-    const std::vector<Client*>& operators = channel->getOperators();
-
-    for (std::vector<Client*>::const_iterator it = clients.begin(); it != clients.end(); ++it) {
-        if (it != clients.begin())
-            names_list += " ";
-        
-        // Add @ prefix for operators
-        bool is_operator = false;
-        for (std::vector<Client*>::const_iterator op_it = operators.begin(); op_it != operators.end(); ++op_it) {
-            if (*op_it == *it) {
-                is_operator = true;
-                break;
-            }
-        }
-        
-        names_list += (is_operator ? "@" : "") + (*it)->getNickname();
-    }
-
-    // Send names reply using proper numeric code
-    std::ostringstream code_str;
-    code_str.width(3);
-    code_str.fill('0');
-    code_str << RPL_NAMREPLY;
-    
-    std::string reply = ":" + std::string(SERVER_NAME) + " " + code_str.str() + " " +
-                       client->getNickname() + " = " + channel_name + " :" + names_list + "\r\n";
-    send(client->getFd(), reply.c_str(), reply.length(), 0);
-
-    // Send end of names
-    sendReply(client, RPL_ENDOFNAMES, channel_name + " :End of NAMES list");
+    std::string out;
+    appendNames(out, client, channel);
+    client->sendRaw(out);
 }
 
 void CommandHandler::handleKick(Client* client, const std::vector<std::string>& params) {
@@ -517,10 +873,14 @@ void CommandHandler::handleKick(Client* client, const std::vector<std::string>&
                           " KICK " + channel_name + " " + target_nick + " :" + kick_message + "\r\n";
     
     // Send kick message to all clients in the channel (including the kicked user)
-    channel->broadcast(kick_msg);
+    channel->broadcastLocal(kick_msg);
+    _server.propagate(kick_msg);
     
     // Remove the kicked user from the channel
     channel->removeClient(target);
+    target->leaveChannel(channel);
+    if (channel->getClients().empty())
+        _server.removeChannel(channel_name);
 }
 
 void CommandHandler::handleTopic(Client* client, const std::vector<std::string>& params) {
@@ -623,7 +983,7 @@ void CommandHandler::handleInvite(Client* client, const std::vector<std::string>
     invite_msg += " ";
     invite_msg += channelName;
     invite_msg += "\r\n";
-    send(target->getFd(), invite_msg.c_str(), invite_msg.length(), 0);
+    target->sendRaw(invite_msg);
 
     // Send RPL_INVITING to inviter
     sendReply(client, RPL_INVITING, nickname + " " + channelName);
@@ -661,11 +1021,11 @@ void CommandHandler::handleMode(Client* client, const std::vector<std::string>&
     std::string modes = params[1];
     size_t param_index = 2;
     bool adding = true;  // Default to adding modes
-    std::string modeChanges;
     Client* targetClient = NULL;  // Moved outside switch
 
     for (size_t i = 0; i < modes.length(); ++i) {
         char mode = modes[i];
+        std::string mode_arg;
         
         // Handle mode flag
         if (mode == '+') {
@@ -683,10 +1043,19 @@ void CommandHandler::handleMode(Client* client, const std::vector<std::string>&
             case 'i':  // Invite only
                 channel->setInviteOnly(adding);
                 break;
+            case 'U':  // UTF-8 only
+            case 'S':  // Strip control characters
+                {
+                    int bit = mode == 'U' ? TEXT_UTF8ONLY : TEXT_SCRUB;
+                    int policy = channel->getTextPolicy();
+                    channel->setTextPolicy(adding ? (policy | bit) : (policy & ~bit));
+                }
+                break;
             case 'k':  // Channel key
                 if (adding) {
                     if (param_index < params.size()) {
-                        channel->setKey(params[param_index++]);
+                        mode_arg = params[param_index++];
+                        channel->setKey(mode_arg);
                     } else {
                         sendReply(client, ERR_NEEDMOREPARAMS, "MODE :Not enough parameters");
                         return;
@@ -698,7 +1067,8 @@ void CommandHandler::handleMode(Client* client, const std::vector<std::string>&
             case 'l':  // User limit
                 if (adding) {
                     if (param_index < params.size()) {
-                        size_t limit = std::atoi(params[param_index++].c_str());
+                        mode_arg = params[param_index++];
+                        size_t limit = std::atoi(mode_arg.c_str());
                         channel->setUserLimit(limit);
                     } else {
                         sendReply(client, ERR_NEEDMOREPARAMS, "MODE :Not enough parameters");
@@ -709,66 +1079,37 @@ void CommandHandler::handleMode(Client* client, const std::vector<std::string>&
                 }
                 break;
             case 'v':
-                if (i + 1 >= params.size()) {
-                    sendReply(client, ERR_NEEDMOREPARAMS, "MODE :Not enough parameters");
-                    return;
-                }
-                targetClient = _server.getClientByNickname(params[i + 1]);
-                if (!targetClient) {
-                    sendReply(client, ERR_NOSUCHNICK, params[i + 1] + " :No such nick");
-                    return;
-                }
-                if (!channel->hasClient(targetClient)) {
-                    sendReply(client, ERR_NOTONCHANNEL, channel_name + " :They aren't on that channel");
-                    return;
-                }
-                if (adding) {
-                    if (!channel->isVoiced(targetClient)) {
-                        channel->addVoice(targetClient);
-                        modeChanges += "+v " + params[i + 1] + " ";
-                    }
-                } else {
-                    if (channel->isVoiced(targetClient)) {
-                        channel->removeVoice(targetClient);
-                        modeChanges += "-v " + params[i + 1] + " ";
-                    }
-                }
-                i++; // Skip the nickname parameter
-                break;
             case 'o':
-                if (i + 1 >= params.size()) {
+                if (param_index >= params.size()) {
                     sendReply(client, ERR_NEEDMOREPARAMS, "MODE :Not enough parameters");
                     return;
                 }
-                targetClient = _server.getClientByNickname(params[i + 1]);
+                mode_arg = params[param_index++];
+                targetClient = _server.getClientByNickname(mode_arg);
                 if (!targetClient) {
-                    sendReply(client, ERR_NOSUCHNICK, params[i + 1] + " :No such nick");
+                    sendReply(client, ERR_NOSUCHNICK, mode_arg + " :No such nick");
                     return;
                 }
                 if (!channel->hasClient(targetClient)) {
                     sendReply(client, ERR_NOTONCHANNEL, channel_name + " :They aren't on that channel");
                     return;
                 }
-                if (adding) {
-                    if (!channel->isOperator(targetClient)) {
-                        channel->addOperator(targetClient);
-                        modeChanges += "+o " + params[i + 1] + " ";
-                    }
-                } else {
-                    if (channel->isOperator(targetClient)) {
-                        channel->removeOperator(targetClient);
-                        modeChanges += "-o " + params[i + 1] + " ";
-                    }
-                }
-                i++; // Skip the nickname parameter
+                if (mode == 'o' && adding)
+                    channel->addOperator(targetClient);
+                else if (mode == 'o')
+                    channel->removeOperator(targetClient);
+                else if (adding)
+                    channel->addVoice(targetClient);
+                else
+                    channel->removeVoice(targetClient);
                 break;
             case 'b':  // Ban
                 if (param_index < params.size()) {
-                    std::string mask = params[param_index++];
+                    mode_arg = params[param_index++];
                     if (adding) {
-                        channel->addBan(mask);
+                        channel->addBan(mode_arg);
                     } else {
-                        channel->removeBan(mask);
+                        channel->removeBan(mode_arg);
                     }
                 } else {
                     sendReply(client, ERR_NEEDMOREPARAMS, "MODE :Not enough parameters");
@@ -792,27 +1133,626 @@ void CommandHandler::handleMode(Client* client, const std::vector<std::string>&
         mode_msg += " ";
         mode_msg += (adding ? "+" : "-");
         mode_msg += mode;
-        if (mode == 'k' || mode == 'l' || mode == 'b') {
+        if (!mode_arg.empty()) {
             mode_msg += " ";
-            mode_msg += params[param_index - 1];
+            mode_msg += mode_arg;
         }
         mode_msg += "\r\n";
-        channel->broadcast(mode_msg);
+        channel->broadcastLocal(mode_msg);
+        _server.propagate(mode_msg);
+    }
+}
+
+// LIST [<channel|mask|condition>{,...}] [<server>]
+void CommandHandler::handleList(Client* client, const std::vector<std::string>& params) {
+    if (!client->isRegistered()) {
+        sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
+        return;
+    }
+
+    // A new LIST cuts short one still streaming
+    if (client->getListQuery()) {
+        client->setListQuery(NULL);
+        sendReply(client, RPL_LISTEND, ":End of LIST");
+    }
+
+    ListQuery* query = new ListQuery(time(NULL));
+    std::vector<std::string> terms = params.empty() ? std::vector<std::string>() : splitList(params[0]);
+    for (size_t i = 0; i < terms.size(); ++i) {
+        if (!query->addTerm(terms[i]))
+            Logger::debug("LIST: ignoring malformed condition " + terms[i]);
+    }
+
+    std::string out = formatReply(client, RPL_LISTSTART, "Channel :Users  Name");
+    if (query->isLookupOnly()) {
+        const std::vector<std::string>& names = query->getMasks();
+        for (size_t i = 0; i < names.size(); ++i) {
+            Channel* channel = _server.getChannel(names[i]);
+            if (channel)
+                out += formatReply(client, RPL_LIST, channel->getName() + " "
+                                   + numberToString(channel->getClients().size()) + " :" + channel->getTopic());
+        }
+        delete query;
+        client->sendRaw(out + formatReply(client, RPL_LISTEND, ":End of LIST"));
+        return;
+    }
+
+    // Anything else walks the channel index, a slice per loop tick
+    client->sendRaw(out);
+    client->setListQuery(query);
+    if (continueList(client))
+        client->setListQuery(NULL);
+    else
+        _server.startListing(client);
+}
+
+// Emits the next slice of a LIST: at most LIST_SCAN_BUDGET channels are
+// examined, and the slice ends early once the client's queue backs up
+bool CommandHandler::continueList(Client* client) {
+    ListQuery* query = client->getListQuery();
+    Channel* channel = query->getCursor() ? ChannelRegistry::next(query->getCursor())
+                                          : _server.getChannels().first();
+
+    std::string out;
+    for (size_t scanned = 0; channel; channel = ChannelRegistry::next(channel), ++scanned) {
+        if (scanned == LIST_SCAN_BUDGET || client->getSendQueueSize() + out.size() > LIST_SENDQ_SOFT)
+            break;
+        query->setCursor(channel);
+        if (query->matches(*channel))
+            out += formatReply(client, RPL_LIST, channel->getName() + " "
+                               + numberToString(channel->getClients().size()) + " :" + channel->getTopic());
+    }
+
+    bool done = channel == NULL;
+    if (done)
+        out += formatReply(client, RPL_LISTEND, ":End of LIST");
+    client->sendRaw(out);
+    return done;
+}
+
+// User queries
+
+static const size_t QUERY_FLUSH_BYTES = 4096;
+
+static bool whoMatches(const std::string& mask, Client* user) {
+    return CaseMapping::match(mask, user->getNickname())
+        || CaseMapping::match(mask, user->getUsername())
+        || CaseMapping::match(mask, user->getHostname())
+        || CaseMapping::match(mask, user->getServerName())
+        || CaseMapping::match(mask, user->getRealname());
+}
+
+std::string CommandHandler::whoRow(Client* client, Client* user, Channel* channel) {
+    std::string flags = "H";
+    if (channel && channel->isOperator(user))
+        flags += "@";
+    else if (channel && channel->isVoiced(user))
+        flags += "+";
+
+    return formatReply(client, RPL_WHOREPLY, (channel ? channel->getName() : std::string("*"))
+                       + " " + user->getUsername() + " " + user->getHostname()
+                       + " " + (user->isRemote() ? user->getServerName() : _server.getHostname())
+                       + " " + user->getNickname() + " " + flags
+                       + " :" + (user->isRemote() ? "1 " : "0 ") + user->getRealname());
+}
+
+// Candidates come from the narrowest index the mask allows: channel
+// membership, the nick hash, or the reversed-host map for "*suffix" masks.
+// Only other masks fall back to a scan, and every path stops at
+// WHO_MAX_ROWS or once the asker's send queue backs up.
+void CommandHandler::handleWho(Client* client, const std::vector<std::string>& params) {
+    if (!client->isRegistered()) {
+        sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
+        return;
+    }
+
+    std::string mask = params.empty() || params[0] == "0" ? "*" : params[0];
+    std::vector<Client*> users;
+    Channel* channel = NULL;
+    bool filter = true;
+
+    if (mask[0] == '#' || mask[0] == '&') {
+        channel = _server.getChannel(mask);
+        if (channel)
+            users = channel->getClients();
+        filter = false;
+    } else if (!CaseMapping::hasWildcards(mask)) {
+        Client* user = _server.getClientByNickname(mask);
+        if (user)
+            users.push_back(user);
+        else
+            _server.findByHostSuffix(mask, users, WHO_MAX_ROWS + 1);
+    } else if (mask[0] == '*' && !CaseMapping::hasWildcards(mask.substr(1))) {
+        _server.findByHostSuffix(mask.substr(1), users, WHO_MAX_ROWS + 1);
+    } else {
+        const OpenHashMap<Client*>& nicks = _server.getNickIndex();
+        for (size_t i = 0; i < nicks.capacity() && users.size() <= WHO_MAX_ROWS; ++i) {
+            if (nicks.occupied(i) && nicks.valueAt(i)->isRegistered() && whoMatches(mask, nicks.valueAt(i)))
+                users.push_back(nicks.valueAt(i));
+        }
+        filter = false;
+    }
+
+    std::string out;
+    size_t rows = 0;
+    bool truncated = false;
+    for (size_t i = 0; i < users.size(); ++i) {
+        Client* user = users[i];
+        if (!user->isRegistered() || (filter && !whoMatches(mask, user)))
+            continue;
+        if (rows == WHO_MAX_ROWS || client->getSendQueueSize() > WHO_SENDQ_SOFT) {
+            truncated = true;
+            break;
+        }
+        out += whoRow(client, user, channel);
+        ++rows;
+        if (out.size() >= QUERY_FLUSH_BYTES) {
+            client->sendRaw(out);
+            out.clear();
+        }
+    }
+    if (truncated)
+        out += formatReply(client, ERR_TOOMANYMATCHES, "WHO " + mask + " :Output too long");
+    out += formatReply(client, RPL_ENDOFWHO, mask + " :End of WHO list");
+    client->sendRaw(out);
+}
+
+void CommandHandler::appendWhois(std::string& out, Client* client, Client* user) {
+    const std::string& nick = user->getNickname();
+    out += formatReply(client, RPL_WHOISUSER, nick + " " + user->getUsername() + " "
+                       + user->getHostname() + " * :" + user->getRealname());
+
+    // Channel list in pieces that keep each line under 512 bytes
+    std::string list;
+    const std::vector<Channel*>& channels = user->getChannels();
+    for (size_t i = 0; i < channels.size(); ++i) {
+        std::string entry = channels[i]->isOperator(user) ? "@"
+                          : channels[i]->isVoiced(user) ? "+" : "";
+        entry += channels[i]->getName();
+        if (!list.empty() && list.size() + entry.size() + 1 > NAMES_CHUNK_BYTES) {
+            out += formatReply(client, RPL_WHOISCHANNELS, nick + " :" + list);
+            list.clear();
+        }
+        list += (list.empty() ? "" : " ") + entry;
+    }
+    if (!list.empty())
+        out += formatReply(client, RPL_WHOISCHANNELS, nick + " :" + list);
+    if (!user->getAccount().empty())
+        out += formatReply(client, RPL_WHOISACCOUNT, nick + " " + user->getAccount() + " :is logged in as");
+
+    if (user->isRemote()) {
+        out += formatReply(client, RPL_WHOISSERVER, nick + " " + user->getServerName()
+                           + " :via " + user->getUplink()->getServerName());
+        return;
+    }
+    out += formatReply(client, RPL_WHOISSERVER, nick + " " + _server.getHostname()
+                       + " :" + SERVER_NAME + " " + SERVER_VERSION);
+
+    std::ostringstream idle;
+    idle << nick << " " << (TimerWheel::monotonicMs() - user->getLastActivity()) / 1000
+         << " " << user->getSignon() << " :seconds idle, signon time";
+    out += formatReply(client, RPL_WHOISIDLE, idle.str());
+}
+
+void CommandHandler::handleWhois(Client* client, const std::vector<std::string>& params) {
+    if (!client->isRegistered()) {
+        sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
+        return;
+    }
+    if (params.empty() || params.back().empty()) {
+        sendReply(client, ERR_NONICKNAMEGIVEN, ":No nickname given");
+        return;
+    }
+
+    // WHOIS [<server>] <nick>{,<nick>}; every user is answered locally
+    std::vector<std::string> masks = splitList(params.size() > 1 ? params[1] : params[0]);
+    if (masks.size() > _server.getConfig().max_targets)
+        masks.resize(_server.getConfig().max_targets);
+
+    std::string out;
+    for (size_t m = 0; m < masks.size(); ++m) {
+        const std::string& mask = masks[m];
+        std::vector<Client*> users;
+        if (!CaseMapping::hasWildcards(mask)) {
+            Client* user = _server.getClientByNickname(mask);
+            if (user && user->isRegistered())
+                users.push_back(user);
+        } else {
+            const OpenHashMap<Client*>& nicks = _server.getNickIndex();
+            for (size_t i = 0; i < nicks.capacity() && users.size() <= WHOIS_MAX_MATCHES; ++i) {
+                if (nicks.occupied(i) && nicks.valueAt(i)->isRegistered()
+                    && CaseMapping::match(mask, nicks.valueAt(i)->getNickname()))
+                    users.push_back(nicks.valueAt(i));
+            }
+        }
+
+        if (users.empty())
+            out += formatReply(client, ERR_NOSUCHNICK, mask + " :No such nick/channel");
+        bool truncated = false;
+        for (size_t i = 0; i < users.size(); ++i) {
+            if (i == WHOIS_MAX_MATCHES || client->getSendQueueSize() > WHO_SENDQ_SOFT) {
+                truncated = true;
+                break;
+            }
+            appendWhois(out, client, users[i]);
+        }
+        if (truncated)
+            out += formatReply(client, ERR_TOOMANYMATCHES, "WHOIS " + mask + " :Output too long");
+        out += formatReply(client, RPL_ENDOFWHOIS, mask + " :End of WHOIS list");
+
+        if (out.size() >= QUERY_FLUSH_BYTES) {
+            client->sendRaw(out);
+            out.clear();
+        }
+    }
+    client->sendRaw(out);
+}
+
+// CAP LS [302] | LIST | REQ :<caps> | END. sasl is offered while the
+// account store is open; batch, message-tags and server-time only change
+// CHATHISTORY replies. An unregistered client that starts negotiating
+// registers at CAP END.
+void CommandHandler::handleCap(Client* client, const std::vector<std::string>& params) {
+    if (params.empty()) {
+        sendReply(client, ERR_NEEDMOREPARAMS, "CAP :Not enough parameters");
+        return;
+    }
+
+    std::string subcommand = params[0];
+    CaseMapping::upperAsciiInPlace(subcommand);
+    std::string prefix = ":" + _server.getHostname() + " CAP "
+                       + (client->getNickname().empty() ? "*" : client->getNickname()) + " ";
+    bool sasl = _server.getAccounts().isOpen();
+    if (subcommand == "LS") {
+        if (!client->isRegistered())
+            client->setCapNegotiating(true);
+        bool values = params.size() > 1 && std::atoi(params[1].c_str()) >= 302;
+        std::string list;
+        for (size_t i = 0; i < CAPABILITY_COUNT; ++i) {
+            if (CAPABILITIES[i].bit == CAP_SASL && !sasl)
+                continue;
+            list += std::string(list.empty() ? "" : " ") + CAPABILITIES[i].name;
+            if (CAPABILITIES[i].bit == CAP_SASL && values)
+                list += "=PLAIN";
+        }
+        client->sendMessage(prefix + "LS :" + list);
+    } else if (subcommand == "LIST") {
+        std::string list;
+        for (size_t i = 0; i < CAPABILITY_COUNT; ++i) {
+            if (client->getCaps() & CAPABILITIES[i].bit)
+                list += std::string(list.empty() ? "" : " ") + CAPABILITIES[i].name;
+        }
+        client->sendMessage(prefix + "LIST :" + list);
+    } else if (subcommand == "REQ") {
+        if (!client->isRegistered())
+            client->setCapNegotiating(true);
+        std::string requested = params.size() > 1 ? params[1] : "";
+        std::istringstream names(requested);
+        std::string name;
+        int caps = client->getCaps();
+        bool known = true;
+        while (names >> name) {
+            bool remove = name[0] == '-';
+            int bit = capabilityBit(name.substr(remove ? 1 : 0));
+            if (!bit || (bit == CAP_SASL && !remove && !sasl))
+                known = false;
+            else if (remove)
+                caps &= ~bit;
+            else
+                caps |= bit;
+        }
+        // All or nothing
+        if (known)
+            client->setCaps(caps);
+        client->sendMessage(prefix + (known ? "ACK :" : "NAK :") + requested);
+    } else if (subcommand == "END") {
+        if (client->isRegistered())
+            return;
+        client->setCapNegotiating(false);
+        client->setSaslStarted(false);
+        tryCompleteRegistration(client);
+    } else {
+        sendReply(client, ERR_INVALIDCAPCMD, params[0] + " :Invalid CAP command");
+    }
+}
+
+// AUTHENTICATE PLAIN, then the base64 of "authzid\0authcid\0password" in
+// 400-byte chunks ("+" for an empty one). "*" aborts.
+void CommandHandler::handleAuthenticate(Client* client, const std::vector<std::string>& params) {
+    if (params.empty()) {
+        sendReply(client, ERR_NEEDMOREPARAMS, "AUTHENTICATE :Not enough parameters");
+        return;
+    }
+    if (!(client->getCaps() & CAP_SASL)) {
+        sendReply(client, ERR_SASLFAIL, ":SASL authentication failed");
+        return;
+    }
+    if (!client->getAccount().empty() || client->isRegistered()) {
+        sendReply(client, ERR_SASLALREADY, ":You have already authenticated using SASL");
+        return;
+    }
+
+    const std::string& data = params[0];
+    if (data == "*") {
+        client->setSaslStarted(false);
+        sendReply(client, ERR_SASLABORTED, ":SASL authentication aborted");
+        return;
+    }
+
+    if (!client->isSaslStarted()) {
+        std::string mechanism = data;
+        CaseMapping::upperAsciiInPlace(mechanism);
+        if (mechanism != "PLAIN") {
+            sendReply(client, RPL_SASLMECHS, "PLAIN :are available SASL mechanisms");
+            sendReply(client, ERR_SASLFAIL, ":SASL authentication failed");
+            return;
+        }
+        client->setSaslStarted(true);
+        client->sendMessage("AUTHENTICATE +");
+        return;
+    }
+
+    std::string& payload = client->getSaslPayload();
+    if (data.size() > SASL_CHUNK || payload.size() + data.size() > SASL_PAYLOAD_MAX) {
+        client->setSaslStarted(false);
+        sendReply(client, ERR_SASLTOOLONG, ":SASL message too long");
+        return;
+    }
+    if (data != "+")
+        payload += data;
+    if (data.size() == SASL_CHUNK)
+        return;
+
+    std::string decoded;
+    bool valid = decodeBase64(payload, decoded);
+    client->setSaslStarted(false);
+    size_t first = decoded.find('\0');
+    size_t second = first == std::string::npos ? first : decoded.find('\0', first + 1);
+    if (!valid || second == std::string::npos) {
+        sendReply(client, ERR_SASLFAIL, ":SASL authentication failed");
+        return;
+    }
+    std::string authzid = decoded.substr(0, first);
+    std::string authcid = decoded.substr(first + 1, second - first - 1);
+    std::string password = decoded.substr(second + 1);
+
+    // Logging in as someone else is not supported
+    if (authcid.empty() || (!authzid.empty() && !CaseMapping::equals(authzid, authcid))) {
+        Logger::warning("Failed SASL login as " + authcid + " from " + client->getHostname());
+        sendReply(client, ERR_SASLFAIL, ":SASL authentication failed");
+        return;
+    }
+
+    // An unknown account is checked against a throwaway hash on the same
+    // workers, so the reply time does not tell which accounts exist
+    std::string hash;
+    if (!_server.getAccounts().find(authcid, hash))
+        hash = _dummy_hash;
+    verifyCredential(client, CREDENTIAL_SASL, CaseMapping::fold(authcid), password, hash);
+}
+
+// REGISTER <account|*> <email> <password>: the account is the current nick.
+// The email is not stored. The new hash is made on the credential pool.
+void CommandHandler::handleRegister(Client* client, const std::vector<std::string>& params) {
+    if (!client->isRegistered()) {
+        client->sendMessage(":" + _server.getHostname() + " FAIL REGISTER COMPLETE_CONNECTION_REQUIRED * "
+                            ":Complete registration before registering an account");
+        return;
+    }
+    if (params.size() < 3) {
+        sendReply(client, ERR_NEEDMOREPARAMS, "REGISTER :Not enough parameters");
+        return;
+    }
+
+    const std::string& nickname = client->getNickname();
+    std::string account = params[0] == "*" ? nickname : params[0];
+    std::string fail = ":" + _server.getHostname() + " FAIL REGISTER ";
+    AccountStore& accounts = _server.getAccounts();
+    if (!client->getAccount().empty()) {
+        client->sendMessage(fail + "ALREADY_AUTHENTICATED " + account + " :You are already logged in");
+    } else if (!CaseMapping::equals(account, nickname)) {
+        client->sendMessage(fail + "ACCOUNT_NAME_MUST_BE_NICK " + account + " :Register your current nickname");
+    } else if (!accounts.isOpen()) {
+        client->sendMessage(fail + "TEMPORARILY_UNAVAILABLE " + account + " :Accounts are unavailable");
+    } else if (accounts.exists(account)) {
+        client->sendMessage(fail + "ACCOUNT_EXISTS " + account + " :Account already exists");
+    } else if (params[2].size() < ACCOUNT_PASSWORD_MIN) {
+        client->sendMessage(fail + "WEAK_PASSWORD " + account + " :Use at least "
+                            + numberToString(ACCOUNT_PASSWORD_MIN) + " characters");
+    } else {
+        CredentialPool::Request request;
+        request.client_id = client->getId();
+        request.fd = client->getFd();
+        request.kind = CREDENTIAL_REGISTER;
+        request.name = CaseMapping::fold(nickname);  // Accounts are named in folded case
+        request.secret = params[2];
+        if (!_server.getCredentials().submit(request)) {
+            client->sendMessage(fail + "TEMPORARILY_UNAVAILABLE " + account + " :Server is busy, try again later");
+            return;
+        }
+        client->setAuthPending(true);
+    }
+}
+
+// The name was checked before hashing; create() settles a race with
+// another REGISTER for the same name
+void CommandHandler::finishRegister(Client* client, const CredentialPool::Result& result) {
+    std::string fail = ":" + _server.getHostname() + " FAIL REGISTER ";
+    if (!result.ok) {
+        client->sendMessage(fail + "TEMPORARILY_UNAVAILABLE " + result.name + " :Could not hash the password");
+        return;
+    }
+    if (!_server.getAccounts().create(result.name, result.hash)) {
+        client->sendMessage(fail + "ACCOUNT_EXISTS " + result.name + " :Account already exists");
+        return;
+    }
+    Logger::info("Registered account " + result.name);
+    client->sendMessage(":" + _server.getHostname() + " REGISTER SUCCESS " + result.name
+                        + " :Account created");
+    logIn(client, result.name);
+}
+
+void CommandHandler::logIn(Client* client, const std::string& account) {
+    client->setAccount(account);
+    std::string mask = (client->getNickname().empty() ? "*" : client->getNickname()) + "!"
+                     + (client->getUsername().empty() ? "*" : client->getUsername()) + "@"
+                     + client->getHostname();
+    sendReply(client, RPL_LOGGEDIN, mask + " " + account + " :You are now logged in as " + account);
+}
+
+// OPER <name> <password>
+void CommandHandler::handleOper(Client* client, const std::vector<std::string>& params) {
+    if (!client->isRegistered()) {
+        sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
+        return;
+    }
+
+    if (params.size() < 2) {
+        sendReply(client, ERR_NEEDMOREPARAMS, "OPER :Not enough parameters");
+        return;
+    }
+
+    if (!_server.hasOpers()) {
+        sendReply(client, ERR_NOOPERHOST, ":No O-lines for your host");
+        return;
+    }
+
+    // An unknown name is checked against a throwaway password of the kind
+    // the configured ones are, so the reply time does not tell which exist
+    std::string expected;
+    if (!_server.findOper(params[0], expected))
+        expected = _server.hasHashedOpers() ? _dummy_hash : "*";
+    verifyCredential(client, CREDENTIAL_OPER, params[0], params[1], expected);
+}
+
+// STATS m: per-command cost, one row per command and client class that ran
+// it. Averages are per call; cycles are TSC ticks.
+// STATS z: heap bytes per subsystem, the share per user and the RSS.
+// STATS a: credential pool queue and timings.
+// STATS r: input reads, bytes per read and reads per wakeup.
+// STATS f: channel fan-out on sender threads.
+void CommandHandler::handleStats(Client* client, const std::vector<std::string>& params) {
+    if (!client->isRegistered()) {
+        sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
+        return;
+    }
+
+    if (params.empty() || params[0].empty()) {
+        sendReply(client, ERR_NEEDMOREPARAMS, "STATS :Not enough parameters");
+        return;
     }
 
-    // Broadcast mode changes
-    if (!modeChanges.empty()) {
-        std::string mode_changes_msg = ":";
-        mode_changes_msg += client->getNickname();
-        mode_changes_msg += "!";
-        mode_changes_msg += client->getUsername();
-        mode_changes_msg += "@";
-        mode_changes_msg += SERVER_NAME;
-        mode_changes_msg += " MODE ";
-        mode_changes_msg += channel_name;
-        mode_changes_msg += " :" + modeChanges + "\r\n";
-        channel->broadcast(mode_changes_msg);
+    if (!client->isOper()) {
+        sendReply(client, ERR_NOPRIVILEGES, ":Permission Denied- You're not an IRC operator");
+        return;
+    }
+
+    const std::string query = params[0].substr(0, 1);
+    std::string out;
+    if (query == "m" || query == "M") {
+        const CommandProfiler& profiler = _server.getProfiler();
+        bool counters = profiler.getMode() == CommandProfiler::PROFILE_COUNTERS;
+        const CommandProfiler::Table& table = profiler.getTable();
+        for (CommandProfiler::Table::const_iterator it = table.begin(); it != table.end(); ++it) {
+            for (int i = 0; i < CommandProfiler::CLASS_COUNT; ++i) {
+                const CommandProfiler::Totals& totals = it->second.by_class[i];
+                if (totals.calls == 0)
+                    continue;
+                std::ostringstream row;
+                row << it->first << " " << CommandProfiler::className(static_cast<CommandProfiler::ClientClass>(i))
+                    << " calls=" << totals.calls << " cycles=" << totals.cycles
+                    << " avg=" << totals.cycles / totals.calls << " max=" << totals.max_cycles;
+                if (counters) {
+                    row << " insn=" << totals.counters[CommandProfiler::COUNTER_INSTRUCTIONS] / totals.calls
+                        << " cache-miss=" << totals.counters[CommandProfiler::COUNTER_CACHE_MISSES] / totals.calls
+                        << " branch-miss=" << totals.counters[CommandProfiler::COUNTER_BRANCH_MISSES] / totals.calls;
+                }
+                out += formatReply(client, RPL_STATSCOMMANDS, row.str());
+            }
+        }
+    } else if (query == "a" || query == "A") {
+        const CredentialPool& pool = _server.getCredentials();
+        CredentialPool::Stats stats = pool.getStats();
+        std::ostringstream row;
+        row << ":workers " << pool.getWorkerCount() << " depth " << pool.depth() << "/" << pool.getMaxQueue()
+            << " max-depth " << stats.max_depth << " submitted " << stats.submitted
+            << " completed " << stats.completed << " rejected " << stats.rejected
+            << " mismatches " << stats.mismatches;
+        out += formatReply(client, RPL_STATSDEBUG, row.str());
+        std::ostringstream timing;
+        uint64_t completed = stats.completed ? stats.completed : 1;
+        timing << ":avg-wait " << stats.wait_ms / completed << "ms avg-verify "
+               << stats.verify_ms / completed << "ms";
+        out += formatReply(client, RPL_STATSDEBUG, timing.str());
+    } else if (query == "r" || query == "R") {
+        const Server::ReadStats& stats = _server.getReadStats();
+        uint64_t reads = stats.reads ? stats.reads : 1;
+        uint64_t events = stats.events ? stats.events : 1;
+        std::ostringstream row;
+        row << ":events " << stats.events << " reads " << stats.reads << " bytes " << stats.bytes
+            << " budget-stops " << stats.budget_stops;
+        out += formatReply(client, RPL_STATSDEBUG, row.str());
+        std::ostringstream averages;
+        averages << ":bytes/read " << stats.bytes / reads << " max " << stats.max_read
+                 << " reads/event " << stats.reads * 100 / events / 100.0 << " max " << stats.max_reads;
+        out += formatReply(client, RPL_STATSDEBUG, averages.str());
+    } else if (query == "f" || query == "F") {
+        const FanoutPool& fanout = _server.getFanout();
+        const FanoutPool::Stats& stats = fanout.getStats();
+        std::ostringstream row;
+        row << ":threads " << fanout.getThreadCount() << " threshold " << fanout.getThreshold()
+            << " fanouts " << stats.fanouts << " recipients " << stats.recipients
+            << " queued " << stats.queued;
+        out += formatReply(client, RPL_STATSDEBUG, row.str());
+    } else if (query == "z" || query == "Z") {
+        MemoryStats stats;
+        _server.accountMemory(stats);
+        for (int i = 0; i < MemoryStats::MEM_COUNT; ++i) {
+            std::ostringstream row;
+            row << ":" << MemoryStats::name(static_cast<MemoryStats::Category>(i))
+                << " " << stats.items[i] << " items " << stats.bytes[i] << " bytes";
+            out += formatReply(client, RPL_STATSDEBUG, row.str());
+        }
+        size_t users = stats.items[MemoryStats::MEM_CLIENTS];
+        std::ostringstream summary;
+        summary << ":total " << stats.total() << " bytes, " << stats.total() / (users ? users : 1)
+                << " per client, resident " << MemoryStats::residentBytes() << " bytes";
+        out += formatReply(client, RPL_STATSDEBUG, summary.str());
+    }
+    out += formatReply(client, RPL_ENDOFSTATS, query + " :End of STATS report");
+    client->sendRaw(out);
+}
+
+// PROFILE [OFF|CYCLES|COUNTERS|RESET]; without an argument reports the mode
+void CommandHandler::handleProfile(Client* client, const std::vector<std::string>& params) {
+    if (!client->isRegistered()) {
+        sendReply(client, ERR_NOTREGISTERED, ":You have not registered");
+        return;
     }
+
+    if (!client->isOper()) {
+        sendReply(client, ERR_NOPRIVILEGES, ":Permission Denied- You're not an IRC operator");
+        return;
+    }
+
+    CommandProfiler& profiler = _server.getProfiler();
+    std::string request = params.empty() ? "" : params[0];
+    CaseMapping::upperAsciiInPlace(request);
+    if (request == "RESET") {
+        profiler.reset();
+    } else if (request == "OFF") {
+        profiler.setMode(CommandProfiler::PROFILE_OFF);
+    } else if (request == "CYCLES") {
+        profiler.setMode(CommandProfiler::PROFILE_CYCLES);
+    } else if (request == "COUNTERS") {
+        profiler.setMode(CommandProfiler::PROFILE_COUNTERS);
+    } else if (!request.empty()) {
+        client->sendMessage(":" + _server.getHostname() + " FAIL PROFILE INVALID_PARAMS " + params[0]
+                            + " :Expected OFF, CYCLES, COUNTERS or RESET");
+        return;
+    }
+    client->sendMessage(":" + _server.getHostname() + " NOTICE " + client->getNickname()
+                        + " :Profiling " + CommandProfiler::modeName(profiler.getMode()));
 }
 
 void CommandHandler::handleCommand(Client* client, const std::string& message) {
@@ -824,12 +1764,29 @@ void CommandHandler::handleCommand(Client* client, const std::string& message) {
     std::vector<std::string> params(tokens.begin() + 1, tokens.end());
 
     // Convert command to uppercase for case-insensitive comparison
-    for (std::string::iterator it = command.begin(); it != command.end(); ++it)
-        *it = toupper(*it);
+    CaseMapping::upperAsciiInPlace(command);
 
     Logger::debug("Processing command: " + command + " from " + client->getNickname());
 
-    // Handle valid commands only
+    // Profiling costs one branch here when off. The class is taken before
+    // the handler runs, as QUIT or OPER may change it.
+    CommandProfiler& profiler = _server.getProfiler();
+    if (!profiler.isEnabled()) {
+        dispatch(client, command, params);
+        return;
+    }
+    CommandProfiler::ClientClass client_class = !client->isRegistered() ? CommandProfiler::CLASS_UNREGISTERED
+                                              : client->isOper() ? CommandProfiler::CLASS_OPERATOR
+                                              : CommandProfiler::CLASS_USER;
+    CommandProfiler::Sample sample;
+    profiler.begin(sample);
+    bool known = dispatch(client, command, params);
+    profiler.end(sample, known ? command : "UNKNOWN", client_class);  // Bounds the table
+}
+
+// Returns false for commands this server does not know
+bool CommandHandler::dispatch(Client* client, const std::string& command,
+                              const std::vector<std::string>& params) {
     if (command == "PASS")
         handlePass(client, params);
     else if (command == "NICK")
@@ -838,12 +1795,20 @@ void CommandHandler::handleCommand(Client* client, const std::string& message) {
         handleUser(client, params);
     else if (command == "QUIT")
         handleQuit(client, params);
+    else if (command == "PING")
+        handlePing(client, params);
+    else if (command == "PONG")
+        handlePong(client, params);
     else if (command == "JOIN")
         handleJoin(client, params);
     else if (command == "PART")
         handlePart(client, params);
     else if (command == "PRIVMSG")
         handlePrivmsg(client, params);
+    else if (command == "NOTICE")
+        handleNotice(client, params);
+    else if (command == "CHATHISTORY")
+        handleChathistory(client, params);
     else if (command == "NAMES")
         handleNames(client, params);
     else if (command == "KICK")
@@ -854,8 +1819,28 @@ void CommandHandler::handleCommand(Client* client, const std::string& message) {
         handleInvite(client, params);
     else if (command == "MODE")
         handleMode(client, params);
+    else if (command == "LIST")
+        handleList(client, params);
+    else if (command == "WHO")
+        handleWho(client, params);
+    else if (command == "WHOIS")
+        handleWhois(client, params);
+    else if (command == "OPER")
+        handleOper(client, params);
+    else if (command == "STATS")
+        handleStats(client, params);
+    else if (command == "PROFILE")
+        handleProfile(client, params);
+    else if (command == "CAP")
+        handleCap(client, params);
+    else if (command == "AUTHENTICATE")
+        handleAuthenticate(client, params);
+    else if (command == "REGISTER")
+        handleRegister(client, params);
     else {
         // Any other command is invalid
         sendReply(client, ERR_UNKNOWNCOMMAND, command + " :Unknown command");
+        return false;
     }
+    return true;
 } 
\ No newline at end of file
@@ -0,0 +1,336 @@
+#include "../../include/AccountStore.hpp"
+#include "../../include/CaseMapping.hpp"
+#include "../../include/StateCodec.hpp"
+#include "../../include/Logger.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <stdexcept>
+
+namespace {
+
+const uint32_t INDEX_MAGIC = 0x49524341;  // "IRCA"
+const uint32_t INDEX_VERSION = 1;
+
+// Header: magic, version, slot count, record count, reserved
+const size_t HEADER_SIZE = 32;
+// Slot: hash (4), reserved (4), record offset (8); offset 0 marks it empty
+const size_t SLOT_SIZE = 16;
+const uint64_t MIN_SLOTS = 16;
+
+// Fields are little-endian whatever the host
+uint64_t loadLE(const unsigned char* in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = bytes; i > 0; --i)
+        value = (value << 8) | in[i - 1];
+    return value;
+}
+
+void storeLE(unsigned char* out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+        out[i] = static_cast<unsigned char>(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+bool writeAll(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    size_t offset = 0;
+    while (offset < size) {
+        ssize_t n = write(fd, bytes + offset, size - offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        offset += n;
+    }
+    return true;
+}
+
+bool readFile(const std::string& path, std::string& out) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno == ENOENT;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        out.append(buffer, n);
+    ::close(fd);
+    return n == 0;
+}
+
+}
+
+AccountStore::AccountStore(const std::string& path)
+    : _path(path), _index(NULL), _index_size(0), _slot_count(0), _indexed(0), _log_fd(-1) {
+}
+
+AccountStore::~AccountStore() {
+    close();
+}
+
+// The lock is taken before anything is read, so the files cannot change
+// underneath
+bool AccountStore::open() {
+    if (isOpen())
+        return true;
+
+    _log_fd = ::open((_path + ".log").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (_log_fd < 0) {
+        Logger::error("Failed to open account log: " + std::string(strerror(errno)));
+        return false;
+    }
+    if (flock(_log_fd, LOCK_EX | LOCK_NB) < 0) {
+        Logger::error("Account log " + _path + ".log is in use by another process");
+        close();
+        return false;
+    }
+
+    if (!mapIndex() || !replayLog()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void AccountStore::close() {
+    if (_index)
+        munmap(const_cast<unsigned char*>(_index), _index_size);
+    _index = NULL;
+    _index_size = 0;
+    _slot_count = 0;
+    _indexed = 0;
+    _overlay.clear();
+    if (_log_fd >= 0)
+        ::close(_log_fd);
+    _log_fd = -1;
+}
+
+bool AccountStore::isOpen() const {
+    return _log_fd >= 0;
+}
+
+// Maps the index and checks its header only; pages fault in as lookups
+// touch them
+bool AccountStore::mapIndex() {
+    std::string path = _path + ".index";
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return true;
+        Logger::error("Failed to open " + path + ": " + strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= HEADER_SIZE)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        Logger::error("Failed to map " + path);
+        return false;
+    }
+    madvise(data, st.st_size, MADV_RANDOM);
+
+    _index = static_cast<const unsigned char*>(data);
+    _index_size = st.st_size;
+    _slot_count = loadLE(_index + 8, 8);
+    _indexed = loadLE(_index + 16, 8);
+    bool valid = loadLE(_index, 4) == INDEX_MAGIC && loadLE(_index + 4, 4) == INDEX_VERSION
+              && _slot_count >= MIN_SLOTS && (_slot_count & (_slot_count - 1)) == 0
+              && _slot_count <= (_index_size - HEADER_SIZE) / SLOT_SIZE;
+    if (!valid) {
+        Logger::error("Unrecognized account index " + path);
+        return false;
+    }
+    return true;
+}
+
+// A torn final record, from a crash mid-append, is cut off so later
+// appends start on a record boundary
+bool AccountStore::replayLog() {
+    std::string path = _path + ".log";
+    std::string log;
+    if (!readFile(path, log)) {
+        Logger::error("Failed to read " + path + ": " + strerror(errno));
+        return false;
+    }
+
+    size_t offset = 0;
+    try {
+        while (log.size() - offset >= 4) {
+            StateReader header(log.data() + offset, 4);
+            uint32_t length = header.getU32();
+            if (length > log.size() - offset - 4)
+                break;
+            StateReader in(log.data() + offset + 4, length);
+            uint8_t type = in.getU8();
+            std::string name = in.getString();
+            if (type == REC_REGISTER)
+                _overlay.insert(name, in.getString());
+            offset += 4 + length;
+        }
+    }
+    catch (const std::exception& e) {
+        Logger::warning("Account log " + path + " has a bad record: " + e.what());
+    }
+
+    if (offset < log.size()) {
+        Logger::warning("Dropping torn tail of " + path);
+        if (truncate(path.c_str(), offset) < 0)
+            return false;
+    }
+    return true;
+}
+
+bool AccountStore::findIndexed(const std::string& key, uint32_t h, std::string& hash) const {
+    if (!_index)
+        return false;
+    uint64_t mask = _slot_count - 1;
+    uint64_t i = h & mask;
+    for (uint64_t probes = 0; probes < _slot_count; ++probes, i = (i + 1) & mask) {
+        const unsigned char* slot = _index + HEADER_SIZE + i * SLOT_SIZE;
+        uint64_t offset = loadLE(slot + 8, 8);
+        if (offset == 0)
+            return false;
+        if (loadLE(slot, 4) != h)
+            continue;
+        if (offset > _index_size - 4)
+            return false;
+        const unsigned char* record = _index + offset;
+        size_t name_length = loadLE(record, 2);
+        size_t hash_length = loadLE(record + 2, 2);
+        if (name_length + hash_length > _index_size - offset - 4)
+            return false;
+        if (name_length == key.size() && std::memcmp(record + 4, key.data(), name_length) == 0) {
+            hash.assign(reinterpret_cast<const char*>(record + 4 + name_length), hash_length);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AccountStore::find(const std::string& name, std::string& hash) const {
+    std::string key = CaseMapping::fold(name);
+    uint32_t h = OpenHashMap<std::string>::hash(key);
+    const std::string* logged = _overlay.find(key, h);
+    if (logged) {
+        hash = *logged;
+        return true;
+    }
+    return findIndexed(key, h, hash);
+}
+
+bool AccountStore::exists(const std::string& name) const {
+    std::string hash;
+    return find(name, hash);
+}
+
+bool AccountStore::create(const std::string& name, const std::string& hash) {
+    if (_log_fd < 0 || exists(name))
+        return false;
+
+    std::string key = CaseMapping::fold(name);
+    StateWriter record;
+    record.putU8(REC_REGISTER);
+    record.putString(key);
+    record.putString(hash);
+    StateWriter framed;
+    framed.putU32(static_cast<uint32_t>(record.data().size()));
+    framed.putBytes(record.data().data(), record.data().size());
+    if (!writeAll(_log_fd, framed.data().data(), framed.data().size()) || fdatasync(_log_fd) < 0) {
+        Logger::error("Account log write failed: " + std::string(strerror(errno)));
+        return false;
+    }
+    _overlay.insert(key, hash);
+    return true;
+}
+
+size_t AccountStore::size() const {
+    return _indexed + _overlay.size();
+}
+
+// Rewrites the index from the old index plus the log at half load, then
+// removes the log. The new index is renamed into place only once complete.
+// The store stays open, and the log locked, until the log is gone.
+bool AccountStore::compact(const std::string& path) {
+    AccountStore store(path);
+    if (!store.open())
+        return false;
+
+    std::vector<std::pair<std::string, std::string> > accounts;
+    accounts.reserve(store.size());
+    for (uint64_t i = 0; store._index && i < store._slot_count; ++i) {
+        const unsigned char* slot = store._index + HEADER_SIZE + i * SLOT_SIZE;
+        uint64_t offset = loadLE(slot + 8, 8);
+        if (offset == 0 || offset > store._index_size - 4)
+            continue;
+        const unsigned char* record = store._index + offset;
+        size_t name_length = loadLE(record, 2);
+        size_t hash_length = loadLE(record + 2, 2);
+        if (name_length + hash_length > store._index_size - offset - 4)
+            continue;
+        std::string name(reinterpret_cast<const char*>(record + 4), name_length);
+        if (!store._overlay.find(name))
+            accounts.push_back(std::make_pair(name, std::string(reinterpret_cast<const char*>(record + 4 + name_length),
+                                                                hash_length)));
+    }
+    for (size_t i = 0; i < store._overlay.capacity(); ++i) {
+        if (store._overlay.occupied(i))
+            accounts.push_back(std::make_pair(store._overlay.keyAt(i), store._overlay.valueAt(i)));
+    }
+
+    uint64_t slots = MIN_SLOTS;
+    while (slots < accounts.size() * 2)
+        slots *= 2;
+
+    std::vector<unsigned char> table(HEADER_SIZE + slots * SLOT_SIZE, 0);
+    std::string records;
+    storeLE(&table[0], INDEX_MAGIC, 4);
+    storeLE(&table[4], INDEX_VERSION, 4);
+    storeLE(&table[8], slots, 8);
+    storeLE(&table[16], accounts.size(), 8);
+    for (size_t i = 0; i < accounts.size(); ++i) {
+        const std::string& name = accounts[i].first;
+        const std::string& hash = accounts[i].second;
+        uint32_t h = OpenHashMap<std::string>::hash(name);
+        uint64_t s = h & (slots - 1);
+        while (loadLE(&table[HEADER_SIZE + s * SLOT_SIZE + 8], 8) != 0)
+            s = (s + 1) & (slots - 1);
+        storeLE(&table[HEADER_SIZE + s * SLOT_SIZE], h, 4);
+        storeLE(&table[HEADER_SIZE + s * SLOT_SIZE + 8], table.size() + records.size(), 8);
+
+        unsigned char lengths[4];
+        storeLE(lengths, name.size(), 2);
+        storeLE(lengths + 2, hash.size(), 2);
+        records.append(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+        records += name;
+        records += hash;
+    }
+
+    std::string temp = path + ".index.tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    bool ok = fd >= 0 && writeAll(fd, &table[0], table.size())
+           && writeAll(fd, records.data(), records.size()) && fsync(fd) == 0;
+    if (fd >= 0)
+        ::close(fd);
+    if (!ok || std::rename(temp.c_str(), (path + ".index").c_str()) != 0) {
+        Logger::error("Account compaction failed: " + std::string(strerror(errno)));
+        unlink(temp.c_str());
+        return false;
+    }
+    unlink((path + ".log").c_str());
+
+    char summary[64];
+    std::snprintf(summary, sizeof(summary), "%lu accounts in %lu slots",
+                  static_cast<unsigned long>(accounts.size()), static_cast<unsigned long>(slots));
+    Logger::info("Compacted " + path + ".index: " + summary);
+    return true;
+}
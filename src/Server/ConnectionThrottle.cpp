@@ -0,0 +1,100 @@
+#include "../../include/ConnectionThrottle.hpp"
+
+ConnectionThrottle::ConnectionThrottle()
+    : _max_clones(MAX_CLONES_PER_HOST), _burst(CONNECT_BURST), _interval(CONNECT_INTERVAL) {}
+
+ConnectionThrottle::~ConnectionThrottle() {}
+
+bool ConnectionThrottle::Key::operator<(const Key& other) const {
+    if (family != other.family)
+        return family < other.family;
+    return std::memcmp(bytes, other.bytes, sizeof(bytes)) < 0;
+}
+
+ConnectionThrottle::Key ConnectionThrottle::keyFor(const struct sockaddr_storage& addr) {
+    Key key;
+    std::memset(&key, 0, sizeof(key));
+
+    if (addr.ss_family == AF_INET6) {
+        const struct sockaddr_in6* in6 = reinterpret_cast<const struct sockaddr_in6*>(&addr);
+        const unsigned char* raw = in6->sin6_addr.s6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+            // Dual-stack peers are throttled as the IPv4 host they are
+            key.family = AF_INET;
+            std::memcpy(key.bytes, raw + 12, 4);
+        } else {
+            key.family = AF_INET6;
+            std::memcpy(key.bytes, raw, 8);
+        }
+    } else if (addr.ss_family == AF_INET) {
+        const struct sockaddr_in* in4 = reinterpret_cast<const struct sockaddr_in*>(&addr);
+        key.family = AF_INET;
+        std::memcpy(key.bytes, &in4->sin_addr.s_addr, 4);
+    }
+    return key;
+}
+
+ConnectionThrottle::Verdict ConnectionThrottle::admit(const Key& key, uint64_t now) {
+    std::map<Key, Entry>::iterator it = _entries.find(key);
+    if (it == _entries.end()) {
+        Entry entry;
+        entry.connections = 0;
+        entry.tat = now;
+        it = _entries.insert(std::make_pair(key, entry)).first;
+    }
+    Entry& entry = it->second;
+
+    if (entry.connections >= _max_clones)
+        return TOO_MANY_CLONES;
+
+    // GCRA: allow a burst of connections back to back, then one per interval
+    uint64_t tat = entry.tat > now ? entry.tat : now;
+    if (tat - now > static_cast<uint64_t>(_burst - 1) * _interval)
+        return THROTTLED;
+
+    entry.tat = tat + _interval;
+    ++entry.connections;
+    return ACCEPT;
+}
+
+// Live connections over a lowered clone limit stay; new ones are refused
+void ConnectionThrottle::setLimits(size_t max_clones, size_t burst, uint64_t interval) {
+    _max_clones = max_clones;
+    _burst = burst;
+    _interval = interval;
+}
+
+void ConnectionThrottle::release(const Key& key) {
+    std::map<Key, Entry>::iterator it = _entries.find(key);
+    if (it != _entries.end() && it->second.connections > 0)
+        --it->second.connections;
+}
+
+void ConnectionThrottle::track(const Key& key) {
+    std::map<Key, Entry>::iterator it = _entries.find(key);
+    if (it == _entries.end()) {
+        Entry entry;
+        entry.connections = 0;
+        entry.tat = 0;
+        it = _entries.insert(std::make_pair(key, entry)).first;
+    }
+    ++it->second.connections;
+}
+
+size_t ConnectionThrottle::collect(uint64_t now) {
+    size_t removed = 0;
+    std::map<Key, Entry>::iterator it = _entries.begin();
+    while (it != _entries.end()) {
+        if (it->second.connections == 0 && it->second.tat <= now) {
+            _entries.erase(it++);
+            ++removed;
+        } else {
+            ++it;
+        }
+    }
+    return removed;
+}
+
+size_t ConnectionThrottle::size() const {
+    return _entries.size();
+}
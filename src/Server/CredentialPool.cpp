@@ -0,0 +1,230 @@
+#include "../../include/CredentialPool.hpp"
+#include "../../include/TimerWheel.hpp"
+#include "../../include/Logger.hpp"
+#include <crypt.h>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+
+namespace {
+
+// Compares every byte so the time taken says nothing about the mismatch
+bool constantTimeEquals(const std::string& a, const std::string& b) {
+    unsigned char diff = a.size() != b.size();
+    size_t length = a.size() < b.size() ? a.size() : b.size();
+    for (size_t i = 0; i < length; ++i)
+        diff |= static_cast<unsigned char>(a[i] ^ b[i]);
+    return diff == 0;
+}
+
+bool setPipeFlags(int fd) {
+    return fcntl(fd, F_SETFL, O_NONBLOCK) == 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+}  // namespace
+
+CredentialPool::CredentialPool(size_t workers, size_t max_queue)
+    : _worker_count(workers), _max_queue(max_queue), _busy(0), _stopping(false) {
+    _pipe[0] = -1;
+    _pipe[1] = -1;
+    std::memset(&_stats, 0, sizeof(_stats));
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_work, NULL);
+    pthread_cond_init(&_idle, NULL);
+}
+
+CredentialPool::~CredentialPool() {
+    stop();
+    pthread_cond_destroy(&_idle);
+    pthread_cond_destroy(&_work);
+    pthread_mutex_destroy(&_mutex);
+}
+
+bool CredentialPool::start() {
+    if (pipe(_pipe) < 0 || !setPipeFlags(_pipe[0]) || !setPipeFlags(_pipe[1])) {
+        Logger::error("Credential pool: pipe: " + std::string(strerror(errno)));
+        stop();
+        return false;
+    }
+
+    _stopping = false;
+    for (size_t i = 0; i < _worker_count; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, workerMain, this) != 0) {
+            Logger::error("Credential pool: could not start worker threads");
+            stop();
+            return false;
+        }
+        _workers.push_back(thread);
+    }
+    return true;
+}
+
+void CredentialPool::stop() {
+    pthread_mutex_lock(&_mutex);
+    _stopping = true;
+    pthread_cond_broadcast(&_work);
+    pthread_mutex_unlock(&_mutex);
+
+    for (size_t i = 0; i < _workers.size(); ++i)
+        pthread_join(_workers[i], NULL);
+    _workers.clear();
+    _queue.clear();
+    _done.clear();
+
+    for (int i = 0; i < 2; ++i) {
+        if (_pipe[i] != -1)
+            close(_pipe[i]);
+        _pipe[i] = -1;
+    }
+}
+
+int CredentialPool::getNotifyFd() const {
+    return _pipe[0];
+}
+
+bool CredentialPool::submit(Request request) {
+    request.queued_ms = TimerWheel::monotonicMs();
+
+    pthread_mutex_lock(&_mutex);
+    if (_workers.empty() || _queue.size() >= _max_queue) {
+        ++_stats.rejected;
+        pthread_mutex_unlock(&_mutex);
+        return false;
+    }
+    _queue.push_back(request);
+    ++_stats.submitted;
+    if (_queue.size() + _busy > _stats.max_depth)
+        _stats.max_depth = _queue.size() + _busy;
+    pthread_cond_signal(&_work);
+    pthread_mutex_unlock(&_mutex);
+    return true;
+}
+
+void CredentialPool::collect(std::vector<Result>& out) {
+    char sink[64];
+    while (read(_pipe[0], sink, sizeof(sink)) > 0)
+        ;
+
+    pthread_mutex_lock(&_mutex);
+    out.insert(out.end(), _done.begin(), _done.end());
+    _done.clear();
+    pthread_mutex_unlock(&_mutex);
+}
+
+void CredentialPool::drain(std::vector<Result>& out) {
+    pthread_mutex_lock(&_mutex);
+    while (!_workers.empty() && (!_queue.empty() || _busy > 0))
+        pthread_cond_wait(&_idle, &_mutex);
+    pthread_mutex_unlock(&_mutex);
+    collect(out);
+}
+
+size_t CredentialPool::depth() const {
+    pthread_mutex_lock(&_mutex);
+    size_t depth = _queue.size() + _busy;
+    pthread_mutex_unlock(&_mutex);
+    return depth;
+}
+
+size_t CredentialPool::getWorkerCount() const {
+    return _worker_count;
+}
+
+size_t CredentialPool::getMaxQueue() const {
+    return _max_queue;
+}
+
+CredentialPool::Stats CredentialPool::getStats() const {
+    pthread_mutex_lock(&_mutex);
+    Stats stats = _stats;
+    pthread_mutex_unlock(&_mutex);
+    return stats;
+}
+
+bool CredentialPool::isHashed(const std::string& expected) {
+    return expected.size() > 1 && expected[0] == '$';
+}
+
+// crypt_r needs a large scratch area; it lives on the heap, one per call,
+// so workers share nothing
+bool CredentialPool::matches(const std::string& secret, const std::string& expected) {
+    if (!isHashed(expected))
+        return constantTimeEquals(secret, expected);
+
+    struct crypt_data* data = new struct crypt_data;
+    std::memset(data, 0, sizeof(*data));
+    const char* hashed = crypt_r(secret.c_str(), expected.c_str(), data);
+    bool ok = hashed && hashed[0] != '*' && constantTimeEquals(hashed, expected);
+    delete data;
+    return ok;
+}
+
+std::string CredentialPool::hash(const std::string& secret) {
+    char salt[CRYPT_GENSALT_OUTPUT_SIZE];
+    if (!crypt_gensalt_rn("$6$", 0, NULL, 0, salt, sizeof(salt)))
+        return "";
+
+    struct crypt_data* data = new struct crypt_data;
+    std::memset(data, 0, sizeof(*data));
+    const char* hashed = crypt_r(secret.c_str(), salt, data);
+    std::string result = hashed && hashed[0] != '*' ? hashed : "";
+    delete data;
+    return result;
+}
+
+void* CredentialPool::workerMain(void* arg) {
+    // Signals go to the loop thread, so they interrupt its poll
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    static_cast<CredentialPool*>(arg)->work();
+    return NULL;
+}
+
+void CredentialPool::work() {
+    pthread_mutex_lock(&_mutex);
+    while (true) {
+        while (!_stopping && _queue.empty())
+            pthread_cond_wait(&_work, &_mutex);
+        if (_stopping)
+            break;
+
+        Request request = _queue.front();
+        _queue.pop_front();
+        ++_busy;
+        pthread_mutex_unlock(&_mutex);
+
+        uint64_t started = TimerWheel::monotonicMs();
+        Result result;
+        result.client_id = request.client_id;
+        result.fd = request.fd;
+        result.kind = request.kind;
+        result.name = request.name;
+        if (request.kind == CREDENTIAL_REGISTER) {
+            result.hash = hash(request.secret);
+            result.ok = !result.hash.empty();
+        } else {
+            result.ok = matches(request.secret, request.expected);
+        }
+        uint64_t finished = TimerWheel::monotonicMs();
+
+        pthread_mutex_lock(&_mutex);
+        --_busy;
+        _done.push_back(result);
+        ++_stats.completed;
+        if (!result.ok)
+            ++_stats.mismatches;
+        _stats.wait_ms += started - request.queued_ms;
+        _stats.verify_ms += finished - started;
+        pthread_cond_broadcast(&_idle);
+
+        // A full pipe already has a wakeup pending
+        char wake = 1;
+        ssize_t written = write(_pipe[1], &wake, 1);
+        (void)written;
+    }
+    pthread_mutex_unlock(&_mutex);
+}
@@ -0,0 +1,227 @@
+#include "../../include/FanoutPool.hpp"
+#include "../../include/Client.hpp"
+#include "../../include/Logger.hpp"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+
+namespace {
+
+bool setPipeFlags(int fd) {
+    return fcntl(fd, F_SETFL, O_NONBLOCK) == 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+}  // namespace
+
+FanoutPool::FanoutPool()
+    : _thread_count(0), _threshold(FANOUT_THRESHOLD), _started(0), _busy(0), _stopping(false) {
+    _pipe[0] = -1;
+    _pipe[1] = -1;
+    std::memset(&_stats, 0, sizeof(_stats));
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_work, NULL);
+    pthread_cond_init(&_idle, NULL);
+}
+
+FanoutPool::~FanoutPool() {
+    stop();
+    for (int i = 0; i < 2; ++i) {
+        if (_pipe[i] != -1)
+            close(_pipe[i]);
+    }
+    pthread_cond_destroy(&_idle);
+    pthread_cond_destroy(&_work);
+    pthread_mutex_destroy(&_mutex);
+}
+
+// The pipe outlives restarts so its read end can stay in the poll set
+bool FanoutPool::start() {
+    if (_pipe[0] == -1) {
+        if (pipe(_pipe) < 0 || !setPipeFlags(_pipe[0]) || !setPipeFlags(_pipe[1])) {
+            Logger::error("Fan-out pool: pipe: " + std::string(strerror(errno)));
+            for (int i = 0; i < 2; ++i) {
+                if (_pipe[i] != -1)
+                    close(_pipe[i]);
+                _pipe[i] = -1;
+            }
+            return false;
+        }
+    }
+
+    _stopping = false;
+    _started = 0;
+    _queues.assign(_thread_count, std::deque<Job*>());
+    for (size_t i = 0; i < _thread_count; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, workerMain, this) != 0) {
+            Logger::error("Fan-out pool: could not start sender threads");
+            stop();
+            return false;
+        }
+        _threads.push_back(thread);
+    }
+
+    // Each worker takes the next queue index as it starts
+    pthread_mutex_lock(&_mutex);
+    while (_started < _threads.size())
+        pthread_cond_wait(&_idle, &_mutex);
+    pthread_mutex_unlock(&_mutex);
+    return true;
+}
+
+void FanoutPool::stop() {
+    pthread_mutex_lock(&_mutex);
+    _stopping = true;
+    pthread_cond_broadcast(&_work);
+    pthread_mutex_unlock(&_mutex);
+
+    for (size_t i = 0; i < _threads.size(); ++i)
+        pthread_join(_threads[i], NULL);
+    _threads.clear();
+    _queues.clear();
+    collect();
+}
+
+void FanoutPool::setThreadCount(size_t threads) {
+    _thread_count = threads;
+}
+
+size_t FanoutPool::getThreadCount() const {
+    return _thread_count;
+}
+
+void FanoutPool::setThreshold(size_t members) {
+    _threshold = members;
+}
+
+size_t FanoutPool::getThreshold() const {
+    return _threshold;
+}
+
+bool FanoutPool::accepts(size_t members) const {
+    return !_threads.empty() && members >= _threshold;
+}
+
+const FanoutPool::Stats& FanoutPool::getStats() const {
+    return _stats;
+}
+
+int FanoutPool::getNotifyFd() const {
+    return _pipe[0];
+}
+
+void FanoutPool::deliver(const SharedLine& line, const std::vector<Client*>& targets) {
+    size_t shards = _threads.size() + 1;
+    std::vector<Job*> jobs(_threads.size(), static_cast<Job*>(NULL));
+    for (size_t i = 0; i < targets.size(); ++i) {
+        Client* client = targets[i];
+        size_t shard = client->getFd() % shards;
+        if (shard == 0) {
+            client->sendRaw(line.str());
+            continue;
+        }
+        if (client->isFanoutPending() || client->getSendQueueSize() > 0 || client->isSendQueueExceeded()) {
+            client->sendRaw(line.str());  // Queues behind what is there
+            ++_stats.queued;
+            continue;
+        }
+        Job*& job = jobs[shard - 1];
+        if (!job) {
+            job = new Job();
+            job->line = line;
+        }
+        job->targets.push_back(client);
+        client->setFanoutPending(true);
+    }
+
+    pthread_mutex_lock(&_mutex);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (jobs[i]) {
+            _queues[i].push_back(jobs[i]);
+            ++_busy;
+        }
+    }
+    pthread_cond_broadcast(&_work);
+    pthread_mutex_unlock(&_mutex);
+
+    ++_stats.fanouts;
+    _stats.recipients += targets.size();
+}
+
+void FanoutPool::collect() {
+    char sink[64];
+    if (_pipe[0] != -1) {
+        while (read(_pipe[0], sink, sizeof(sink)) > 0)
+            ;
+    }
+
+    std::vector<Job*> finished;
+    pthread_mutex_lock(&_mutex);
+    finished.swap(_finished);
+    pthread_mutex_unlock(&_mutex);
+
+    for (size_t i = 0; i < finished.size(); ++i) {
+        Job* job = finished[i];
+        for (size_t j = 0; j < job->targets.size(); ++j) {
+            if (job->sent[j] < job->line.size())
+                ++_stats.queued;
+            job->targets[j]->finishFanout(job->line.str(), job->sent[j]);
+        }
+        delete job;
+    }
+}
+
+void FanoutPool::drain() {
+    pthread_mutex_lock(&_mutex);
+    while (_busy > 0)
+        pthread_cond_wait(&_idle, &_mutex);
+    pthread_mutex_unlock(&_mutex);
+    collect();
+}
+
+void* FanoutPool::workerMain(void* arg) {
+    // Signals go to the loop thread, so they interrupt its poll
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    static_cast<FanoutPool*>(arg)->work();
+    return NULL;
+}
+
+// Only the job's sockets are written; the clients' other state stays with
+// the loop thread until collect()
+void FanoutPool::work() {
+    pthread_mutex_lock(&_mutex);
+    std::deque<Job*>& queue = _queues[_started++];
+    pthread_cond_broadcast(&_idle);
+    while (true) {
+        while (!_stopping && queue.empty())
+            pthread_cond_wait(&_work, &_mutex);
+        if (queue.empty())
+            break;
+        Job* job = queue.front();
+        queue.pop_front();
+        pthread_mutex_unlock(&_mutex);
+
+        const std::string& line = job->line.str();
+        job->sent.resize(job->targets.size());
+        for (size_t i = 0; i < job->targets.size(); ++i)
+            job->sent[i] = job->targets[i]->writeDirect(line);
+
+        pthread_mutex_lock(&_mutex);
+        bool wake = _finished.empty();
+        _finished.push_back(job);
+        --_busy;
+        pthread_cond_broadcast(&_idle);
+
+        // A wakeup is already pending unless this is the first result
+        if (wake) {
+            char byte = 1;
+            ssize_t written = write(_pipe[1], &byte, 1);
+            (void)written;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+}
@@ -0,0 +1,895 @@
+#include "../../include/LinkManager.hpp"
+#include "../../include/Server.hpp"
+#include "../../include/Client.hpp"
+#include "../../include/Channel.hpp"
+#include "../../include/Logger.hpp"
+#include "../../include/TextFilter.hpp"
+#include <sstream>
+
+std::string numberToString(size_t number);
+
+namespace {
+
+const size_t NJOIN_LINE_LIMIT = 400;
+
+}
+
+LinkManager::LinkManager(Server& server)
+    : _server(server), _listen_fd(-1), _listen_port(0) {
+}
+
+LinkManager::~LinkManager() {
+    clear();
+    for (std::vector<Target*>::iterator it = _targets.begin(); it != _targets.end(); ++it)
+        delete *it;
+}
+
+void LinkManager::clear() {
+    for (std::map<std::string, Client*>::iterator it = _remote.begin(); it != _remote.end(); ++it)
+        delete it->second;
+    _remote.clear();
+    _servers.clear();
+    _connecting.clear();
+    _outgoing.clear();
+    _silenced.clear();
+    for (std::vector<Target*>::iterator it = _targets.begin(); it != _targets.end(); ++it) {
+        _server.getTimers().cancel(&(*it)->retry);
+        (*it)->link = NULL;
+    }
+    if (_listen_fd != -1) {
+        close(_listen_fd);
+        _listen_fd = -1;
+    }
+}
+
+// Configuration
+
+bool LinkManager::listen(int port, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        Logger::error("Failed to create link socket: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    int opt = 1;
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0
+        || fcntl(fd, F_SETFL, O_NONBLOCK) < 0
+        || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+        || ::listen(fd, backlog) < 0) {
+        Logger::error("Failed to listen for server links: " + std::string(strerror(errno)));
+        close(fd);
+        return false;
+    }
+    return adoptListener(fd, port);
+}
+
+bool LinkManager::adoptListener(int fd, int port) {
+    _listen_fd = fd;
+    _listen_port = port;
+    Logger::info("Accepting server links on port " + numberToString(port));
+    return true;
+}
+
+void LinkManager::closeListener() {
+    if (_listen_fd != -1) {
+        close(_listen_fd);
+        Logger::info("No longer accepting server links");
+    }
+    _listen_fd = -1;
+    _listen_port = 0;
+}
+
+void LinkManager::addTarget(const std::string& host, int port) {
+    Target* target = new Target();
+    target->host = host;
+    target->port = port;
+    target->link = NULL;
+    target->retry.kind = TIMER_LINK_RETRY;
+    target->retry.owner = target;
+    _targets.push_back(target);
+}
+
+void LinkManager::connectAll() {
+    for (std::vector<Target*>::iterator it = _targets.begin(); it != _targets.end(); ++it) {
+        if (!(*it)->link)
+            connectTarget(*it);
+    }
+}
+
+int LinkManager::getListenFd() const {
+    return _listen_fd;
+}
+
+int LinkManager::getListenPort() const {
+    return _listen_port;
+}
+
+const std::vector<LinkManager::Target*>& LinkManager::getTargets() const {
+    return _targets;
+}
+
+void LinkManager::setPassword(const std::string& password) {
+    _password = password;
+}
+
+void LinkManager::setAcceptPassword(const std::string& expected) {
+    _accept_password = expected;
+}
+
+const std::string& LinkManager::getPassword() const {
+    return _password;
+}
+
+const std::string& LinkManager::getAcceptPassword() const {
+    return _accept_password.empty() ? _password : _accept_password;
+}
+
+void LinkManager::connectTarget(Target* target) {
+    struct sockaddr_storage addr;
+    std::memset(&addr, 0, sizeof(addr));
+    struct sockaddr_in* in4 = reinterpret_cast<struct sockaddr_in*>(&addr);
+    in4->sin_family = AF_INET;
+    in4->sin_port = htons(target->port);
+    if (inet_pton(AF_INET, target->host.c_str(), &in4->sin_addr) != 1) {
+        Logger::error("Invalid link address: " + target->host);
+        return;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+        if (fd >= 0)
+            close(fd);
+        scheduleRetry(target);
+        return;
+    }
+    if (connect(fd, (struct sockaddr*)in4, sizeof(*in4)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        scheduleRetry(target);
+        return;
+    }
+
+    Client* link = _server.addConnection(fd, addr, target->host, true);
+    target->link = link;
+    _connecting.insert(link);
+    _outgoing.insert(link);
+    _server.setPollEvents(fd, POLLOUT);
+}
+
+void LinkManager::scheduleRetry(Target* target) {
+    _server.getTimers().arm(&target->retry, LINK_RETRY_INTERVAL);
+}
+
+void LinkManager::handleRetry(Target* target) {
+    if (!target->link)
+        connectTarget(target);
+}
+
+// Link connections
+
+bool LinkManager::isConnecting(Client* link) const {
+    return _connecting.count(link) != 0;
+}
+
+void LinkManager::finishConnect(Client* link) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    _connecting.erase(link);
+    if (getsockopt(link->getFd(), SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+        Logger::debug("Link to " + link->getHostname() + " failed: " + std::string(strerror(error)));
+        _server.disconnectClient(link, "Connection failed");
+        return;
+    }
+    if (_password.empty()) {
+        Logger::error("No link password set, not linking to " + link->getHostname());
+        _server.disconnectClient(link, "No link password configured");
+        return;
+    }
+    _server.setPollEvents(link->getFd(), POLLIN);
+    sendHandshake(link);
+}
+
+void LinkManager::sendLine(Client* link, const std::string& line) {
+    link->sendRaw(line + "\r\n");
+}
+
+void LinkManager::sendHandshake(Client* link) {
+    sendLine(link, "PASS " + _password);
+    sendLine(link, "SERVER " + _server.getHostname() + " 1 :" + SERVER_NAME " " SERVER_VERSION);
+}
+
+// Plain values are compared here; hashes go to the credential pool and the
+// link's input waits until finishCredential runs
+void LinkManager::verifyPassword(Client* link, const std::string& secret) {
+    const std::string& expected = getAcceptPassword();
+    if (expected.empty()) {
+        link->setAuthenticated(false);
+        return;
+    }
+    if (!CredentialPool::isHashed(expected)) {
+        link->setAuthenticated(CredentialPool::matches(secret, expected));
+        return;
+    }
+
+    CredentialPool::Request request;
+    request.client_id = link->getId();
+    request.fd = link->getFd();
+    request.kind = CREDENTIAL_LINK;
+    request.secret = secret;
+    request.expected = expected;
+    if (!_server.getCredentials().submit(request)) {
+        dropLink(link, "Server load is temporarily too heavy");
+        return;
+    }
+    link->setAuthPending(true);
+}
+
+void LinkManager::finishCredential(Client* link, const CredentialPool::Result& result) {
+    link->setAuthenticated(result.ok);
+}
+
+void LinkManager::dropLink(Client* link, const std::string& reason) {
+    _server.disconnectClient(link, reason);
+}
+
+LinkManager::Message LinkManager::parse(const std::string& line) {
+    Message msg;
+    std::string::size_type pos = 0;
+
+    if (!line.empty() && line[0] == ':') {
+        pos = line.find(' ');
+        msg.prefix = line.substr(1, pos == std::string::npos ? std::string::npos : pos - 1);
+        if (pos == std::string::npos)
+            return msg;
+        ++pos;
+    }
+
+    while (pos < line.size()) {
+        if (line[pos] == ' ') {
+            ++pos;
+            continue;
+        }
+        if (line[pos] == ':' && !msg.command.empty()) {
+            msg.params.push_back(line.substr(pos + 1));
+            break;
+        }
+        std::string::size_type end = line.find(' ', pos);
+        std::string token = line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        if (msg.command.empty())
+            msg.command = token;
+        else
+            msg.params.push_back(token);
+        pos = end == std::string::npos ? line.size() : end;
+    }
+    return msg;
+}
+
+std::string LinkManager::prefixNick(const std::string& prefix) {
+    return prefix.substr(0, prefix.find('!'));
+}
+
+std::string LinkManager::userPrefix(Client* client) {
+    return client->getNickname() + "!" + client->getUsername() + "@" + client->getHostname();
+}
+
+void LinkManager::handleLine(Client* link, const std::string& line) {
+    Message msg = parse(line);
+    if (msg.command.empty())
+        return;
+
+    if (!link->isRegistered()) {
+        if (msg.command == "PASS") {
+            if (!msg.params.empty())
+                verifyPassword(link, msg.params[0]);
+        } else if (msg.command == "SERVER") {
+            completeHandshake(link, msg);
+        } else if (msg.command == "ERROR") {
+            Logger::error("Link " + link->getHostname() + " refused: " + (msg.params.empty() ? "" : msg.params[0]));
+        } else {
+            dropLink(link, "Server handshake expected");
+        }
+        return;
+    }
+
+    Client* user = NULL;
+    if (!msg.prefix.empty())
+        user = getRemoteClient(prefixNick(msg.prefix));
+    if (user && user->getUplink() != link)
+        return;  // Wrong direction: ignore rather than corrupt the tree
+
+    const std::string& cmd = msg.command;
+    if (cmd == "PING") {
+        sendLine(link, ":" + _server.getHostname() + " PONG " + _server.getHostname() + " :"
+                 + (msg.params.empty() ? "" : msg.params.back()));
+    } else if (cmd == "PONG") {
+        if (!msg.params.empty())
+            link->handlePong(msg.params.back(), TimerWheel::monotonicMs());
+    } else if (cmd == "ERROR") {
+        Logger::error("Link " + link->getServerName() + ": " + (msg.params.empty() ? "" : msg.params[0]));
+    } else if (cmd == "SERVER") {
+        handleServer(link, msg);
+    } else if (cmd == "NICK" && msg.params.size() >= 7) {
+        handleNickIntro(link, msg, line);
+    } else if (cmd == "NJOIN") {
+        handleNjoin(link, msg, line);
+    } else if (cmd == "MODE") {
+        handleMode(link, msg, line);
+    } else if (cmd == "TOPIC") {
+        handleTopic(link, msg, line);
+    } else if (cmd == "KICK") {
+        handleKick(link, msg, line);
+    } else if (cmd == "KILL") {
+        handleKill(link, msg);
+    } else if (cmd == "SQUIT") {
+        handleSquit(link, msg);
+    } else if (!user) {
+        Logger::debug("Dropping " + cmd + " from unknown source " + msg.prefix);
+    } else if (cmd == "NICK") {
+        handleNickChange(link, user, msg, line);
+    } else if (cmd == "JOIN") {
+        handleJoin(link, user, msg, line);
+    } else if (cmd == "PART") {
+        handlePart(link, user, msg, line);
+    } else if (cmd == "PRIVMSG" || cmd == "NOTICE") {
+        handleMessage(link, user, msg, line);
+    } else if (cmd == "INVITE") {
+        handleInvite(link, msg, line);
+    } else if (cmd == "QUIT") {
+        removeRemote(user, msg.params.empty() ? "Quit" : msg.params[0]);
+        propagate(line + "\r\n", link);
+    }
+}
+
+void LinkManager::completeHandshake(Client* link, const Message& msg) {
+    if (!link->isAuthenticated()) {
+        dropLink(link, "Bad link password");
+        return;
+    }
+    if (_password.empty() && !_outgoing.count(link)) {
+        Logger::error("No link password set, refusing link from " + link->getHostname());
+        dropLink(link, "No link password configured");
+        return;
+    }
+    if (msg.params.empty()) {
+        dropLink(link, "Malformed SERVER");
+        return;
+    }
+
+    const std::string& name = msg.params[0];
+    if (name == _server.getHostname() || _servers.count(name)) {
+        dropLink(link, "Server " + name + " already exists");
+        return;
+    }
+
+    RemoteServer entry;
+    entry.via = link;
+    entry.parent = _server.getHostname();
+    entry.hops = 1;
+    entry.description = msg.params.size() > 2 ? msg.params[2] : "";
+    _servers[name] = entry;
+
+    link->setServerName(name);
+    link->setRegistered(true);
+    if (!_outgoing.count(link))
+        sendHandshake(link);
+    sendBurst(link);
+    propagate(":" + _server.getHostname() + " SERVER " + name + " 2 :" + entry.description + "\r\n", link);
+    _server.onClientRegistered(link);
+    Logger::info("Linked with server " + name);
+}
+
+void LinkManager::sendBurst(Client* link) {
+    const std::string& me = _server.getHostname();
+
+    for (std::map<std::string, RemoteServer>::const_iterator it = _servers.begin(); it != _servers.end(); ++it) {
+        if (it->second.via != link)
+            sendLine(link, ":" + it->second.parent + " SERVER " + it->first + " "
+                     + numberToString(it->second.hops + 1) + " :" + it->second.description);
+    }
+
+    const std::map<int, Client*>& locals = _server.getClients();
+    for (std::map<int, Client*>::const_iterator it = locals.begin(); it != locals.end(); ++it) {
+        Client* client = it->second;
+        if (client->isServerLink() || !client->isRegistered() || client->isClosing())
+            continue;
+        sendLine(link, "NICK " + client->getNickname() + " 1 " + numberToString(client->getSignon()) + " "
+                 + client->getUsername() + " " + client->getHostname() + " " + me + " :" + client->getRealname());
+    }
+    for (std::map<std::string, Client*>::const_iterator it = _remote.begin(); it != _remote.end(); ++it) {
+        Client* client = it->second;
+        if (client->getUplink() == link)
+            continue;
+        sendLine(link, "NICK " + client->getNickname() + " 2 " + numberToString(client->getSignon()) + " "
+                 + client->getUsername() + " " + client->getHostname() + " " + client->getServerName()
+                 + " :" + client->getRealname());
+    }
+
+    for (Channel* channel = _server.getChannels().first(); channel; channel = ChannelRegistry::next(channel)) {
+        const std::vector<Client*>& members = channel->getClients();
+        std::string names;
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (members[i]->getUplink() == link)
+                continue;
+            if (!names.empty())
+                names += ",";
+            if (channel->isOperator(members[i]))
+                names += "@";
+            else if (channel->isVoiced(members[i]))
+                names += "+";
+            names += members[i]->getNickname();
+            if (names.size() >= NJOIN_LINE_LIMIT) {
+                sendLine(link, ":" + me + " NJOIN " + channel->getName() + " :" + names);
+                names.clear();
+            }
+        }
+        if (!names.empty())
+            sendLine(link, ":" + me + " NJOIN " + channel->getName() + " :" + names);
+
+        std::string modes = "+";
+        std::string args;
+        if (channel->isInviteOnly())
+            modes += "i";
+        if (channel->isTopicRestricted())
+            modes += "t";
+        if (channel->getTextPolicy() & TEXT_UTF8ONLY)
+            modes += "U";
+        if (channel->getTextPolicy() & TEXT_SCRUB)
+            modes += "S";
+        if (channel->hasKey()) {
+            modes += "k";
+            args += " " + channel->getKey();
+        }
+        if (channel->getUserLimit() > 0) {
+            modes += "l";
+            args += " " + numberToString(channel->getUserLimit());
+        }
+        if (modes.size() > 1)
+            sendLine(link, ":" + me + " MODE " + channel->getName() + " " + modes + args);
+
+        const std::vector<std::string>& bans = channel->getBanList();
+        for (size_t i = 0; i < bans.size(); ++i)
+            sendLine(link, ":" + me + " MODE " + channel->getName() + " +b " + bans[i]);
+
+        if (!channel->getTopic().empty())
+            sendLine(link, ":" + me + " TOPIC " + channel->getName() + " :" + channel->getTopic());
+    }
+}
+
+void LinkManager::linkClosed(Client* link, const std::string& reason) {
+    _connecting.erase(link);
+    _outgoing.erase(link);
+    for (std::vector<Target*>::iterator it = _targets.begin(); it != _targets.end(); ++it) {
+        if ((*it)->link == link) {
+            (*it)->link = NULL;
+            scheduleRetry(*it);
+        }
+    }
+
+    if (!link->isRegistered())
+        return;
+
+    const std::string& peer = link->getServerName();
+    std::string split = _server.getHostname() + " " + peer;
+    Logger::info("Lost link to " + peer + ": " + reason);
+
+    std::vector<std::string> lost;
+    for (std::map<std::string, RemoteServer>::iterator it = _servers.begin(); it != _servers.end(); ++it) {
+        if (it->second.via == link)
+            lost.push_back(it->first);
+    }
+    for (size_t i = 0; i < lost.size(); ++i)
+        _servers.erase(lost[i]);
+
+    std::vector<Client*> users;
+    for (std::map<std::string, Client*>::iterator it = _remote.begin(); it != _remote.end(); ++it) {
+        if (it->second->getUplink() == link)
+            users.push_back(it->second);
+    }
+    for (size_t i = 0; i < users.size(); ++i)
+        removeRemote(users[i], split);
+
+    propagate("SQUIT " + peer + " :" + reason + "\r\n", link);
+}
+
+// Local events
+
+void LinkManager::introduce(Client* client) {
+    if (client->getSignon() == 0)
+        client->setSignon(time(NULL));
+    propagate("NICK " + client->getNickname() + " 1 " + numberToString(client->getSignon()) + " "
+              + client->getUsername() + " " + client->getHostname() + " " + _server.getHostname()
+              + " :" + client->getRealname() + "\r\n");
+}
+
+void LinkManager::propagate(const std::string& line, Client* except) {
+    if (line.empty())
+        return;
+    for (std::map<std::string, RemoteServer>::iterator it = _servers.begin(); it != _servers.end(); ++it) {
+        // Only directly connected peers are their own route
+        if (it->second.hops == 1 && it->second.via != except)
+            it->second.via->sendRaw(line);
+    }
+}
+
+// Called for every local user that goes, so a KILL's mark is always cleared
+void LinkManager::clientQuit(Client* client, const std::string& reason) {
+    if (_silenced.erase(client->getId()) || !client->isRegistered() || client->getNickname().empty())
+        return;
+    propagate(":" + client->getNickname() + " QUIT :" + reason + "\r\n");
+}
+
+Client* LinkManager::getRemoteClient(const std::string& nickname) const {
+    std::map<std::string, Client*>::const_iterator it = _remote.find(nickname);
+    return it != _remote.end() ? it->second : NULL;
+}
+
+// Peer messages
+
+void LinkManager::handleServer(Client* link, const Message& msg) {
+    if (msg.params.empty())
+        return;
+    const std::string& name = msg.params[0];
+    if (name == _server.getHostname() || _servers.count(name)) {
+        dropLink(link, "Loop detected: " + name + " already linked");
+        return;
+    }
+
+    RemoteServer entry;
+    entry.via = link;
+    entry.parent = msg.prefix.empty() ? link->getServerName() : msg.prefix;
+    entry.hops = msg.params.size() > 1 ? std::atoi(msg.params[1].c_str()) : 2;
+    entry.description = msg.params.size() > 2 ? msg.params[2] : "";
+    _servers[name] = entry;
+
+    propagate(":" + entry.parent + " SERVER " + name + " " + numberToString(entry.hops + 1)
+              + " :" + entry.description + "\r\n", link);
+}
+
+void LinkManager::handleNickIntro(Client* link, const Message& msg, const std::string& line) {
+    const std::string& nick = msg.params[0];
+    time_t ts = static_cast<time_t>(std::atol(msg.params[2].c_str()));
+
+    Client* existing = _server.getClientByNickname(nick);
+    if (existing) {
+        // The older nick wins; on a tie both users lose it
+        if (existing->getSignon() <= ts) {
+            sendLine(link, "KILL " + nick + " :Nick collision");
+            if (existing->getSignon() == ts)
+                killClient(existing, "Nick collision", link);
+            return;
+        }
+        killClient(existing, "Nick collision", link);
+    }
+
+    Client* user = new Client(-1);
+    user->setUplink(link);
+    user->setNickname(nick);
+    user->setSignon(ts);
+    user->setUsername(msg.params[3]);
+    user->setHostname(msg.params[4]);
+    user->setServerName(msg.params[5]);
+    user->setRealname(msg.params[6]);
+    user->setAuthenticated(true);
+    user->setRegistered(true);
+    _remote[nick] = user;
+    _server.indexUser(user);
+
+    propagate(line + "\r\n", link);
+}
+
+void LinkManager::handleNickChange(Client* link, Client* user, const Message& msg, const std::string& line) {
+    if (msg.params.empty())
+        return;
+    const std::string& nick = msg.params[0];
+
+    Client* existing = _server.getClientByNickname(nick);
+    if (existing && existing != user) {
+        // Both sides claimed the nick at once: nobody keeps it
+        killClient(existing, "Nick collision", NULL);
+        removeRemote(user, "Nick collision");
+        return;
+    }
+
+    std::string notice = line + "\r\n";
+    _server.sendToPeers(user, SharedLine(notice), false);
+    const std::vector<Channel*>& channels = user->getChannels();
+
+    std::string old_nick = user->getNickname();
+    _remote.erase(old_nick);
+    user->setNickname(nick);
+    _remote[nick] = user;
+    _server.renameUser(user, old_nick);
+    for (size_t i = 0; i < channels.size(); ++i)
+        channels[i]->refreshName(user);
+    propagate(notice, link);
+}
+
+void LinkManager::handleJoin(Client* link, Client* user, const Message& msg, const std::string& line) {
+    if (msg.params.empty())
+        return;
+
+    Channel* channel = _server.getChannel(msg.params[0]);
+    if (!channel)
+        channel = _server.createChannel(msg.params[0]);
+    if (!channel->hasClient(user)) {
+        channel->broadcastLocal(line + "\r\n");
+        channel->addClient(user);
+        user->joinChannel(channel);
+    }
+    propagate(line + "\r\n", link);
+}
+
+void LinkManager::handleNjoin(Client* link, const Message& msg, const std::string& line) {
+    if (msg.params.size() < 2)
+        return;
+
+    Channel* channel = _server.getChannel(msg.params[0]);
+    if (!channel)
+        channel = _server.createChannel(msg.params[0]);
+
+    std::istringstream names(msg.params[1]);
+    std::string entry;
+    while (std::getline(names, entry, ',')) {
+        bool op = !entry.empty() && entry[0] == '@';
+        bool voice = !entry.empty() && entry[0] == '+';
+        Client* user = getRemoteClient((op || voice) ? entry.substr(1) : entry);
+        if (!user || user->getUplink() != link)
+            continue;
+        if (!channel->hasClient(user)) {
+            channel->broadcastLocal(":" + userPrefix(user) + " JOIN " + channel->getName() + "\r\n");
+            channel->addClient(user);
+            user->joinChannel(channel);
+        }
+        if (op)
+            channel->addOperator(user);
+        if (voice)
+            channel->addVoice(user);
+    }
+    propagate(line + "\r\n", link);
+}
+
+void LinkManager::handlePart(Client* link, Client* user, const Message& msg, const std::string& line) {
+    if (msg.params.empty())
+        return;
+
+    Channel* channel = _server.getChannel(msg.params[0]);
+    if (channel && channel->hasClient(user)) {
+        channel->broadcastLocal(line + "\r\n");
+        channel->removeClient(user);
+        user->leaveChannel(channel);
+        if (channel->getClients().empty())
+            _server.removeChannel(channel->getName());
+    }
+    propagate(line + "\r\n", link);
+}
+
+void LinkManager::handleMessage(Client* link, Client* user, const Message& msg, const std::string& line) {
+    if (msg.params.size() < 2)
+        return;
+
+    const std::string& target = msg.params[0];
+    std::string out = line + "\r\n";
+    if (target[0] == '#' || target[0] == '&') {
+        Channel* channel = _server.getChannel(target);
+        if (channel) {
+            SharedLine shared(out);
+            channel->broadcast(shared.str(), user, link);
+            channel->addHistory(shared);
+        }
+        return;
+    }
+
+    Client* recipient = _server.getClientByNickname(target);
+    if (!recipient)
+        return;
+    if (!recipient->isRemote())
+        recipient->sendRaw(out);
+    else if (recipient->getUplink() != link)
+        recipient->sendRaw(out);
+}
+
+void LinkManager::handleMode(Client* link, const Message& msg, const std::string& line) {
+    if (msg.params.size() < 2)
+        return;
+    const std::string& target = msg.params[0];
+    if (target[0] != '#' && target[0] != '&') {
+        propagate(line + "\r\n", link);
+        return;
+    }
+
+    Channel* channel = _server.getChannel(target);
+    if (!channel)
+        channel = _server.createChannel(target);
+
+    const std::string& modes = msg.params[1];
+    size_t arg = 2;
+    bool adding = true;
+    for (size_t i = 0; i < modes.size(); ++i) {
+        char mode = modes[i];
+        if (mode == '+' || mode == '-') {
+            adding = mode == '+';
+            continue;
+        }
+        switch (mode) {
+            case 'i':
+                channel->setInviteOnly(adding);
+                break;
+            case 't':
+                channel->setTopicRestricted(adding);
+                break;
+            case 'U':
+            case 'S': {
+                int bit = mode == 'U' ? TEXT_UTF8ONLY : TEXT_SCRUB;
+                int policy = channel->getTextPolicy();
+                channel->setTextPolicy(adding ? (policy | bit) : (policy & ~bit));
+                break;
+            }
+            case 'k':
+                if (!adding)
+                    channel->setKey("");
+                else if (arg < msg.params.size())
+                    channel->setKey(msg.params[arg++]);
+                break;
+            case 'l':
+                if (!adding)
+                    channel->setUserLimit(0);
+                else if (arg < msg.params.size())
+                    channel->setUserLimit(std::atoi(msg.params[arg++].c_str()));
+                break;
+            case 'b':
+                if (arg < msg.params.size()) {
+                    if (adding)
+                        channel->addBan(msg.params[arg++]);
+                    else
+                        channel->removeBan(msg.params[arg++]);
+                }
+                break;
+            case 'o':
+            case 'v': {
+                if (arg >= msg.params.size())
+                    break;
+                Client* member = _server.getClientByNickname(msg.params[arg++]);
+                if (!member || !channel->hasClient(member))
+                    break;
+                if (mode == 'o' && adding)
+                    channel->addOperator(member);
+                else if (mode == 'o')
+                    channel->removeOperator(member);
+                else if (adding)
+                    channel->addVoice(member);
+                else
+                    channel->removeVoice(member);
+                break;
+            }
+        }
+    }
+
+    // Burst modes come from a server prefix and only restate known state
+    if (msg.prefix.find('!') != std::string::npos || getRemoteClient(msg.prefix))
+        channel->broadcastLocal(line + "\r\n");
+    propagate(line + "\r\n", link);
+}
+
+void LinkManager::handleTopic(Client* link, const Message& msg, const std::string& line) {
+    if (msg.params.empty())
+        return;
+
+    Channel* channel = _server.getChannel(msg.params[0]);
+    if (!channel)
+        channel = _server.createChannel(msg.params[0]);
+
+    std::string topic = msg.params.size() > 1 ? msg.params[1] : "";
+    if (topic != channel->getTopic()) {
+        channel->applyTopic(topic, prefixNick(msg.prefix));
+        channel->broadcastLocal(line + "\r\n");
+    }
+    propagate(line + "\r\n", link);
+}
+
+void LinkManager::handleKick(Client* link, const Message& msg, const std::string& line) {
+    if (msg.params.size() < 2)
+        return;
+
+    Channel* channel = _server.getChannel(msg.params[0]);
+    Client* target = _server.getClientByNickname(msg.params[1]);
+    if (channel && target && channel->hasClient(target)) {
+        channel->broadcastLocal(line + "\r\n");
+        channel->removeClient(target);
+        target->leaveChannel(channel);
+        if (channel->getClients().empty())
+            _server.removeChannel(channel->getName());
+    }
+    propagate(line + "\r\n", link);
+}
+
+void LinkManager::handleInvite(Client* link, const Message& msg, const std::string& line) {
+    if (msg.params.size() < 2)
+        return;
+
+    Client* target = _server.getClientByNickname(msg.params[0]);
+    if (!target)
+        return;
+    Channel* channel = _server.getChannel(msg.params[1]);
+    if (channel)
+        channel->addInvite(target);
+
+    std::string out = line + "\r\n";
+    if (!target->isRemote())
+        target->sendRaw(out);
+    else if (target->getUplink() != link)
+        target->sendRaw(out);
+}
+
+void LinkManager::handleKill(Client* link, const Message& msg) {
+    if (msg.params.empty())
+        return;
+
+    Client* victim = _server.getClientByNickname(msg.params[0]);
+    if (victim)
+        killClient(victim, msg.params.size() > 1 ? msg.params[1] : "Killed", link);
+}
+
+void LinkManager::handleSquit(Client* link, const Message& msg) {
+    if (msg.params.empty() || !_servers.count(msg.params[0]))
+        return;
+
+    const std::string& name = msg.params[0];
+    std::string reason = msg.params.size() > 1 ? msg.params[1] : "Split";
+    removeServer(name, reason);
+    propagate("SQUIT " + name + " :" + reason + "\r\n", link);
+}
+
+// State changes
+
+void LinkManager::killClient(Client* victim, const std::string& reason, Client* except) {
+    propagate("KILL " + victim->getNickname() + " :" + reason + "\r\n", except);
+    if (victim->isRemote()) {
+        removeRemote(victim, "Killed (" + reason + ")");
+        return;
+    }
+
+    // The KILL already told the network; don't follow it with a QUIT
+    // when the client is torn down
+    _silenced.insert(victim->getId());
+    _server.disconnectClient(victim, reason);
+}
+
+void LinkManager::removeRemote(Client* user, const std::string& reason) {
+    _server.sendToPeers(user, SharedLine(":" + userPrefix(user) + " QUIT :" + reason + "\r\n"), false);
+    _server.leaveAllChannels(user);
+    _server.dropInvites(user);
+    _server.unindexUser(user);
+    _remote.erase(user->getNickname());
+    delete user;
+}
+
+void LinkManager::removeServer(const std::string& name, const std::string& reason) {
+    // Collect the split server and everything it introduced
+    std::set<std::string> lost;
+    lost.insert(name);
+    bool grew = true;
+    while (grew) {
+        grew = false;
+        for (std::map<std::string, RemoteServer>::iterator it = _servers.begin(); it != _servers.end(); ++it) {
+            if (!lost.count(it->first) && lost.count(it->second.parent)) {
+                lost.insert(it->first);
+                grew = true;
+            }
+        }
+    }
+
+    std::vector<Client*> users;
+    for (std::map<std::string, Client*>::iterator it = _remote.begin(); it != _remote.end(); ++it) {
+        if (lost.count(it->second->getServerName()))
+            users.push_back(it->second);
+    }
+    for (size_t i = 0; i < users.size(); ++i)
+        removeRemote(users[i], reason);
+    for (std::set<std::string>::iterator it = lost.begin(); it != lost.end(); ++it)
+        _servers.erase(*it);
+}
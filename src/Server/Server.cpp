@@ -3,11 +3,18 @@
 #include "../../include/Channel.hpp"
 #include "../../include/Logger.hpp"
 #include "../../include/CommandHandler.hpp"
+#include "../../include/CaseMapping.hpp"
+#include "../../include/ListQuery.hpp"
+#include "../../include/TextFilter.hpp"
 #include <sstream>
+#include <algorithm>
+#include <sys/uio.h>
 
 // Define static members
-const std::string Server::_hostname = "ft_irc";
 Server* Server::_instance = NULL;
+volatile sig_atomic_t Server::_upgrade_requested = 0;
+volatile sig_atomic_t Server::_reload_requested = 0;
+volatile sig_atomic_t Server::_shutdown_requested = 0;
 
 // Helper function for number to string conversion
 std::string numberToString(size_t number) {
@@ -17,7 +24,17 @@ std::string numberToString(size_t number) {
 }
 
 Server::Server(int port, const std::string& password)
-    : _socket_fd(-1), _port(port), _password(password), _command_handler(NULL) {
+    : _socket_fd(-1), _password(password), _command_handler(NULL),
+      _store(CHANNEL_STORE_PATH), _links(*this),
+      _history(HISTORY_MAX_BYTES), _hostname(SERVER_NAME), _peer_epoch(0),
+      _text_policy(0), _credentials(CREDENTIAL_WORKERS, CREDENTIAL_QUEUE_MAX),
+      _accounts(ACCOUNT_STORE_PATH) {
+    _throttle_gc_timer.kind = TIMER_THROTTLE_GC;
+    _throttle_gc_timer.owner = this;
+    _store_timer.kind = TIMER_STORE_MAINTENANCE;
+    _store_timer.owner = this;
+    std::memset(&_read_stats, 0, sizeof(_read_stats));
+    _config.port = port;
 }
 
 Server::~Server() {
@@ -25,24 +42,31 @@ Server::~Server() {
 }
 
 bool Server::setupSocket() {
-    _socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (_socket_fd < 0) {
+    _socket_fd = openListener(_config.port, _config.listen_backlog);
+    return _socket_fd != -1;
+}
+
+// Non-blocking socket listening on every IPv4 address; -1 on failure
+int Server::openListener(int port, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
         Logger::error("Failed to create socket: " + std::string(strerror(errno)));
-        return false;
+        return -1;
     }
 
     // Set socket options
     int opt = 1;
-    if (setsockopt(_socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
         Logger::error("Failed to set socket options: " + std::string(strerror(errno)));
-        close(_socket_fd);
-        return false;
+        close(fd);
+        return -1;
     }
 
     // Set non-blocking
-    if (fcntl(_socket_fd, F_SETFL, O_NONBLOCK) < 0) {
+    if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
         Logger::error("Failed to set socket to non-blocking mode: " + std::string(strerror(errno)));
-        throw std::runtime_error("Failed to set socket to non-blocking mode");
+        close(fd);
+        return -1;
     }
 
     // Bind socket
@@ -50,133 +74,620 @@ bool Server::setupSocket() {
     std::memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(_port);
+    addr.sin_port = htons(port);
 
-    if (bind(_socket_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         Logger::error("Failed to bind socket: " + std::string(strerror(errno)));
-        close(_socket_fd);
-        return false;
+        close(fd);
+        return -1;
     }
 
     // Listen
-    if (listen(_socket_fd, 5) < 0) {
+    if (listen(fd, backlog) < 0) {
         Logger::error("Failed to listen on socket: " + std::string(strerror(errno)));
-        close(_socket_fd);
-        return false;
+        close(fd);
+        return -1;
     }
 
-    return true;
+    return fd;
 }
 
 bool Server::start() {
     if (!setupSocket())
         return false;
+    if (_config.link_port && !_links.listen(_config.link_port, _config.listen_backlog))
+        return false;
+
+    loadChannels();
+    initialize();
+    return true;
+}
+
+void Server::loadChannels() {
+    uint64_t started = TimerWheel::monotonicMs();
+    std::map<std::string, ChannelStore::State> states;
+    if (!_store.load(states))
+        return;
+
+    size_t restored = 0;
+    for (std::map<std::string, ChannelStore::State>::const_iterator it = states.begin(); it != states.end(); ++it) {
+        const ChannelStore::State& state = it->second;
+
+        // Nobody could ever be invited back in: only a member can invite
+        if (state.invite_only && state.founder.empty()) {
+            Logger::info("Not restoring invite-only channel " + it->first + ": it has no founder");
+            continue;
+        }
+
+        Channel* channel = createChannel(it->first);
+        channel->restoreTopic(state.topic, state.topic_setter, state.topic_time);
+        channel->setKey(state.key);
+        channel->setInviteOnly(state.invite_only);
+        channel->setTopicRestricted(state.topic_restricted);
+        channel->setUserLimit(state.user_limit);
+        channel->setTextPolicy(state.text_policy);
+        for (size_t i = 0; i < state.bans.size(); ++i)
+            channel->addBan(state.bans[i]);
+        channel->setFounder(state.founder);
+        ++restored;
+    }
+
+    Logger::info("Restored " + numberToString(restored) + " channels in "
+                 + numberToString(TimerWheel::monotonicMs() - started) + "ms");
+}
+
+void Server::initialize() {
+    Logger::debug("Case mapping kernels: " + std::string(CaseMapping::kernelName())
+                  + ", text scan: " + TextFilter::kernelName());
 
     // Initialize command handler
     _command_handler = new CommandHandler(*this);
 
     // Initialize poll with server socket
-    struct pollfd pfd;
-    pfd.fd = _socket_fd;
-    pfd.events = POLLIN;
-    pfd.revents = 0;  // Initialize revents
-    _poll_fds.push_back(pfd);
+    addPollFd(_socket_fd);
+    if (_links.getListenFd() != -1)
+        addPollFd(_links.getListenFd());
+    if (_credentials.start())
+        addPollFd(_credentials.getNotifyFd());
+    if (!_accounts.open())
+        Logger::warning("Account store unavailable; SASL and REGISTER are disabled");
+    if (_fanout.start())
+        addPollFd(_fanout.getNotifyFd());
 
-    return true;
+    _timers.arm(&_throttle_gc_timer, THROTTLE_GC_INTERVAL);
+
+    // Channels restored so far are already durable; journal from here on
+    if (_store.open())
+        _timers.arm(&_store_timer, CHANNEL_STORE_INTERVAL);
 }
 
-void Server::handleNewConnection() {
-    struct sockaddr_in clientAddr;
+void Server::handleNewConnection(int listen_fd) {
+    struct sockaddr_storage clientAddr;
     socklen_t clientLen = sizeof(clientAddr);
     
-    int clientFd = accept(_socket_fd, (struct sockaddr*)&clientAddr, &clientLen);
+    int clientFd = accept(listen_fd, (struct sockaddr*)&clientAddr, &clientLen);
     if (clientFd < 0) {
         if (errno != EWOULDBLOCK)
             Logger::error("Failed to accept connection: " + std::string(strerror(errno)));
         return;
     }
 
+    char hostname[NI_MAXHOST];
+    if (getnameinfo((struct sockaddr*)&clientAddr, clientLen,
+                    hostname, NI_MAXHOST, NULL, 0, NI_NUMERICHOST) != 0) {
+        std::strcpy(hostname, "unknown");
+    }
+
+    // Enforce connection limits before any per-client state is allocated;
+    // the link port is password protected and exempt
+    bool server_link = listen_fd != _socket_fd;
+    std::string reason;
+    if (!server_link && _config.max_clients && _clients.size() >= _config.max_clients)
+        reason = "Server is full";
+    else if (!server_link) {
+        ConnectionThrottle::Verdict verdict
+            = _throttle.admit(ConnectionThrottle::keyFor(clientAddr), TimerWheel::monotonicMs());
+        if (verdict != ConnectionThrottle::ACCEPT)
+            reason = verdict == ConnectionThrottle::TOO_MANY_CLONES
+                ? "Too many host connections" : "Connection throttled";
+    }
+    if (!reason.empty()) {
+        std::string error_msg = "ERROR :Closing Link: " + std::string(hostname) + " (" + reason + ")\r\n";
+        send(clientFd, error_msg.c_str(), error_msg.length(), MSG_DONTWAIT);
+        close(clientFd);
+        Logger::debug("Rejected connection from " + std::string(hostname) + ": " + reason);
+        return;
+    }
+
     // Set socket to non-blocking mode
     if (fcntl(clientFd, F_SETFL, O_NONBLOCK) < 0) {
         Logger::error("Failed to set client socket to non-blocking mode: " + std::string(strerror(errno)));
+        if (!server_link)
+            _throttle.release(ConnectionThrottle::keyFor(clientAddr));
         close(clientFd);
         return;
     }
 
-    // Create new client
-    Client* newClient = new Client(clientFd);
-    
-    // Set hostname
-    char hostname[NI_MAXHOST];
-    if (getnameinfo((struct sockaddr*)&clientAddr, sizeof(clientAddr),
-                    hostname, NI_MAXHOST, NULL, 0, NI_NUMERICHOST) == 0) {
-        newClient->setHostname(hostname);
-    } else {
-        newClient->setHostname("unknown");
+    addConnection(clientFd, clientAddr, hostname, server_link);
+    Logger::info("New connection from " + std::string(hostname));
+}
+
+Client* Server::addConnection(int fd, const struct sockaddr_storage& addr,
+                              const std::string& hostname, bool server_link) {
+    Client* client = new Client(fd);
+    client->setHostname(hostname);
+    client->setAddress(addr);
+    client->setServerLink(server_link);
+
+    addPollFd(fd);
+    _clients[fd] = client;
+    if (!server_link)
+        indexUser(client);
+    client->setLastActivity(TimerWheel::monotonicMs());
+    _timers.arm(&client->getRegistrationTimer(), _config.registration_timeout);
+    return client;
+}
+
+void Server::setPollEvents(int fd, short events) {
+    std::map<int, Client*>::iterator it = _clients.find(fd);
+    if (it != _clients.end() && it->second->isRunnable())
+        events &= ~POLLIN;
+    for (size_t i = 0; i < _poll_fds.size(); ++i) {
+        if (_poll_fds[i].fd == fd)
+            _poll_fds[i].events = events;
+    }
+}
+
+void Server::setPollInput(int fd, bool enabled) {
+    for (size_t i = 0; i < _poll_fds.size(); ++i) {
+        if (_poll_fds[i].fd == fd)
+            _poll_fds[i].events = enabled ? (_poll_fds[i].events | POLLIN) : (_poll_fds[i].events & ~POLLIN);
     }
+}
+
+// Local users sharing at least one channel with client get line exactly
+// once: a fresh epoch marks everyone reached so far, so overlapping
+// channels cost a comparison instead of a duplicate send. Remote members
+// are reached through propagation, not here.
+void Server::sendToPeers(Client* client, const SharedLine& line, bool include_self) {
+    uint64_t epoch = ++_peer_epoch;
+    client->markVisited(epoch);
+    if (include_self && !client->isRemote())
+        client->sendRaw(line.str());
 
-    // Add to poll fds
+    const std::vector<Channel*>& channels = client->getChannels();
+    for (size_t i = 0; i < channels.size(); ++i) {
+        const std::vector<Client*>& members = channels[i]->getClients();
+        for (size_t m = 0; m < members.size(); ++m) {
+            if (!members[m]->isRemote() && members[m]->markVisited(epoch))
+                members[m]->sendRaw(line.str());
+        }
+    }
+}
+
+void Server::startListing(Client* client) {
+    _listings.insert(client->getFd());
+}
+
+// Drop client from every channel, deleting channels left empty
+void Server::leaveAllChannels(Client* client) {
+    std::vector<Channel*> channels = client->getChannels();
+    for (size_t i = 0; i < channels.size(); ++i) {
+        channels[i]->removeClient(client);
+        client->leaveChannel(channels[i]);
+        if (channels[i]->getClients().empty())
+            removeChannel(channels[i]->getName());
+    }
+}
+
+// Invites are held by pointer and outlive membership, so a pending one
+// would otherwise pass to whoever gets the recycled record next
+void Server::dropInvites(Client* client) {
+    for (Channel* channel = _channels.first(); channel; channel = ChannelRegistry::next(channel))
+        channel->removeInvite(client);
+}
+
+// Host index keys are reversed so a suffix mask becomes a key prefix and
+// the ordered map serves as the trie: "*.example.com" is one range scan.
+static std::string reversedHost(const std::string& host) {
+    std::string key = CaseMapping::fold(host);
+    std::reverse(key.begin(), key.end());
+    return key;
+}
+
+void Server::indexUser(Client* client) {
+    if (!client->getNickname().empty())
+        _nicks.insert(CaseMapping::fold(client->getNickname()), client);
+    _hosts.insert(std::make_pair(reversedHost(client->getHostname()), client));
+}
+
+// Call after client->setNickname(); old_nickname may be empty
+void Server::renameUser(Client* client, const std::string& old_nickname) {
+    if (!old_nickname.empty()) {
+        std::string old_key = CaseMapping::fold(old_nickname);
+        Client** owner = _nicks.find(old_key);
+        if (owner && *owner == client)
+            _nicks.erase(old_key);
+    }
+    if (!client->getNickname().empty())
+        _nicks.insert(CaseMapping::fold(client->getNickname()), client);
+}
+
+void Server::unindexUser(Client* client) {
+    if (!client->getNickname().empty()) {
+        std::string key = CaseMapping::fold(client->getNickname());
+        Client** owner = _nicks.find(key);
+        if (owner && *owner == client)
+            _nicks.erase(key);
+    }
+    typedef std::multimap<std::string, Client*>::iterator HostIter;
+    std::pair<HostIter, HostIter> range = _hosts.equal_range(reversedHost(client->getHostname()));
+    for (HostIter it = range.first; it != range.second; ++it) {
+        if (it->second == client) {
+            _hosts.erase(it);
+            break;
+        }
+    }
+}
+
+const OpenHashMap<Client*>& Server::getNickIndex() const {
+    return _nicks;
+}
+
+// Appends up to limit registered users whose host ends with suffix;
+// returns the count added
+size_t Server::findByHostSuffix(const std::string& suffix, std::vector<Client*>& out, size_t limit) const {
+    std::string prefix = reversedHost(suffix);
+    size_t found = 0;
+    std::multimap<std::string, Client*>::const_iterator it = _hosts.lower_bound(prefix);
+    for (; it != _hosts.end() && found < limit; ++it) {
+        if (it->first.compare(0, prefix.size(), prefix) != 0)
+            break;
+        if (!it->second->isRegistered())
+            continue;
+        out.push_back(it->second);
+        ++found;
+    }
+    return found;
+}
+
+void Server::accountMemory(MemoryStats& stats) const {
+    // Local connections, then remote users, which only the nick index holds
+    for (std::map<int, Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+        it->second->accountMemory(stats);
+    for (size_t i = 0; i < _nicks.capacity(); ++i) {
+        if (_nicks.occupied(i) && _nicks.valueAt(i)->isRemote())
+            _nicks.valueAt(i)->accountMemory(stats);
+    }
+    stats.add(MemoryStats::MEM_CLIENTS, _clients.size() * (MemoryStats::NODE_OVERHEAD + sizeof(std::pair<int, Client*>))
+              + MemoryStats::vectorBytes(_poll_fds) + Client::pooledCount() * sizeof(Client), 0);
+
+    for (Channel* channel = _channels.first(); channel; channel = ChannelRegistry::next(channel))
+        channel->accountMemory(stats);
+
+    stats.add(MemoryStats::MEM_NICK_INDEX, _nicks.memoryUsage(), _nicks.size());
+    size_t hosts = _hosts.size() * (MemoryStats::NODE_OVERHEAD + sizeof(std::pair<std::string, Client*>));
+    for (std::multimap<std::string, Client*>::const_iterator it = _hosts.begin(); it != _hosts.end(); ++it)
+        hosts += MemoryStats::stringBytes(it->first);
+    stats.add(MemoryStats::MEM_HOST_INDEX, hosts, _hosts.size());
+    stats.add(MemoryStats::MEM_CHANNEL_INDEX, _channels.memoryUsage(), _channels.size());
+}
+
+void Server::addPollFd(int fd) {
     struct pollfd pfd;
-    pfd.fd = clientFd;
+    pfd.fd = fd;
     pfd.events = POLLIN;
     pfd.revents = 0;  // Initialize revents
     _poll_fds.push_back(pfd);
-
-    _clients[clientFd] = newClient;
-    Logger::info("New client connected from " + std::string(hostname));
 }
 
+// Reads until the socket is drained, seen as EAGAIN or a short read, or
+// the per-event budget is spent; poll reports the rest next time round.
+// Each readv fills the free space behind a held partial line first, then
+// the shared receive buffer.
 void Server::handleClientMessage(int client_fd) {
-    char buffer[1024];
-    ssize_t bytes_read = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    
-    if (bytes_read <= 0) {
-        if (bytes_read == 0) {
-            Logger::debug("Client disconnected gracefully");
-        } else {
-            Logger::debug("Error reading from client: " + std::string(strerror(errno)));
+    Client* client = _clients[client_fd];
+    ++_read_stats.events;
+    size_t reads = 0;
+    while (true) {
+        if (reads == _config.read_budget) {
+            ++_read_stats.budget_stops;
+            break;
         }
-        removeClient(client_fd);
-        return;
+
+        DynamicBuffer& pending = client->getBuffer();
+        size_t held = 0;
+        if (pending.size() > 0) {
+            pending.reserve(BUFFER_SIZE);
+            held = pending.remainingCapacity();
+        }
+        // Never read more than the client's buffer could keep, as lines
+        // past the quantum are held there. A lowered limit can leave a
+        // buffer already past it.
+        size_t kept = pending.size() + held;
+        size_t room = kept < DynamicBuffer::maxSize() ? DynamicBuffer::maxSize() - kept : 0;
+        if (held + room == 0) {
+            Logger::error("Buffer overflow for client " + client->getNickname());
+            removeClient(client_fd);
+            return;
+        }
+        struct iovec iov[2];
+        iov[0].iov_base = held ? pending.tail() : NULL;
+        iov[0].iov_len = held;
+        iov[1].iov_base = _recv_buffer;
+        iov[1].iov_len = room < sizeof(_recv_buffer) ? room : sizeof(_recv_buffer);
+
+        ssize_t bytes_read = readv(client_fd, iov, 2);
+        if (bytes_read < 0 && errno == EINTR)
+            continue;
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (bytes_read <= 0) {
+            if (bytes_read == 0) {
+                Logger::debug("Client disconnected gracefully");
+            } else {
+                Logger::debug("Error reading from client: " + std::string(strerror(errno)));
+            }
+            removeClient(client_fd);
+            return;
+        }
+
+        ++reads;
+        ++_read_stats.reads;
+        _read_stats.bytes += bytes_read;
+        if (static_cast<size_t>(bytes_read) > _read_stats.max_read)
+            _read_stats.max_read = bytes_read;
+        client->setLastActivity(TimerWheel::monotonicMs());
+        if (!takeInput(client, held, bytes_read))
+            return;
+        if (static_cast<size_t>(bytes_read) < held + iov[1].iov_len
+            || client->isAuthPending() || client->isRunnable())
+            break;
     }
+    if (reads > _read_stats.max_reads)
+        _read_stats.max_reads = reads;
+}
 
-    Client* client = _clients[client_fd];
-    if (!client->appendToBuffer(buffer, bytes_read)) {
+// The first held bytes of a read are already in the client's buffer; the
+// rest sit in the shared one. Whatever finishes the held line is copied
+// over, the remaining lines are parsed in place. False if the client is gone.
+bool Server::takeInput(Client* client, size_t held, size_t size) {
+    DynamicBuffer& pending = client->getBuffer();
+    size_t quantum = quantumFor(client);
+    size_t in_place = size < held ? size : held;
+    pending.commit(in_place);
+    const char* data = _recv_buffer;
+    size_t rest = size - in_place;
+
+    if (pending.size() > 0 && rest > 0) {
+        const char* newline = static_cast<const char*>(std::memchr(data, '\n', rest));
+        size_t head = newline ? newline - data + 1 : rest;
+        if (!client->appendToBuffer(data, head)) {
+            Logger::error("Buffer overflow for client " + client->getNickname());
+            removeClient(client->getFd());
+            return false;
+        }
+        data += head;
+        rest -= head;
+    }
+    if (pending.size() > 0 && !processLines(client, quantum))
+        return false;
+    if (rest == 0)
+        return true;
+
+    // While a credential check holds the client, or its quantum is spent,
+    // every byte is kept
+    size_t used = 0;
+    if (pending.size() == 0 && !consumeLines(client, data, rest, used, quantum))
+        return false;
+    if (used < rest && !client->appendToBuffer(data + used, rest - used)) {
         Logger::error("Buffer overflow for client " + client->getNickname());
-        removeClient(client_fd);
-        return;
+        removeClient(client->getFd());
+        return false;
     }
+    if (quantum == 0 && pending.size() > 0)
+        schedule(client);
+    return true;
+}
 
-    DynamicBuffer& clientBuffer = client->getBuffer();
-    while (clientBuffer.hasCompleteLine()) {
-        std::string cmd = clientBuffer.getLine();
+// Runs complete lines from data until none is left, the quantum is spent
+// or a credential check puts the client on hold; used is what was taken.
+// False if a command dropped the connection.
+bool Server::consumeLines(Client* client, const char* data, size_t size, size_t& used, size_t& quantum) {
+    int client_fd = client->getFd();
+    used = 0;
+    while (used < size && quantum > 0 && !client->isAuthPending()) {
+        const char* end = static_cast<const char*>(std::memchr(data + used, '\n', size - used));
+        if (!end)
+            break;
+        size_t length = end - (data + used);
+        std::string cmd(data + used, length > 0 && end[-1] == '\r' ? length - 1 : length);
+        used += length + 1;
+        --quantum;
         if (!cmd.empty()) {
             Logger::debug("Processing command: '" + cmd + "'");
-            _command_handler->handleCommand(client, cmd);
+            if (client->isServerLink())
+                _links.handleLine(client, cmd);
+            else
+                _command_handler->handleCommand(client, cmd);
         }
+
+        // The command may have dropped this connection
+        std::map<int, Client*>::iterator it = _clients.find(client_fd);
+        if (it == _clients.end() || it->second != client || client->isClosing())
+            return false;
+    }
+    return true;
+}
+
+// Runs buffered lines until none is complete, the quantum is spent or a
+// credential check puts the client on hold; the check's result resumes
+// it. A spent quantum puts the client on the run queue. The buffer's
+// storage goes back once it is empty. False if a command dropped the
+// connection.
+bool Server::processLines(Client* client, size_t& quantum) {
+    DynamicBuffer& pending = client->getBuffer();
+    size_t used = 0;
+    if (!consumeLines(client, pending.data(), pending.size(), used, quantum))
+        return false;
+    pending.consume(used);
+    if (quantum == 0 && pending.size() > 0)
+        schedule(client);
+    pending.release();
+    return true;
+}
+
+// Links carry bursts of the whole network and are not rationed
+size_t Server::quantumFor(const Client* client) const {
+    return client->isServerLink() ? static_cast<size_t>(-1) : _config.command_quantum;
+}
+
+// Reads stay off while the client has lines waiting, so a flood backs up
+// in its own socket rather than in our buffers
+void Server::schedule(Client* client) {
+    if (client->isRunnable())
+        return;
+    client->setRunnable(true);
+    _run_queue.push_back(std::make_pair(client->getFd(), client->getId()));
+    setPollInput(client->getFd(), false);
+}
+
+// Each queued client gets one quantum per loop turn, in arrival order;
+// one with more left goes to the back. True while work remains.
+bool Server::serviceRunQueue() {
+    for (size_t n = _run_queue.size(); n > 0; --n) {
+        std::pair<int, uint64_t> entry = _run_queue.front();
+        _run_queue.pop_front();
+        std::map<int, Client*>::iterator it = _clients.find(entry.first);
+        if (it == _clients.end() || it->second->getId() != entry.second || it->second->isClosing())
+            continue;
+        Client* client = it->second;
+        client->setRunnable(false);
+        setPollInput(entry.first, true);
+        size_t quantum = quantumFor(client);
+        processLines(client, quantum);
     }
+    return !_run_queue.empty();
 }
 
-void Server::removeClient(int client_fd) {
-    // Remove from poll fds
-    for (std::vector<pollfd>::iterator it = _poll_fds.begin(); it != _poll_fds.end(); ++it) {
-        if (it->fd == client_fd) {
-            _poll_fds.erase(it);
+// Results for clients that left meanwhile are dropped; a reused fd is told
+// apart by the client id
+void Server::applyCredentialResults(const std::vector<CredentialPool::Result>& results) {
+    for (size_t i = 0; i < results.size(); ++i) {
+        const CredentialPool::Result& result = results[i];
+        std::map<int, Client*>::iterator it = _clients.find(result.fd);
+        if (it == _clients.end() || it->second->getId() != result.client_id || it->second->isClosing())
+            continue;
+        Client* client = it->second;
+        client->setAuthPending(false);
+        if (result.kind == CREDENTIAL_LINK)
+            _links.finishCredential(client, result);
+        else
+            _command_handler->finishCredential(client, result);
+
+        if (!client->isClosing()) {
+            size_t quantum = quantumFor(client);
+            processLines(client, quantum);
+        }
+    }
+}
+
+// Only marks the client: it stays in every index until the teardown
+// phase, so whatever still holds it this loop turn holds a live record.
+// Its fd leaves the poll set at once; poll ignores negative fds.
+void Server::removeClient(int client_fd, const std::string& reason) {
+    std::map<int, Client*>::iterator it = _clients.find(client_fd);
+    if (it == _clients.end() || it->second->isClosing())
+        return;
+    Client* client = it->second;
+    client->setClosing(reason);
+    _timers.cancel(&client->getRegistrationTimer());
+    _timers.cancel(&client->getPingTimer());
+    for (size_t i = 0; i < _poll_fds.size(); ++i) {
+        if (_poll_fds[i].fd == client_fd) {
+            _poll_fds[i].fd = -1;
             break;
         }
     }
+    _teardown.push_back(client);
+}
 
-    // Delete client object
-    delete _clients[client_fd];
-    _clients.erase(client_fd);
+// Teardown phase, once per loop turn: every client closed since the last
+// one tells its peers and leaves channels and indexes before any record
+// is freed, then the fds are closed and the poll set compacted in one pass.
+// A client a fan-out job still holds waits for a later turn.
+void Server::reapClients() {
+    if (_teardown.empty())
+        return;
 
-    // Close socket
-    close(client_fd);
+    std::vector<Client*> held;
+    size_t ready = 0;
+    for (size_t i = 0; i < _teardown.size(); ++i) {
+        if (_teardown[i]->isFanoutPending())
+            held.push_back(_teardown[i]);
+        else
+            _teardown[ready++] = _teardown[i];
+    }
+    _teardown.resize(ready);
+
+    for (size_t i = 0; i < _teardown.size(); ++i) {
+        Client* client = _teardown[i];
+        const std::string& reason = client->getCloseReason();
+        if (client->isServerLink())
+            _links.linkClosed(client, reason);
+        else {
+            _throttle.release(ConnectionThrottle::keyFor(client->getAddress()));
+            if (client->isRegistered())
+                sendToPeers(client, SharedLine(":" + client->getNickname() + "!" + client->getUsername()
+                                               + "@" + SERVER_NAME + " QUIT :" + reason + "\r\n"), false);
+            _links.clientQuit(client, reason);
+            leaveAllChannels(client);
+            dropInvites(client);
+            unindexUser(client);
+        }
+        client->flushSendQueue();  // Best effort for the closing ERROR
+    }
+
+    for (size_t i = 0; i < _teardown.size(); ++i) {
+        int fd = _teardown[i]->getFd();
+        _clients.erase(fd);
+        delete _teardown[i];
+        close(fd);
+    }
+    _teardown.swap(held);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < _poll_fds.size(); ++i) {
+        if (_poll_fds[i].fd >= 0)
+            _poll_fds[kept++] = _poll_fds[i];
+    }
+    _poll_fds.resize(kept);
 }
 
 void Server::run() {
     while (true) {
-        int ready = poll(&_poll_fds[0], _poll_fds.size(), -1);
+        if (_shutdown_requested) {
+            Logger::info("Shutting down server...");
+            return;
+        }
+        if (_reload_requested) {
+            _reload_requested = 0;
+            reloadConfig();
+        }
+
+        bool backlog = serviceRunQueue();
+        bool listing = serviceListings();
+        serviceSendQueues();
+        reapClients();
+
+        if (_upgrade_requested) {
+            _upgrade_requested = 0;
+            if (upgrade())
+                return;
+        }
+
+        int timeout = listing || backlog ? 0 : _timers.msUntilNext(TimerWheel::monotonicMs());
+        int ready = poll(&_poll_fds[0], _poll_fds.size(), timeout);
         if (ready < 0) {
             if (errno == EINTR)
                 continue;
@@ -184,33 +695,192 @@ void Server::run() {
             break;
         }
 
-        for (size_t i = 0; i < _poll_fds.size(); ++i) {
+        for (size_t i = 0; ready > 0 && i < _poll_fds.size(); ++i) {
+            int fd = _poll_fds[i].fd;
+            if (_poll_fds[i].revents & (POLLOUT | POLLERR | POLLHUP)) {
+                std::map<int, Client*>::iterator it = _clients.find(fd);
+                if (it != _clients.end() && _links.isConnecting(it->second)) {
+                    _links.finishConnect(it->second);
+                    continue;
+                }
+                if (it != _clients.end() && (_poll_fds[i].revents & POLLOUT)) {
+                    Client* client = it->second;
+                    if (!client->flushSendQueue()) {
+                        removeClient(fd, "Write error");
+                        continue;
+                    }
+                    if (client->getSendQueueSize() == 0 || client->isFanoutPending())
+                        setPollEvents(fd, POLLIN);
+                }
+            }
             if (_poll_fds[i].revents & POLLIN) {
-                if (_poll_fds[i].fd == _socket_fd)
-                    handleNewConnection();
-                else
-                    handleClientMessage(_poll_fds[i].fd);
+                if (fd == _socket_fd || fd == _links.getListenFd()) {
+                    handleNewConnection(fd);
+                } else if (fd == _fanout.getNotifyFd()) {
+                    _fanout.collect();
+                } else if (fd == _credentials.getNotifyFd()) {
+                    std::vector<CredentialPool::Result> results;
+                    _credentials.collect(results);
+                    applyCredentialResults(results);
+                } else
+                    handleClientMessage(fd);
+            }
+        }
+
+        runTimers();
+    }
+}
+
+// Queues that started backing up since the last poll wait for POLLOUT;
+// ones past their limit are dropped rather than left to grow
+void Server::serviceSendQueues() {
+    std::vector<Client*> blocked;
+    Client::collectBlocked(blocked);
+    for (size_t i = 0; i < blocked.size(); ++i) {
+        Client* client = blocked[i];
+        std::map<int, Client*>::iterator it = _clients.find(client->getFd());
+        if (it == _clients.end() || it->second != client || client->isClosing())
+            continue;
+        if (client->isSendQueueExceeded())
+            disconnectClient(client, "SendQ exceeded");
+        else if (client->getSendQueueSize() > 0 && !client->isFanoutPending())
+            setPollEvents(client->getFd(), POLLIN | POLLOUT);
+    }
+}
+
+// Streams pending LIST replies while their readers keep up; returns true
+// when some listing can go on without waiting for its queue to drain
+bool Server::serviceListings() {
+    bool runnable = false;
+    std::set<int>::iterator it = _listings.begin();
+    while (it != _listings.end()) {
+        std::map<int, Client*>::iterator found = _clients.find(*it);
+        Client* client = found != _clients.end() ? found->second : NULL;
+        if (!client || client->isClosing() || !client->getListQuery()) {
+            _listings.erase(it++);
+            continue;
+        }
+        if (client->getSendQueueSize() <= LIST_SENDQ_SOFT) {
+            if (_command_handler->continueList(client)) {
+                client->setListQuery(NULL);
+                _listings.erase(it++);
+                continue;
             }
+            runnable = runnable || client->getSendQueueSize() <= LIST_SENDQ_SOFT;
+        }
+        ++it;
+    }
+    return runnable;
+}
+
+void Server::runTimers() {
+    _timers.advance(TimerWheel::monotonicMs());
+    while (Timer* timer = _timers.popExpired())
+        handleTimer(timer);
+}
+
+void Server::handleTimer(Timer* timer) {
+    switch (timer->kind) {
+        case TIMER_REGISTRATION: {
+            Client* client = static_cast<Client*>(timer->owner);
+            if (!client->isRegistered())
+                disconnectClient(client, "Registration timeout");
+            break;
         }
+        case TIMER_PING:
+            handlePingTimer(static_cast<Client*>(timer->owner));
+            break;
+        case TIMER_THROTTLE_GC: {
+            size_t removed = _throttle.collect(TimerWheel::monotonicMs());
+            if (removed > 0)
+                Logger::debug("Throttle GC removed " + numberToString(removed) + " host entries");
+            _timers.arm(&_throttle_gc_timer, THROTTLE_GC_INTERVAL);
+            break;
+        }
+        case TIMER_STORE_MAINTENANCE:
+            _store.reap();
+            if (_store.needsCompaction())
+                _store.compact(_channels);
+            _timers.arm(&_store_timer, CHANNEL_STORE_INTERVAL);
+            break;
+        case TIMER_LINK_RETRY:
+            _links.handleRetry(static_cast<LinkManager::Target*>(timer->owner));
+            break;
     }
 }
 
+void Server::handlePingTimer(Client* client) {
+    uint64_t now = TimerWheel::monotonicMs();
+    uint64_t idle = now - client->getLastActivity();
+
+    // Any inbound traffic since the last PING proves the peer is alive
+    if (client->isPingPending() && client->getLastActivity() >= client->getPingSent())
+        client->clearPing();
+
+    if (!client->isPingPending()) {
+        if (idle < _config.ping_interval) {
+            _timers.arm(&client->getPingTimer(), _config.ping_interval - idle);
+            return;
+        }
+        const std::string& token = client->startPing(now);
+        client->sendRaw("PING :" + token + "\r\n");
+        _timers.arm(&client->getPingTimer(), _config.ping_timeout);
+        return;
+    }
+
+    disconnectClient(client, "Ping timeout: " + numberToString(idle / 1000) + " seconds");
+}
+
+void Server::onClientRegistered(Client* client) {
+    _timers.cancel(&client->getRegistrationTimer());
+    _timers.arm(&client->getPingTimer(), _config.ping_interval);
+    if (!client->isServerLink())
+        _links.introduce(client);
+}
+
+void Server::disconnectClient(Client* client, const std::string& reason) {
+    if (client->isClosing())
+        return;
+    Logger::info("Disconnecting " + client->getHostname() + ": " + reason);
+    client->sendRaw("ERROR :Closing Link: " + client->getHostname() + " (" + reason + ")\r\n");
+    removeClient(client->getFd(), reason);
+}
+
 void Server::stop() {
+    // Sender threads may hold clients; let them finish before any goes
+    _fanout.stop();
+
     // First clear the poll_fds vector to ensure proper deallocation
     clearPollFds();
 
     // Clean up clients
     for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        _timers.cancel(&it->second->getRegistrationTimer());
+        _timers.cancel(&it->second->getPingTimer());
         close(it->first);
         delete it->second;
     }
     _clients.clear();
+    _teardown.clear();
+    _nicks.clear();
+    _hosts.clear();
+
+    // Users on other servers only exist while their links do
+    _links.clear();
 
     // Clean up channels
-    for (std::map<std::string, Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it)
-        delete it->second;
+    Channel* channel = _channels.first();
+    while (channel) {
+        Channel* next = ChannelRegistry::next(channel);
+        delete channel;
+        channel = next;
+    }
     _channels.clear();
 
+    // Workers may still be hashing; wait for them before the clients go
+    _credentials.stop();
+    Client::releasePool();
+
     // Clean up command handler
     delete _command_handler;
     _command_handler = NULL;
@@ -222,45 +892,220 @@ void Server::stop() {
     }
 }
 
+void Server::setExecutable(const std::string& path) {
+    _executable = path;
+}
+
+void Server::setConfigPath(const std::string& path) {
+    _config_path = path;
+}
+
+const ServerConfig& Server::getConfig() const {
+    return _config;
+}
+
+// Before start() the settings are only recorded. Once running, changed
+// listeners are opened before the old ones close, and a port that cannot
+// be bound keeps its old socket; connected clients are never touched.
+// Everything else is read where it is used, from the next loop turn on.
+void Server::configure(const ServerConfig& config) {
+    ServerConfig next = config;
+    if (_socket_fd != -1) {
+        if (next.port != _config.port) {
+            int fd = openListener(next.port, next.listen_backlog);
+            if (fd == -1)
+                next.port = _config.port;
+            else {
+                replacePollFd(_socket_fd, fd);
+                close(_socket_fd);
+                _socket_fd = fd;
+                Logger::info("Now listening on port " + numberToString(next.port));
+            }
+        } else if (next.listen_backlog != _config.listen_backlog)
+            listen(_socket_fd, next.listen_backlog);  // Resizes the queue in place
+
+        int link_fd = _links.getListenFd();
+        if (next.link_port != _config.link_port) {
+            if (next.link_port == 0) {
+                _links.closeListener();
+                replacePollFd(link_fd, -1);
+            } else if (_links.listen(next.link_port, next.listen_backlog)) {
+                replacePollFd(link_fd, _links.getListenFd());
+                if (link_fd != -1)
+                    close(link_fd);
+            } else
+                next.link_port = _config.link_port;
+        } else if (link_fd != -1 && next.listen_backlog != _config.listen_backlog)
+            listen(link_fd, next.listen_backlog);
+
+        if (next.fanout_threads != _config.fanout_threads) {
+            _fanout.stop();
+            _fanout.setThreadCount(next.fanout_threads);
+            _fanout.start();
+        }
+    }
+    _config = next;
+    applyLimits();
+}
+
+// Limits kept by other classes; the rest are read from _config where used
+void Server::applyLimits() {
+    DynamicBuffer::setMaxSize(_config.input_buffer_max);
+    Client::setSendQueueLimits(_config.sendq_max, _config.sendq_link_max);
+    _throttle.setLimits(_config.max_clones_per_host, _config.connect_burst, _config.connect_interval);
+    Logger::setLogLevel(static_cast<Logger::Level>(_config.log_level));
+    _fanout.setThreadCount(_config.fanout_threads);
+    _fanout.setThreshold(_config.fanout_threshold);
+}
+
+// SIGHUP, between loop turns. A file that does not parse changes nothing.
+void Server::reloadConfig() {
+    if (_config_path.empty()) {
+        Logger::warning("SIGHUP ignored: no config file was given");
+        return;
+    }
+    ServerConfig next = _config;
+    if (!next.load(_config_path)) {
+        Logger::error("Keeping the current configuration");
+        return;
+    }
+    ServerConfig previous = _config;
+    configure(next);
+    std::string changed = previous.changedKeys(_config);
+    Logger::info("Reloaded " + _config_path + ": " + (changed.empty() ? "no changes" : changed));
+}
+
+// Swaps a listener in the poll set; -1 on either side adds or drops one
+void Server::replacePollFd(int old_fd, int new_fd) {
+    for (std::vector<pollfd>::iterator it = _poll_fds.begin(); old_fd != -1 && it != _poll_fds.end(); ++it) {
+        if (it->fd != old_fd)
+            continue;
+        if (new_fd == -1)
+            _poll_fds.erase(it);
+        else
+            it->fd = new_fd;
+        return;
+    }
+    if (new_fd != -1)
+        addPollFd(new_fd);
+}
+
+void Server::setHostname(const std::string& name) {
+    _hostname = name;
+}
+
+void Server::setTextPolicy(int policy) {
+    _text_policy = policy;
+}
+
+void Server::addOper(const std::string& name, const std::string& password) {
+    _opers[name] = password;
+}
+
+bool Server::findOper(const std::string& name, std::string& password) const {
+    std::map<std::string, std::string>::const_iterator it = _opers.find(name);
+    if (it == _opers.end())
+        return false;
+    password = it->second;
+    return true;
+}
+
+bool Server::hasOpers() const {
+    return !_opers.empty();
+}
+
+bool Server::hasHashedOpers() const {
+    for (std::map<std::string, std::string>::const_iterator it = _opers.begin(); it != _opers.end(); ++it) {
+        if (CredentialPool::isHashed(it->second))
+            return true;
+    }
+    return false;
+}
+
+CommandProfiler& Server::getProfiler() {
+    return _profiler;
+}
+
+const Server::ReadStats& Server::getReadStats() const {
+    return _read_stats;
+}
+
+CredentialPool& Server::getCredentials() {
+    return _credentials;
+}
+
+AccountStore& Server::getAccounts() {
+    return _accounts;
+}
+
+FanoutPool& Server::getFanout() {
+    return _fanout;
+}
+
+LinkManager& Server::getLinks() {
+    return _links;
+}
+
+void Server::propagate(const std::string& line, Client* except) {
+    _links.propagate(line, except);
+}
+
+TimerWheel& Server::getTimers() {
+    return _timers;
+}
+
 const std::string& Server::getPassword() const {
     return _password;
 }
 
-const std::map<std::string, Channel*>& Server::getChannels() const {
+const ChannelRegistry& Server::getChannels() const {
     return _channels;
 }
 
+const std::map<int, Client*>& Server::getClients() const {
+    return _clients;
+}
+
 Client* Server::getClientByNickname(const std::string& nickname) const {
-    for (std::map<int, Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->second->getNickname() == nickname)
-            return it->second;
-    }
-    return NULL;
+    Client* const* client = _nicks.find(CaseMapping::fold(nickname));
+    return client ? *client : NULL;
 }
 
 Channel* Server::createChannel(const std::string& name) {
-    std::map<std::string, Channel*>::iterator it = _channels.find(name);
-    if (it != _channels.end())
-        return it->second;
-    
-    Channel* channel = new Channel(name);
-    _channels[name] = channel;
+    Channel* channel = _channels.find(name);
+    if (channel)
+        return channel;
+
+    channel = new Channel(name);
+    channel->setServer(this);
+    channel->setStore(&_store);
+    channel->setHistory(&_history);
+    _channels.insert(channel);
     Logger::debug("Created new channel: " + name);
     return channel;
 }
 
 Channel* Server::getChannel(const std::string& name) {
-    std::map<std::string, Channel*>::iterator it = _channels.find(name);
-    return (it != _channels.end()) ? it->second : NULL;
+    return _channels.find(name);
 }
 
 void Server::removeChannel(const std::string& name) {
-    std::map<std::string, Channel*>::iterator it = _channels.find(name);
-    if (it != _channels.end()) {
-        delete it->second;
-        _channels.erase(it);
-        Logger::debug("Removed channel: " + name);
+    Channel* channel = _channels.find(name);
+    if (!channel)
+        return;
+
+    // Listings paused on this channel resume from the one before it
+    for (std::set<int>::iterator it = _listings.begin(); it != _listings.end(); ++it) {
+        std::map<int, Client*>::iterator found = _clients.find(*it);
+        ListQuery* query = found != _clients.end() ? found->second->getListQuery() : NULL;
+        if (query && query->getCursor() == channel)
+            query->setCursor(ChannelRegistry::prev(channel));
     }
+
+    _store.logDrop(*channel);
+    _channels.erase(channel);
+    delete channel;
+    Logger::debug("Removed channel: " + name);
 }
 
 void Server::broadcastToChannel(const std::string& channel_name, const std::string& message, Client* exclude) {
@@ -271,4 +1116,8 @@ void Server::broadcastToChannel(const std::string& channel_name, const std::stri
 
 const std::string& Server::getHostname() const {
     return _hostname;
+}
+
+int Server::getTextPolicy() const {
+    return _text_policy;
 } 
\ No newline at end of file
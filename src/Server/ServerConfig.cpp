@@ -0,0 +1,157 @@
+#include "../../include/ServerConfig.hpp"
+#include "../../include/DynamicBuffer.hpp"
+#include "../../include/StateCodec.hpp"
+#include "../../include/Logger.hpp"
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+struct Field {
+    const char*             name;
+    size_t ServerConfig::*  value;
+    size_t                  min;
+    size_t                  max;
+};
+
+// Also the order of the upgrade state; append only
+const Field FIELDS[] = {
+    { "port",                 &ServerConfig::port,                 1,    65535 },
+    { "link_port",            &ServerConfig::link_port,            0,    65535 },
+    { "listen_backlog",       &ServerConfig::listen_backlog,       1,    65535 },
+    { "max_clients",          &ServerConfig::max_clients,          0,    1000000 },
+    { "max_clones_per_host",  &ServerConfig::max_clones_per_host,  1,    1000000 },
+    { "connect_burst",        &ServerConfig::connect_burst,        1,    1000000 },
+    { "connect_interval",     &ServerConfig::connect_interval,     0,    3600000 },
+    { "input_buffer_max",     &ServerConfig::input_buffer_max,     BUFFER_SIZE, 16 << 20 },
+    { "read_budget",          &ServerConfig::read_budget,          1,    1024 },
+    { "command_quantum",      &ServerConfig::command_quantum,      1,    1024 },
+    { "sendq_max",            &ServerConfig::sendq_max,            BUFFER_SIZE, 1 << 30 },
+    { "sendq_link_max",       &ServerConfig::sendq_link_max,       BUFFER_SIZE, 1 << 30 },
+    { "registration_timeout", &ServerConfig::registration_timeout, 1000, 3600000 },
+    { "ping_interval",        &ServerConfig::ping_interval,        1000, 3600000 },
+    { "ping_timeout",         &ServerConfig::ping_timeout,         1000, 3600000 },
+    { "nick_length",          &ServerConfig::nick_length,          1,    64 },
+    { "channel_length",       &ServerConfig::channel_length,       2,    200 },
+    { "log_level",            &ServerConfig::log_level,            Logger::DEBUG, Logger::ERROR },
+    { "fanout_threads",       &ServerConfig::fanout_threads,       0,    FANOUT_MAX_THREADS },
+    { "fanout_threshold",     &ServerConfig::fanout_threshold,     0,    1000000 },
+    { "max_targets",          &ServerConfig::max_targets,          1,    512 }
+};
+const size_t FIELD_COUNT = sizeof(FIELDS) / sizeof(FIELDS[0]);
+
+const char* const LOG_LEVELS[] = { "debug", "info", "warning", "error" };
+
+std::string trim(const std::string& text) {
+    std::string::size_type start = text.find_first_not_of(" \t\r");
+    if (start == std::string::npos)
+        return "";
+    std::string::size_type end = text.find_last_not_of(" \t\r");
+    return text.substr(start, end - start + 1);
+}
+
+bool parseValue(const Field& field, const std::string& text, size_t& value) {
+    if (field.value == &ServerConfig::log_level) {
+        for (size_t i = 0; i < sizeof(LOG_LEVELS) / sizeof(LOG_LEVELS[0]); ++i) {
+            if (text == LOG_LEVELS[i]) {
+                value = i;
+                return true;
+            }
+        }
+        return false;
+    }
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos || text.size() > 10)
+        return false;
+    unsigned long long number = std::strtoull(text.c_str(), NULL, 10);
+    if (number < field.min || number > field.max)
+        return false;
+    value = static_cast<size_t>(number);
+    return true;
+}
+
+}
+
+ServerConfig::ServerConfig()
+    : port(0), link_port(0), listen_backlog(LISTEN_BACKLOG), max_clients(MAX_CLIENTS),
+      max_clones_per_host(MAX_CLONES_PER_HOST), connect_burst(CONNECT_BURST),
+      connect_interval(CONNECT_INTERVAL), input_buffer_max(DynamicBuffer::DEFAULT_MAX_SIZE),
+      read_budget(RECV_READ_BUDGET), command_quantum(COMMAND_QUANTUM),
+      sendq_max(MAX_SENDQ), sendq_link_max(MAX_SENDQ_LINK),
+      registration_timeout(REGISTRATION_TIMEOUT), ping_interval(PING_INTERVAL),
+      ping_timeout(PING_TIMEOUT), nick_length(NICK_LENGTH), channel_length(CHANNEL_LENGTH),
+      log_level(Logger::INFO), fanout_threads(0), fanout_threshold(FANOUT_THRESHOLD),
+      max_targets(MAX_TARGETS) {
+}
+
+// Parses into a copy so a bad line halfway through changes nothing
+bool ServerConfig::load(const std::string& path) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        Logger::error("Cannot read config file " + path);
+        return false;
+    }
+
+    ServerConfig next = *this;
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); ++number) {
+        std::string::size_type hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+        line = trim(line);
+        if (line.empty())
+            continue;
+
+        std::string::size_type equals = line.find('=');
+        std::string key = trim(line.substr(0, equals));
+        std::string text = equals == std::string::npos ? "" : trim(line.substr(equals + 1));
+        const Field* field = NULL;
+        for (size_t i = 0; i < FIELD_COUNT && !field; ++i) {
+            if (key == FIELDS[i].name)
+                field = &FIELDS[i];
+        }
+
+        std::ostringstream where;
+        where << path << ":" << number << ": ";
+        if (!field) {
+            Logger::error(where.str() + "unknown setting '" + key + "'");
+            return false;
+        }
+        if (!parseValue(*field, text, next.*(field->value))) {
+            Logger::error(where.str() + "invalid value for " + key);
+            return false;
+        }
+    }
+    if (file.bad()) {
+        Logger::error("Failed reading config file " + path);
+        return false;
+    }
+    *this = next;
+    return true;
+}
+
+std::string ServerConfig::changedKeys(const ServerConfig& other) const {
+    std::string keys;
+    for (size_t i = 0; i < FIELD_COUNT; ++i) {
+        if (this->*(FIELDS[i].value) == other.*(FIELDS[i].value))
+            continue;
+        if (!keys.empty())
+            keys += ", ";
+        keys += FIELDS[i].name;
+    }
+    return keys;
+}
+
+void ServerConfig::write(StateWriter& out) const {
+    out.putU32(static_cast<uint32_t>(FIELD_COUNT));
+    for (size_t i = 0; i < FIELD_COUNT; ++i)
+        out.putU64(this->*(FIELDS[i].value));
+}
+
+void ServerConfig::read(StateReader& in) {
+    uint32_t count = in.getU32();
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t value = in.getU64();
+        if (i < FIELD_COUNT)
+            this->*(FIELDS[i].value) = static_cast<size_t>(value);
+    }
+}
@@ -0,0 +1,448 @@
+#include "../../include/Server.hpp"
+#include "../../include/Client.hpp"
+#include "../../include/Channel.hpp"
+#include "../../include/Logger.hpp"
+#include "../../include/StateCodec.hpp"
+#include <sys/wait.h>
+#include <algorithm>
+#include <stdexcept>
+
+// Binary upgrade: the running server serializes its state, forks and execs
+// the (possibly replaced) binary with --resume <fd>, then hands every socket
+// over a Unix socket with SCM_RIGHTS. Connections stay open throughout.
+
+std::string numberToString(size_t number);
+
+namespace {
+
+const uint32_t UPGRADE_MAGIC = 0x49524355;  // "IRCU"
+const uint32_t UPGRADE_VERSION = 10;
+const size_t FDS_PER_MESSAGE = 200;         // Below the kernel's SCM_MAX_FD
+const int HANDOFF_TIMEOUT_MS = 10000;
+
+bool writeAll(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool readAll(int fd, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool sendFds(int sock, const std::vector<int>& fds) {
+    for (size_t start = 0; start < fds.size(); start += FDS_PER_MESSAGE) {
+        size_t count = std::min(FDS_PER_MESSAGE, fds.size() - start);
+        std::vector<char> control(CMSG_SPACE(count * sizeof(int)));
+        char marker = 'F';
+        struct iovec iov;
+        iov.iov_base = &marker;
+        iov.iov_len = 1;
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control[0];
+        msg.msg_controllen = control.size();
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fds[start], count * sizeof(int));
+
+        ssize_t n;
+        do {
+            n = sendmsg(sock, &msg, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n != 1)
+            return false;
+    }
+    return true;
+}
+
+bool recvFds(int sock, size_t total, std::vector<int>& fds) {
+    while (fds.size() < total) {
+        size_t count = std::min(FDS_PER_MESSAGE, total - fds.size());
+        std::vector<char> control(CMSG_SPACE(count * sizeof(int)));
+        char marker;
+        struct iovec iov;
+        iov.iov_base = &marker;
+        iov.iov_len = 1;
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control[0];
+        msg.msg_controllen = control.size();
+
+        ssize_t n;
+        do {
+            n = recvmsg(sock, &msg, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n != 1 || (msg.msg_flags & MSG_CTRUNC))
+            return false;
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            return false;
+        size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        fds.insert(fds.end(), data, data + received);
+    }
+    return true;
+}
+
+// Members without an index (users on other servers) are left out; they
+// come back with the link burst once the new process relinks
+void putClientList(StateWriter& out, const std::vector<Client*>& clients,
+                   const std::map<Client*, uint32_t>& index) {
+    std::vector<uint32_t> local;
+    for (size_t i = 0; i < clients.size(); ++i) {
+        std::map<Client*, uint32_t>::const_iterator it = index.find(clients[i]);
+        if (it != index.end())
+            local.push_back(it->second);
+    }
+    out.putU32(static_cast<uint32_t>(local.size()));
+    for (size_t i = 0; i < local.size(); ++i)
+        out.putU32(local[i]);
+}
+
+void getClientList(StateReader& in, std::vector<Client*>& out, const std::vector<Client*>& clients) {
+    uint32_t count = in.getU32();
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t index = in.getU32();
+        if (index >= clients.size())
+            throw std::runtime_error("client index out of range");
+        out.push_back(clients[index]);
+    }
+}
+
+}
+
+void Server::serializeState(StateWriter& out, std::vector<int>& fds) const {
+    out.putU32(UPGRADE_MAGIC);
+    out.putU32(UPGRADE_VERSION);
+    _config.write(out);
+    out.putString(_config_path);
+    out.putString(_password);
+    out.putString(_hostname);
+    out.putU8(static_cast<uint8_t>(_text_policy));
+    out.putU8(static_cast<uint8_t>(_profiler.getMode()));
+    out.putU32(static_cast<uint32_t>(_opers.size()));
+    for (std::map<std::string, std::string>::const_iterator it = _opers.begin(); it != _opers.end(); ++it) {
+        out.putString(it->first);
+        out.putString(it->second);
+    }
+
+    // fds[0] is the listening socket, then the link listener if any, then
+    // one fd per client in order
+    fds.push_back(_socket_fd);
+    out.putU32(static_cast<uint32_t>(_links.getListenPort()));
+    out.putU8(_links.getListenFd() != -1 ? 1 : 0);
+    if (_links.getListenFd() != -1)
+        fds.push_back(_links.getListenFd());
+
+    // Server links are not handed over: peers see a split and the new
+    // process reconnects its targets
+    out.putString(_links.getPassword());
+    out.putString(_links.getAcceptPassword());
+    const std::vector<LinkManager::Target*>& targets = _links.getTargets();
+    out.putU32(static_cast<uint32_t>(targets.size()));
+    for (size_t i = 0; i < targets.size(); ++i) {
+        out.putString(targets[i]->host);
+        out.putU32(static_cast<uint32_t>(targets[i]->port));
+    }
+
+    std::vector<Client*> locals;
+    for (std::map<int, Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        if (!it->second->isServerLink())
+            locals.push_back(it->second);
+    }
+
+    std::map<Client*, uint32_t> index;
+    out.putU32(static_cast<uint32_t>(locals.size()));
+    for (size_t i = 0; i < locals.size(); ++i) {
+        Client* client = locals[i];
+        index[client] = static_cast<uint32_t>(i);
+        fds.push_back(client->getFd());
+
+        out.putString(client->getNickname());
+        out.putString(client->getUsername());
+        out.putString(client->getRealname());
+        out.putString(client->getHostname());
+        out.putBytes(&client->getAddress(), sizeof(struct sockaddr_storage));
+        out.putU8((client->isAuthenticated() ? 1 : 0) | (client->isRegistered() ? 2 : 0)
+                  | (client->isOper() ? 4 : 0) | (client->isCapNegotiating() ? 8 : 0));
+        out.putU64(static_cast<uint64_t>(client->getSignon()));
+        out.putString(client->getAccount());
+        out.putU32(static_cast<uint32_t>(client->getCaps()));
+        DynamicBuffer& input = client->getBuffer();
+        out.putString(std::string(input.data(), input.size()));
+        out.putString(client->getSendQueue());
+    }
+
+    out.putU32(static_cast<uint32_t>(_channels.size()));
+    for (Channel* channel = _channels.first(); channel; channel = ChannelRegistry::next(channel)) {
+        out.putString(channel->getName());
+        out.putString(channel->getTopic());
+        out.putString(channel->getTopicSetter());
+        out.putU64(static_cast<uint64_t>(channel->getTopicTime()));
+        out.putString(channel->getKey());
+        out.putU8(channel->isInviteOnly() ? 1 : 0);
+        out.putU8(channel->isTopicRestricted() ? 1 : 0);
+        out.putU8(static_cast<uint8_t>(channel->getTextPolicy()));
+        out.putU32(static_cast<uint32_t>(channel->getUserLimit()));
+        out.putString(channel->getFounder());
+
+        const std::vector<std::string>& bans = channel->getBanList();
+        out.putU32(static_cast<uint32_t>(bans.size()));
+        for (size_t i = 0; i < bans.size(); ++i)
+            out.putString(bans[i]);
+
+        putClientList(out, channel->getClients(), index);
+        putClientList(out, channel->getOperators(), index);
+        putClientList(out, channel->getVoicedClients(), index);
+        putClientList(out, channel->getInvitedClients(), index);
+    }
+}
+
+void Server::restoreState(StateReader& in, const std::vector<int>& fds) {
+    if (in.getU32() != UPGRADE_MAGIC || in.getU32() != UPGRADE_VERSION)
+        throw std::runtime_error("incompatible upgrade state");
+    ServerConfig config;
+    config.read(in);
+    configure(config);
+    _config_path = in.getString();
+    _password = in.getString();
+    _hostname = in.getString();
+    _text_policy = in.getU8();
+    _profiler.setMode(static_cast<CommandProfiler::Mode>(in.getU8()));  // Totals start over
+    uint32_t oper_count = in.getU32();
+    for (uint32_t i = 0; i < oper_count; ++i) {
+        std::string name = in.getString();
+        _opers[name] = in.getString();
+    }
+    _socket_fd = fds.at(0);
+
+    size_t next_fd = 1;
+    int link_port = static_cast<int>(in.getU32());
+    if (in.getU8())
+        _links.adoptListener(fds.at(next_fd++), link_port);
+    _links.setPassword(in.getString());
+    _links.setAcceptPassword(in.getString());
+    uint32_t target_count = in.getU32();
+    for (uint32_t i = 0; i < target_count; ++i) {
+        std::string host = in.getString();
+        _links.addTarget(host, static_cast<int>(in.getU32()));
+    }
+
+    uint64_t now = TimerWheel::monotonicMs();
+    std::vector<Client*> clients;
+    uint32_t client_count = in.getU32();
+    for (uint32_t i = 0; i < client_count; ++i) {
+        Client* client = new Client(fds.at(next_fd++));
+        _clients[client->getFd()] = client;
+        clients.push_back(client);
+        addPollFd(client->getFd());
+
+        client->setNickname(in.getString());
+        client->setUsername(in.getString());
+        client->setRealname(in.getString());
+        client->setHostname(in.getString());
+        struct sockaddr_storage address;
+        in.getBytes(&address, sizeof(address));
+        client->setAddress(address);
+        uint8_t flags = in.getU8();
+        client->setAuthenticated(flags & 1);
+        client->setRegistered(flags & 2);
+        client->setOper(flags & 4);
+        client->setCapNegotiating(flags & 8);
+        client->setSignon(static_cast<time_t>(in.getU64()));
+        client->setAccount(in.getString());
+        client->setCaps(static_cast<int>(in.getU32()));
+        std::string input = in.getString();
+        client->appendToBuffer(input.data(), input.size());
+        if (!input.empty())
+            schedule(client);  // Lines the old process had not run yet
+        client->sendRaw(in.getString());  // Unsent output; queues again if still blocked
+        indexUser(client);
+
+        _throttle.track(ConnectionThrottle::keyFor(address));
+        client->setLastActivity(now);
+        if (client->isRegistered())
+            _timers.arm(&client->getPingTimer(), _config.ping_interval);
+        else
+            _timers.arm(&client->getRegistrationTimer(), _config.registration_timeout);
+    }
+
+    uint32_t channel_count = in.getU32();
+    for (uint32_t i = 0; i < channel_count; ++i) {
+        Channel* channel = createChannel(in.getString());
+        std::string topic = in.getString();
+        std::string setter = in.getString();
+        channel->restoreTopic(topic, setter, static_cast<time_t>(in.getU64()));
+        channel->setKey(in.getString());
+        channel->setInviteOnly(in.getU8() != 0);
+        channel->setTopicRestricted(in.getU8() != 0);
+        channel->setTextPolicy(in.getU8());
+        channel->setUserLimit(in.getU32());
+        channel->setFounder(in.getString());
+
+        uint32_t ban_count = in.getU32();
+        for (uint32_t b = 0; b < ban_count; ++b)
+            channel->addBan(in.getString());
+
+        std::vector<Client*> members, operators, voiced, invited;
+        getClientList(in, members, clients);
+        getClientList(in, operators, clients);
+        getClientList(in, voiced, clients);
+        getClientList(in, invited, clients);
+        for (size_t m = 0; m < members.size(); ++m) {
+            channel->addClient(members[m]);
+            members[m]->joinChannel(channel);
+        }
+        for (size_t m = 0; m < operators.size(); ++m)
+            channel->addOperator(operators[m]);
+        for (size_t m = 0; m < voiced.size(); ++m)
+            channel->addVoice(voiced[m]);
+        for (size_t m = 0; m < invited.size(); ++m)
+            channel->addInvite(invited[m]);
+    }
+}
+
+bool Server::upgrade() {
+    if (_executable.empty()) {
+        Logger::error("Upgrade unavailable: executable path unknown");
+        return false;
+    }
+    Logger::info("Upgrading to " + _executable);
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        Logger::error("Upgrade failed: socketpair: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    // Settle credential checks so no client is handed over mid-PASS
+    std::vector<CredentialPool::Result> results;
+    _credentials.drain(results);
+    applyCredentialResults(results);
+    _fanout.drain();  // Unsent fan-out output joins the queues handed over
+    reapClients();    // Including clients a fan-out job was still holding
+    _accounts.close();  // Releases the log lock for the new process
+
+    StateWriter state;
+    std::vector<int> fds;
+    serializeState(state, fds);
+
+    // The child of a threaded process must not allocate: everything it
+    // needs is built here
+    std::string fd_arg = numberToString(sv[1]);
+    std::vector<int> inherited(fds);
+    for (std::map<int, Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+        inherited.push_back(it->first);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        Logger::error("Upgrade failed: fork: " + std::string(strerror(errno)));
+        close(sv[0]);
+        close(sv[1]);
+        _accounts.open();
+        return false;
+    }
+
+    if (pid == 0) {
+        // The new binary receives its sockets over the handoff channel only
+        close(sv[0]);
+        for (size_t i = 0; i < inherited.size(); ++i)
+            close(inherited[i]);
+        execl(_executable.c_str(), _executable.c_str(), "--resume", fd_arg.c_str(), (char*)NULL);
+        _exit(127);
+    }
+    close(sv[1]);
+
+    uint32_t header[2] = { UPGRADE_MAGIC, static_cast<uint32_t>(fds.size()) };
+    uint64_t length = state.data().size();
+    bool ok = writeAll(sv[0], header, sizeof(header))
+        && writeAll(sv[0], &length, sizeof(length))
+        && writeAll(sv[0], state.data().data(), state.data().size())
+        && sendFds(sv[0], fds);
+
+    // Wait for the new process to confirm it owns the connections
+    char ack = 0;
+    if (ok) {
+        struct pollfd pfd;
+        pfd.fd = sv[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        ok = poll(&pfd, 1, HANDOFF_TIMEOUT_MS) == 1 && read(sv[0], &ack, 1) == 1 && ack == 'R';
+    }
+    close(sv[0]);
+
+    if (!ok) {
+        Logger::error("Upgrade failed: new process did not take over, continuing");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        _accounts.open();
+        return false;
+    }
+
+    Logger::info("Handed " + numberToString(fds.size() - 1) + " sockets to pid " + numberToString(pid));
+    return true;
+}
+
+bool Server::resume(int handoff_fd) {
+    try {
+        uint32_t header[2];
+        uint64_t length;
+        if (!readAll(handoff_fd, header, sizeof(header)) || header[0] != UPGRADE_MAGIC
+            || !readAll(handoff_fd, &length, sizeof(length)))
+            throw std::runtime_error("bad handoff header");
+
+        std::vector<char> blob(length);
+        if (length > 0 && !readAll(handoff_fd, &blob[0], length))
+            throw std::runtime_error("truncated handoff state");
+
+        std::vector<int> fds;
+        if (!recvFds(handoff_fd, header[1], fds))
+            throw std::runtime_error("failed to receive sockets");
+
+        StateReader in(blob.empty() ? NULL : &blob[0], blob.size());
+        restoreState(in, fds);
+        initialize();
+        _links.connectAll();
+    }
+    catch (const std::exception& e) {
+        Logger::error(std::string("Resume failed: ") + e.what());
+        close(handoff_fd);
+        return false;
+    }
+
+    char ack = 'R';
+    bool ok = writeAll(handoff_fd, &ack, 1);
+    close(handoff_fd);
+    Logger::info("Resumed " + numberToString(_clients.size()) + " connections and "
+                 + numberToString(_channels.size()) + " channels on port " + numberToString(_config.port));
+    return ok;
+}
@@ -0,0 +1,375 @@
+#include "../../include/CaseMapping.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+# define CASEMAPPING_X86 1
+# include <immintrin.h>
+#endif
+
+namespace {
+
+enum {
+    CLASS_LETTER = 1,
+    CLASS_NICK = 2,         // Letters, digits, '-', '_'
+    CLASS_CHANNEL = 4       // Anything but space, ',', ':', BEL
+};
+
+// Scalar reference and tail handling
+struct Tables {
+    unsigned char lower[256];   // RFC 1459
+    unsigned char upper[256];   // ASCII, for command names
+    unsigned char classes[256];
+
+    Tables() {
+        for (int c = 0; c < 256; ++c) {
+            lower[c] = (c >= 'A' && c <= '^') ? c + ('a' - 'A') : c;
+            upper[c] = (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+            bool letter = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+            classes[c] = (letter ? CLASS_LETTER : 0)
+                | ((letter || (c >= '0' && c <= '9') || c == '-' || c == '_') ? CLASS_NICK : 0)
+                | ((c != ' ' && c != ',' && c != ':' && c != 7) ? CLASS_CHANNEL : 0);
+        }
+    }
+};
+
+const Tables& tables() {
+    static const Tables instance;
+    return instance;
+}
+
+void foldScalar(char* text, size_t size) {
+    const unsigned char* lower = tables().lower;
+    for (size_t i = 0; i < size; ++i)
+        text[i] = lower[static_cast<unsigned char>(text[i])];
+}
+
+void upperScalar(char* text, size_t size) {
+    const unsigned char* upper = tables().upper;
+    for (size_t i = 0; i < size; ++i)
+        text[i] = upper[static_cast<unsigned char>(text[i])];
+}
+
+bool equalScalar(const char* a, const char* b, size_t size) {
+    const unsigned char* lower = tables().lower;
+    for (size_t i = 0; i < size; ++i) {
+        if (lower[static_cast<unsigned char>(a[i])] != lower[static_cast<unsigned char>(b[i])])
+            return false;
+    }
+    return true;
+}
+
+size_t spanScalar(const char* text, size_t size, unsigned char char_class) {
+    const unsigned char* classes = tables().classes;
+    size_t i = 0;
+    while (i < size && (classes[static_cast<unsigned char>(text[i])] & char_class))
+        ++i;
+    return i;
+}
+
+size_t nickSpanScalar(const char* text, size_t size) {
+    return spanScalar(text, size, CLASS_NICK);
+}
+
+size_t channelSpanScalar(const char* text, size_t size) {
+    return spanScalar(text, size, CLASS_CHANNEL);
+}
+
+#ifdef CASEMAPPING_X86
+
+// Byte range tests use one signed compare: adding 0x80 - lo moves [lo, hi]
+// to the bottom of the signed range, so "x - lo <= hi - lo" unsigned
+// becomes "shifted < -128 + (hi - lo + 1)" signed.
+
+inline __m128i inRange16(__m128i x, unsigned char lo, unsigned char hi) {
+    __m128i shifted = _mm_add_epi8(x, _mm_set1_epi8(static_cast<char>(0x80 - lo)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(0x80 + (hi - lo) + 1)));
+}
+
+inline __m128i foldBlock16(__m128i x) {
+    return _mm_add_epi8(x, _mm_and_si128(inRange16(x, 'A', '^'), _mm_set1_epi8(0x20)));
+}
+
+void foldSse2(char* text, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i* block = reinterpret_cast<__m128i*>(text + i);
+        _mm_storeu_si128(block, foldBlock16(_mm_loadu_si128(block)));
+    }
+    foldScalar(text + i, size - i);
+}
+
+void upperSse2(char* text, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i* block = reinterpret_cast<__m128i*>(text + i);
+        __m128i x = _mm_loadu_si128(block);
+        _mm_storeu_si128(block, _mm_sub_epi8(x, _mm_and_si128(inRange16(x, 'a', 'z'), _mm_set1_epi8(0x20))));
+    }
+    upperScalar(text + i, size - i);
+}
+
+bool equalSse2(const char* a, const char* b, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = foldBlock16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m128i y = foldBlock16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF)
+            return false;
+    }
+    return equalScalar(a + i, b + i, size - i);
+}
+
+size_t nickSpanSse2(const char* text, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        __m128i ok = _mm_or_si128(_mm_or_si128(inRange16(x, 'A', 'Z'), inRange16(x, 'a', 'z')),
+                                  _mm_or_si128(inRange16(x, '0', '9'),
+                                               _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('-')),
+                                                            _mm_cmpeq_epi8(x, _mm_set1_epi8('_')))));
+        unsigned bad = ~static_cast<unsigned>(_mm_movemask_epi8(ok)) & 0xFFFF;
+        if (bad)
+            return i + __builtin_ctz(bad);
+    }
+    return i + nickSpanScalar(text + i, size - i);
+}
+
+size_t channelSpanSse2(const char* text, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        __m128i bad = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                                _mm_cmpeq_epi8(x, _mm_set1_epi8(','))),
+                                   _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(':')),
+                                                _mm_cmpeq_epi8(x, _mm_set1_epi8(7))));
+        unsigned bits = _mm_movemask_epi8(bad);
+        if (bits)
+            return i + __builtin_ctz(bits);
+    }
+    return i + channelSpanScalar(text + i, size - i);
+}
+
+// AVX2 variants: same logic on 32-byte blocks, finishing with SSE2 so a
+// 16..31 byte tail still runs vectorized
+
+# define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET inline __m256i inRange32(__m256i x, unsigned char lo, unsigned char hi) {
+    __m256i shifted = _mm256_add_epi8(x, _mm256_set1_epi8(static_cast<char>(0x80 - lo)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(0x80 + (hi - lo) + 1)), shifted);
+}
+
+AVX2_TARGET inline __m256i foldBlock32(__m256i x) {
+    return _mm256_add_epi8(x, _mm256_and_si256(inRange32(x, 'A', '^'), _mm256_set1_epi8(0x20)));
+}
+
+AVX2_TARGET void foldAvx2(char* text, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i* block = reinterpret_cast<__m256i*>(text + i);
+        _mm256_storeu_si256(block, foldBlock32(_mm256_loadu_si256(block)));
+    }
+    foldSse2(text + i, size - i);
+}
+
+AVX2_TARGET void upperAvx2(char* text, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i* block = reinterpret_cast<__m256i*>(text + i);
+        __m256i x = _mm256_loadu_si256(block);
+        _mm256_storeu_si256(block, _mm256_sub_epi8(x, _mm256_and_si256(inRange32(x, 'a', 'z'),
+                                                                      _mm256_set1_epi8(0x20))));
+    }
+    upperSse2(text + i, size - i);
+}
+
+AVX2_TARGET bool equalAvx2(const char* a, const char* b, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = foldBlock32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)));
+        __m256i y = foldBlock32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        if (static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y))) != 0xFFFFFFFFu)
+            return false;
+    }
+    return equalSse2(a + i, b + i, size - i);
+}
+
+AVX2_TARGET size_t nickSpanAvx2(const char* text, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        __m256i ok = _mm256_or_si256(_mm256_or_si256(inRange32(x, 'A', 'Z'), inRange32(x, 'a', 'z')),
+                                     _mm256_or_si256(inRange32(x, '0', '9'),
+                                                     _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')),
+                                                                     _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')))));
+        unsigned bad = ~static_cast<unsigned>(_mm256_movemask_epi8(ok));
+        if (bad)
+            return i + __builtin_ctz(bad);
+    }
+    return i + nickSpanSse2(text + i, size - i);
+}
+
+AVX2_TARGET size_t channelSpanAvx2(const char* text, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        __m256i bad = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                                      _mm256_cmpeq_epi8(x, _mm256_set1_epi8(','))),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(':')),
+                                                      _mm256_cmpeq_epi8(x, _mm256_set1_epi8(7))));
+        unsigned bits = _mm256_movemask_epi8(bad);
+        if (bits)
+            return i + __builtin_ctz(bits);
+    }
+    return i + channelSpanSse2(text + i, size - i);
+}
+
+#endif  // CASEMAPPING_X86
+
+struct Kernels {
+    void        (*fold)(char*, size_t);
+    void        (*upper)(char*, size_t);
+    bool        (*equal)(const char*, const char*, size_t);
+    size_t      (*nick_span)(const char*, size_t);
+    size_t      (*channel_span)(const char*, size_t);
+    const char* name;
+};
+
+// Kernels this CPU can run, fastest first; scalar is always last
+size_t availableKernels(Kernels* out) {
+    size_t count = 0;
+#ifdef CASEMAPPING_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        Kernels avx2 = { foldAvx2, upperAvx2, equalAvx2, nickSpanAvx2, channelSpanAvx2, "avx2" };
+        out[count++] = avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        Kernels sse2 = { foldSse2, upperSse2, equalSse2, nickSpanSse2, channelSpanSse2, "sse2" };
+        out[count++] = sse2;
+    }
+#endif
+    Kernels scalar = { foldScalar, upperScalar, equalScalar, nickSpanScalar, channelSpanScalar, "scalar" };
+    out[count++] = scalar;
+    return count;
+}
+
+const size_t KERNEL_COUNT_MAX = 3;
+
+Kernels selectKernels() {
+    Kernels all[KERNEL_COUNT_MAX];
+    availableKernels(all);
+    return all[0];
+}
+
+Kernels& kernels() {
+    static Kernels selected = selectKernels();
+    return selected;
+}
+
+// Below one vector the table loop wins over the call and setup
+const size_t VECTOR_MIN = 16;
+
+}  // namespace
+
+char CaseMapping::toLower(char c) {
+    return tables().lower[static_cast<unsigned char>(c)];
+}
+
+std::string CaseMapping::fold(const std::string& text) {
+    std::string folded(text);
+    foldInPlace(folded);
+    return folded;
+}
+
+void CaseMapping::foldInPlace(std::string& text) {
+    if (text.empty())
+        return;
+    if (text.size() < VECTOR_MIN)
+        foldScalar(&text[0], text.size());
+    else
+        kernels().fold(&text[0], text.size());
+}
+
+void CaseMapping::upperAsciiInPlace(std::string& text) {
+    if (text.empty())
+        return;
+    if (text.size() < VECTOR_MIN)
+        upperScalar(&text[0], text.size());
+    else
+        kernels().upper(&text[0], text.size());
+}
+
+bool CaseMapping::equals(const std::string& a, const std::string& b) {
+    if (a.size() != b.size())
+        return false;
+    if (a.size() < VECTOR_MIN)
+        return equalScalar(a.data(), b.data(), a.size());
+    return kernels().equal(a.data(), b.data(), a.size());
+}
+
+// Iterative glob match: on mismatch, back up to the last '*' and let it
+// swallow one more character. Linear in practice, no recursion.
+bool CaseMapping::match(const std::string& mask, const std::string& text) {
+    size_t m = 0, t = 0;
+    size_t star = std::string::npos, resume = 0;
+
+    while (t < text.size()) {
+        if (m < mask.size() && (mask[m] == '?' || toLower(mask[m]) == toLower(text[t]))) {
+            ++m;
+            ++t;
+        } else if (m < mask.size() && mask[m] == '*') {
+            star = m++;
+            resume = t;
+        } else if (star != std::string::npos) {
+            m = star + 1;
+            t = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (m < mask.size() && mask[m] == '*')
+        ++m;
+    return m == mask.size();
+}
+
+bool CaseMapping::hasWildcards(const std::string& mask) {
+    return mask.find_first_of("*?") != std::string::npos;
+}
+
+bool CaseMapping::isLetter(char c) {
+    return tables().classes[static_cast<unsigned char>(c)] & CLASS_LETTER;
+}
+
+size_t CaseMapping::spanNickname(const std::string& text, size_t from) {
+    if (from >= text.size())
+        return 0;
+    size_t size = text.size() - from;
+    if (size < VECTOR_MIN)
+        return nickSpanScalar(text.data() + from, size);
+    return kernels().nick_span(text.data() + from, size);
+}
+
+size_t CaseMapping::spanChannelName(const std::string& text, size_t from) {
+    if (from >= text.size())
+        return 0;
+    size_t size = text.size() - from;
+    if (size < VECTOR_MIN)
+        return channelSpanScalar(text.data() + from, size);
+    return kernels().channel_span(text.data() + from, size);
+}
+
+const char* CaseMapping::kernelName() {
+    return kernels().name;
+}
+
+bool CaseMapping::useKernel(const std::string& name) {
+    Kernels all[KERNEL_COUNT_MAX];
+    size_t count = availableKernels(all);
+    for (size_t i = 0; i < count; ++i) {
+        if (name == all[i].name) {
+            kernels() = all[i];
+            return true;
+        }
+    }
+    return false;
+}
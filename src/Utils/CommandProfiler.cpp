@@ -0,0 +1,159 @@
+#include "../../include/CommandProfiler.hpp"
+#include "../../include/Logger.hpp"
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+namespace {
+
+inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+int openEvent(uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;    // Allowed at perf_event_paranoid 2
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+}  // namespace
+
+CommandProfiler::Totals::Totals() : calls(0), cycles(0), max_cycles(0) {
+    std::memset(counters, 0, sizeof(counters));
+}
+
+CommandProfiler::CommandProfiler() : _mode(PROFILE_OFF), _group_fd(-1) {
+    for (int i = 0; i < COUNTER_COUNT - 1; ++i)
+        _member_fds[i] = -1;
+}
+
+CommandProfiler::~CommandProfiler() {
+    closeCounters();
+}
+
+bool CommandProfiler::setMode(Mode mode) {
+    if (mode == PROFILE_COUNTERS && _group_fd == -1 && !openCounters()) {
+        Logger::warning("Hardware counters unavailable (" + std::string(strerror(errno))
+                        + "), profiling cycles only");
+        _mode = PROFILE_CYCLES;
+        return false;
+    }
+    if (mode != PROFILE_COUNTERS)
+        closeCounters();
+    _mode = mode;
+    return true;
+}
+
+CommandProfiler::Mode CommandProfiler::getMode() const {
+    return _mode;
+}
+
+bool CommandProfiler::openCounters() {
+    _group_fd = openEvent(PERF_COUNT_HW_INSTRUCTIONS, -1);
+    if (_group_fd == -1)
+        return false;
+    const uint64_t members[COUNTER_COUNT - 1] = {
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for (int i = 0; i < COUNTER_COUNT - 1; ++i) {
+        _member_fds[i] = openEvent(members[i], _group_fd);
+        if (_member_fds[i] == -1) {
+            int saved = errno;
+            closeCounters();
+            errno = saved;
+            return false;
+        }
+    }
+    ioctl(_group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+void CommandProfiler::closeCounters() {
+    for (int i = 0; i < COUNTER_COUNT - 1; ++i) {
+        if (_member_fds[i] != -1)
+            close(_member_fds[i]);
+        _member_fds[i] = -1;
+    }
+    if (_group_fd != -1)
+        close(_group_fd);
+    _group_fd = -1;
+}
+
+// PERF_FORMAT_GROUP reads as { nr, value[nr] }
+bool CommandProfiler::readCounters(uint64_t* values) const {
+    uint64_t buffer[1 + COUNTER_COUNT];
+    if (read(_group_fd, buffer, sizeof(buffer)) != static_cast<ssize_t>(sizeof(buffer)))
+        return false;
+    std::memcpy(values, buffer + 1, sizeof(uint64_t) * COUNTER_COUNT);
+    return true;
+}
+
+void CommandProfiler::begin(Sample& sample) const {
+    sample.counted = _mode == PROFILE_COUNTERS && readCounters(sample.counters);
+    sample.cycles = readCycles();
+}
+
+void CommandProfiler::end(const Sample& sample, const std::string& command, ClientClass client_class) {
+    uint64_t cycles = readCycles() - sample.cycles;
+    Totals& totals = _table[command].by_class[client_class];
+    ++totals.calls;
+    totals.cycles += cycles;
+    if (cycles > totals.max_cycles)
+        totals.max_cycles = cycles;
+
+    uint64_t counters[COUNTER_COUNT];
+    if (sample.counted && _mode == PROFILE_COUNTERS && readCounters(counters)) {
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+            totals.counters[i] += counters[i] - sample.counters[i];
+    }
+}
+
+void CommandProfiler::reset() {
+    _table.clear();
+}
+
+const CommandProfiler::Table& CommandProfiler::getTable() const {
+    return _table;
+}
+
+const char* CommandProfiler::modeName(Mode mode) {
+    switch (mode) {
+        case PROFILE_CYCLES:
+            return "cycles";
+        case PROFILE_COUNTERS:
+            return "counters";
+        default:
+            return "off";
+    }
+}
+
+const char* CommandProfiler::className(ClientClass client_class) {
+    switch (client_class) {
+        case CLASS_UNREGISTERED:
+            return "unregistered";
+        case CLASS_OPERATOR:
+            return "oper";
+        default:
+            return "user";
+    }
+}
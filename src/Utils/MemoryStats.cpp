@@ -0,0 +1,54 @@
+#include "../../include/MemoryStats.hpp"
+#include <cstdio>
+#include <unistd.h>
+
+MemoryStats::MemoryStats() {
+    for (int i = 0; i < MEM_COUNT; ++i) {
+        bytes[i] = 0;
+        items[i] = 0;
+    }
+}
+
+void MemoryStats::add(Category category, size_t size, size_t count) {
+    bytes[category] += size;
+    items[category] += count;
+}
+
+size_t MemoryStats::total() const {
+    size_t sum = 0;
+    for (int i = 0; i < MEM_COUNT; ++i)
+        sum += bytes[i];
+    return sum;
+}
+
+const char* MemoryStats::name(Category category) {
+    static const char* const names[MEM_COUNT] = {
+        "clients", "input", "sendq", "channels", "members", "bans", "topics",
+        "history", "nick-index", "host-index", "channel-index"
+    };
+    return names[category];
+}
+
+size_t MemoryStats::stringBytes(const std::string& text) {
+#if defined(_GLIBCXX_USE_CXX11_ABI) && _GLIBCXX_USE_CXX11_ABI
+    // Up to 15 characters fit in the object itself
+    return text.capacity() > 15 ? text.capacity() + 1 : 0;
+#else
+    // Reference-counted representation: header in front of the characters
+    return text.empty() ? 0 : text.capacity() + 1 + 3 * sizeof(size_t);
+#endif
+}
+
+// Second field of /proc/self/statm is resident pages
+size_t MemoryStats::residentBytes() {
+    FILE* file = std::fopen("/proc/self/statm", "r");
+    if (!file)
+        return 0;
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    int fields = std::fscanf(file, "%lu %lu", &size, &resident);
+    std::fclose(file);
+    if (fields != 2)
+        return 0;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
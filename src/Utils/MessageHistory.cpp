@@ -0,0 +1,185 @@
+#include "../../include/MessageHistory.hpp"
+#include <sys/time.h>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// Bookkeeping charged per entry on top of the line itself
+const size_t ENTRY_OVERHEAD = sizeof(HistoryRing::Entry) + 32;
+
+uint64_t wallClockMs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+}
+
+// HistoryRing
+
+HistoryRing::HistoryRing(size_t capacity)
+    : _entries(capacity > 0 ? capacity : 1), _start(0), _count(0), _bytes(0) {
+}
+
+size_t HistoryRing::cost(const Entry& entry) {
+    return entry.line.size() + ENTRY_OVERHEAD;
+}
+
+const HistoryRing::Entry& HistoryRing::at(size_t i) const {
+    return _entries[(_start + i) % _entries.size()];
+}
+
+size_t HistoryRing::push(const Entry& entry) {
+    size_t released = 0;
+    if (_count == _entries.size())
+        released = dropOldest();
+
+    _entries[(_start + _count) % _entries.size()] = entry;
+    ++_count;
+    _bytes += cost(entry);
+    return released;
+}
+
+size_t HistoryRing::dropOldest() {
+    if (_count == 0)
+        return 0;
+
+    Entry& oldest = _entries[_start];
+    size_t released = cost(oldest);
+    oldest.line = SharedLine();
+    _start = (_start + 1) % _entries.size();
+    --_count;
+    _bytes -= released;
+    return released;
+}
+
+void HistoryRing::clear() {
+    while (_count > 0)
+        dropOldest();
+}
+
+size_t HistoryRing::size() const {
+    return _count;
+}
+
+bool HistoryRing::empty() const {
+    return _count == 0;
+}
+
+size_t HistoryRing::bytes() const {
+    return _bytes;
+}
+
+size_t HistoryRing::memoryUsage() const {
+    // _bytes already charges each live entry its slot; count every slot once
+    return _entries.capacity() * sizeof(Entry) + _bytes - _count * sizeof(Entry);
+}
+
+void HistoryRing::latest(size_t limit, std::vector<const Entry*>& out) const {
+    size_t first = _count > limit ? _count - limit : 0;
+    for (size_t i = first; i < _count; ++i)
+        out.push_back(&at(i));
+}
+
+void HistoryRing::before(uint64_t msgid, size_t limit, std::vector<const Entry*>& out) const {
+    size_t end = 0;
+    while (end < _count && at(end).msgid < msgid)
+        ++end;
+    size_t first = end > limit ? end - limit : 0;
+    for (size_t i = first; i < end; ++i)
+        out.push_back(&at(i));
+}
+
+void HistoryRing::after(uint64_t msgid, size_t limit, std::vector<const Entry*>& out) const {
+    size_t i = 0;
+    while (i < _count && at(i).msgid <= msgid)
+        ++i;
+    for (; i < _count && out.size() < limit; ++i)
+        out.push_back(&at(i));
+}
+
+// MessageHistory
+
+MessageHistory::MessageHistory(size_t max_bytes)
+    : _max_bytes(max_bytes), _bytes(0), _next_msgid(wallClockMs() << 12) {
+    // Seeding from the clock keeps ids increasing across restarts
+}
+
+void MessageHistory::record(HistoryRing& ring, const SharedLine& line) {
+    HistoryRing::Entry entry;
+    entry.line = line;
+    entry.msgid = _next_msgid++;
+    entry.time_ms = wallClockMs();
+
+    _bytes -= ring.push(entry);
+    _bytes += HistoryRing::cost(entry);
+    touch(ring);
+    enforceBudget();
+}
+
+void MessageHistory::forget(HistoryRing& ring) {
+    _bytes -= ring.bytes();
+    ring.clear();
+    std::map<HistoryRing*, RingList::iterator>::iterator it = _position.find(&ring);
+    if (it != _position.end()) {
+        _lru.erase(it->second);
+        _position.erase(it);
+    }
+}
+
+void MessageHistory::touch(HistoryRing& ring) {
+    std::map<HistoryRing*, RingList::iterator>::iterator it = _position.find(&ring);
+    if (it != _position.end())
+        _lru.splice(_lru.end(), _lru, it->second);
+    else
+        _position[&ring] = _lru.insert(_lru.end(), &ring);
+}
+
+void MessageHistory::enforceBudget() {
+    while (_bytes > _max_bytes && !_lru.empty()) {
+        HistoryRing* ring = _lru.front();
+        _bytes -= ring->dropOldest();
+        if (ring->empty()) {
+            _position.erase(ring);
+            _lru.pop_front();
+        }
+    }
+}
+
+size_t MessageHistory::bytes() const {
+    return _bytes;
+}
+
+size_t MessageHistory::maxBytes() const {
+    return _max_bytes;
+}
+
+std::string MessageHistory::formatTime(uint64_t time_ms) {
+    time_t seconds = static_cast<time_t>(time_ms / 1000);
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+
+    char buffer[32];
+    size_t len = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(buffer + len, sizeof(buffer) - len, ".%03uZ", static_cast<unsigned>(time_ms % 1000));
+    return buffer;
+}
+
+std::string MessageHistory::formatMsgid(uint64_t msgid) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%llx", static_cast<unsigned long long>(msgid));
+    return buffer;
+}
+
+bool MessageHistory::parseMsgid(const std::string& token, uint64_t& msgid) {
+    if (token.empty() || token.size() > 16)
+        return false;
+    char* end = NULL;
+    unsigned long long value = strtoull(token.c_str(), &end, 16);
+    if (*end != '\0')
+        return false;
+    msgid = value;
+    return true;
+}
@@ -0,0 +1,60 @@
+#include "../../include/SharedLine.hpp"
+
+namespace {
+
+const std::string EMPTY_LINE;
+
+}
+
+SharedLine::SharedLine() : _body(NULL) {
+}
+
+SharedLine::SharedLine(const std::string& text) : _body(new Body()) {
+    _body->text = text;
+    _body->refs = 1;
+}
+
+SharedLine::SharedLine(const SharedLine& other) : _body(other._body) {
+    if (_body)
+        ++_body->refs;
+}
+
+SharedLine& SharedLine::operator=(const SharedLine& other) {
+    if (_body != other._body) {
+        release();
+        _body = other._body;
+        if (_body)
+            ++_body->refs;
+    }
+    return *this;
+}
+
+SharedLine::~SharedLine() {
+    release();
+}
+
+void SharedLine::release() {
+    if (_body && --_body->refs == 0)
+        delete _body;
+    _body = NULL;
+}
+
+const std::string& SharedLine::str() const {
+    return _body ? _body->text : EMPTY_LINE;
+}
+
+const char* SharedLine::data() const {
+    return str().data();
+}
+
+size_t SharedLine::size() const {
+    return _body ? _body->text.size() : 0;
+}
+
+bool SharedLine::empty() const {
+    return size() == 0;
+}
+
+size_t SharedLine::refs() const {
+    return _body ? _body->refs : 0;
+}
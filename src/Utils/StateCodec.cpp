@@ -0,0 +1,88 @@
+#include "../../include/StateCodec.hpp"
+#include <cstring>
+#include <stdexcept>
+
+StateWriter::StateWriter() {}
+
+void StateWriter::putU8(uint8_t value) {
+    _buffer += static_cast<char>(value);
+}
+
+void StateWriter::putU32(uint32_t value) {
+    for (int i = 0; i < 4; ++i)
+        _buffer += static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+void StateWriter::putU64(uint64_t value) {
+    for (int i = 0; i < 8; ++i)
+        _buffer += static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+void StateWriter::putString(const std::string& value) {
+    putU32(static_cast<uint32_t>(value.size()));
+    _buffer += value;
+}
+
+void StateWriter::putBytes(const void* data, size_t len) {
+    _buffer.append(static_cast<const char*>(data), len);
+}
+
+const std::string& StateWriter::data() const {
+    return _buffer;
+}
+
+void StateWriter::clear() {
+    _buffer.clear();
+}
+
+StateReader::StateReader(const void* data, size_t size)
+    : _data(static_cast<const unsigned char*>(data)), _size(size), _pos(0) {
+}
+
+void StateReader::require(size_t len) const {
+    if (len > _size - _pos)
+        throw std::runtime_error("truncated state record");
+}
+
+uint8_t StateReader::getU8() {
+    require(1);
+    return _data[_pos++];
+}
+
+uint32_t StateReader::getU32() {
+    require(4);
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i)
+        value |= static_cast<uint32_t>(_data[_pos++]) << (8 * i);
+    return value;
+}
+
+uint64_t StateReader::getU64() {
+    require(8);
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i)
+        value |= static_cast<uint64_t>(_data[_pos++]) << (8 * i);
+    return value;
+}
+
+std::string StateReader::getString() {
+    uint32_t len = getU32();
+    require(len);
+    std::string value(reinterpret_cast<const char*>(_data + _pos), len);
+    _pos += len;
+    return value;
+}
+
+void StateReader::getBytes(void* out, size_t len) {
+    require(len);
+    std::memcpy(out, _data + _pos, len);
+    _pos += len;
+}
+
+bool StateReader::atEnd() const {
+    return _pos == _size;
+}
+
+size_t StateReader::position() const {
+    return _pos;
+}
@@ -0,0 +1,300 @@
+#include "../../include/TextFilter.hpp"
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define TEXTFILTER_X86 1
+# include <immintrin.h>
+#endif
+
+namespace {
+
+inline bool isControl(unsigned char c) {
+    return c == 0 || c == 7 || c == '\r';
+}
+
+bool controlsScalar(const unsigned char* text, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (isControl(text[i]))
+            return true;
+    }
+    return false;
+}
+
+bool utf8Scalar(const unsigned char* text, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        if (size - i >= 8) {
+            uint64_t word;
+            std::memcpy(&word, text + i, sizeof(word));
+            if (!(word & 0x8080808080808080ULL)) {
+                i += 8;
+                continue;
+            }
+        }
+
+        unsigned char lead = text[i];
+        if (lead < 0x80) {
+            ++i;
+            continue;
+        }
+
+        // Second byte bounds exclude overlongs, surrogates and > U+10FFFF
+        size_t length;
+        unsigned char low = 0x80, high = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            length = 2;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            length = 3;
+            if (lead == 0xE0)
+                low = 0xA0;
+            else if (lead == 0xED)
+                high = 0x9F;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            length = 4;
+            if (lead == 0xF0)
+                low = 0x90;
+            else if (lead == 0xF4)
+                high = 0x8F;
+        } else {
+            return false;
+        }
+
+        if (size - i < length || text[i + 1] < low || text[i + 1] > high)
+            return false;
+        for (size_t k = 2; k < length; ++k) {
+            if ((text[i + k] & 0xC0) != 0x80)
+                return false;
+        }
+        i += length;
+    }
+    return true;
+}
+
+TextFilter::Scan scanScalar(const unsigned char* text, size_t size) {
+    TextFilter::Scan result;
+    result.utf8 = utf8Scalar(text, size);
+    result.controls = controlsScalar(text, size);
+    return result;
+}
+
+#ifdef TEXTFILTER_X86
+
+# define AVX2_TARGET __attribute__((target("avx2")))
+
+// Error classes for a pair of adjacent bytes, looked up from the high and
+// low nibble of the first byte and the high nibble of the second; a pair
+// is invalid when all three lookups share a bit
+enum {
+    TOO_SHORT = 1 << 0,     // Lead byte not followed by a continuation
+    TOO_LONG = 1 << 1,      // ASCII followed by a continuation
+    OVERLONG_3 = 1 << 2,
+    TOO_LARGE = 1 << 3,
+    SURROGATE = 1 << 4,
+    OVERLONG_2 = 1 << 5,
+    TOO_LARGE_1000 = 1 << 6,
+    OVERLONG_4 = 1 << 6,
+    TWO_CONTS = 1 << 7,     // Continuation after continuation; fine for 3/4 byte forms
+    CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS
+};
+
+# define TABLE16(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) \
+    static_cast<char>(a), static_cast<char>(b), static_cast<char>(c), static_cast<char>(d), \
+    static_cast<char>(e), static_cast<char>(f), static_cast<char>(g), static_cast<char>(h), \
+    static_cast<char>(i), static_cast<char>(j), static_cast<char>(k), static_cast<char>(l), \
+    static_cast<char>(m), static_cast<char>(n), static_cast<char>(o), static_cast<char>(p)
+
+# define BYTE_1_HIGH TABLE16( \
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+    TOO_SHORT | OVERLONG_2, \
+    TOO_SHORT, \
+    TOO_SHORT | OVERLONG_3 | SURROGATE, \
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4)
+
+# define BYTE_1_LOW TABLE16( \
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+    CARRY | OVERLONG_2, \
+    CARRY, \
+    CARRY, \
+    CARRY | TOO_LARGE, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000)
+
+# define BYTE_2_HIGH TABLE16( \
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT)
+
+struct Utf8State {
+    __m256i error;
+    __m256i previous;       // Last block, for pairs that straddle blocks
+    __m256i incomplete;     // Nonzero when the last block ended mid-sequence
+};
+
+AVX2_TARGET inline __m256i highNibbles(__m256i x) {
+    return _mm256_and_si256(_mm256_srli_epi16(x, 4), _mm256_set1_epi8(0x0F));
+}
+
+AVX2_TARGET inline void checkBlock(Utf8State& state, __m256i input) {
+    if (_mm256_movemask_epi8(input) == 0) {
+        // All ASCII: only an unfinished sequence from before can be wrong
+        state.error = _mm256_or_si256(state.error, state.incomplete);
+        state.previous = input;
+        return;
+    }
+
+    // Bytes 1, 2 and 3 positions back, pulling in the previous block
+    __m256i carried = _mm256_permute2x128_si256(state.previous, input, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(input, carried, 15);
+    __m256i prev2 = _mm256_alignr_epi8(input, carried, 14);
+    __m256i prev3 = _mm256_alignr_epi8(input, carried, 13);
+
+    const __m256i byte_1_high = _mm256_setr_epi8(BYTE_1_HIGH, BYTE_1_HIGH);
+    const __m256i byte_1_low = _mm256_setr_epi8(BYTE_1_LOW, BYTE_1_LOW);
+    const __m256i byte_2_high = _mm256_setr_epi8(BYTE_2_HIGH, BYTE_2_HIGH);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, highNibbles(prev1)),
+                         _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+        _mm256_shuffle_epi8(byte_2_high, highNibbles(input)));
+
+    // Third and fourth bytes of 3/4 byte forms must be continuations; that
+    // is exactly where TWO_CONTS is expected, so XOR cancels it there
+    __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+    __m256i expected = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+    state.error = _mm256_or_si256(state.error, _mm256_xor_si256(expected, special));
+
+    // A lead byte in the last 1-3 positions needs the next block
+    const __m256i last_ok = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+    state.incomplete = _mm256_subs_epu8(input, last_ok);
+    state.previous = input;
+}
+
+AVX2_TARGET inline __m256i controlMask(__m256i input) {
+    return _mm256_or_si256(_mm256_cmpeq_epi8(input, _mm256_setzero_si256()),
+                           _mm256_or_si256(_mm256_cmpeq_epi8(input, _mm256_set1_epi8(7)),
+                                           _mm256_cmpeq_epi8(input, _mm256_set1_epi8('\r'))));
+}
+
+AVX2_TARGET TextFilter::Scan scanAvx2(const unsigned char* text, size_t size) {
+    Utf8State state;
+    state.error = _mm256_setzero_si256();
+    state.previous = _mm256_setzero_si256();
+    state.incomplete = _mm256_setzero_si256();
+    __m256i controls = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        controls = _mm256_or_si256(controls, controlMask(input));
+        checkBlock(state, input);
+    }
+
+    TextFilter::Scan result;
+    result.controls = false;
+    if (i < size) {
+        // Zero padding reads as ASCII, so a truncated sequence still fails
+        unsigned char tail[32] = {0};
+        std::memcpy(tail, text + i, size - i);
+        result.controls = controlsScalar(text + i, size - i);
+        checkBlock(state, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail)));
+    }
+    state.error = _mm256_or_si256(state.error, state.incomplete);
+
+    result.utf8 = _mm256_testz_si256(state.error, state.error) != 0;
+    result.controls = result.controls || _mm256_movemask_epi8(controls) != 0;
+    return result;
+}
+
+#endif  // TEXTFILTER_X86
+
+struct Kernel {
+    TextFilter::Scan    (*scan)(const unsigned char*, size_t);
+    const char*         name;
+};
+
+// Kernels this CPU can run, fastest first; scalar is always last
+size_t availableKernels(Kernel* out) {
+    size_t count = 0;
+#ifdef TEXTFILTER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        Kernel avx2 = { scanAvx2, "avx2" };
+        out[count++] = avx2;
+    }
+#endif
+    Kernel scalar = { scanScalar, "scalar" };
+    out[count++] = scalar;
+    return count;
+}
+
+const size_t KERNEL_COUNT_MAX = 2;
+
+Kernel selectKernel() {
+    Kernel all[KERNEL_COUNT_MAX];
+    availableKernels(all);
+    return all[0];
+}
+
+Kernel& kernel() {
+    static Kernel selected = selectKernel();
+    return selected;
+}
+
+// Below one block the scalar loops finish before the vector setup would
+const size_t VECTOR_MIN = 32;
+
+}  // namespace
+
+TextFilter::Scan TextFilter::scan(const std::string& text) {
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(text.data());
+    if (text.size() < VECTOR_MIN)
+        return scanScalar(data, text.size());
+    return kernel().scan(data, text.size());
+}
+
+bool TextFilter::isUtf8(const std::string& text) {
+    return scan(text).utf8;
+}
+
+std::string TextFilter::scrub(const std::string& text) {
+    std::string clean;
+    clean.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (!isControl(static_cast<unsigned char>(text[i])))
+            clean += text[i];
+    }
+    return clean;
+}
+
+const char* TextFilter::kernelName() {
+    return kernel().name;
+}
+
+bool TextFilter::useKernel(const std::string& name) {
+    Kernel all[KERNEL_COUNT_MAX];
+    size_t count = availableKernels(all);
+    for (size_t i = 0; i < count; ++i) {
+        if (name == all[i].name) {
+            kernel() = all[i];
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,149 @@
+#include "../../include/TimerWheel.hpp"
+#include <ctime>
+
+TimerWheel::TimerWheel() : _tick(monotonicMs() / TICK_MS), _count(0) {
+    for (unsigned level = 0; level < LEVELS; ++level) {
+        for (unsigned i = 0; i < SLOTS; ++i) {
+            _slots[level][i].prev = &_slots[level][i];
+            _slots[level][i].next = &_slots[level][i];
+        }
+    }
+    _expired.prev = &_expired;
+    _expired.next = &_expired;
+}
+
+TimerWheel::~TimerWheel() {
+    // Detach any remaining timers so their owners see them as disarmed
+    for (unsigned level = 0; level < LEVELS; ++level) {
+        for (unsigned i = 0; i < SLOTS; ++i) {
+            while (_slots[level][i].next != &_slots[level][i])
+                unlink(_slots[level][i].next);
+        }
+    }
+    while (_expired.next != &_expired)
+        unlink(_expired.next);
+}
+
+uint64_t TimerWheel::monotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void TimerWheel::link(Timer* head, Timer* timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+void TimerWheel::unlink(Timer* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+void TimerWheel::place(Timer* timer) {
+    if (timer->expires < _tick)
+        timer->expires = _tick;
+
+    uint64_t delta = timer->expires - _tick;
+    unsigned level = 0;
+    while (level < LEVELS - 1 && delta >= (static_cast<uint64_t>(1) << (SLOT_BITS * (level + 1))))
+        ++level;
+
+    // Clamp anything beyond the wheel's horizon to the last slot it can reach
+    uint64_t horizon = static_cast<uint64_t>(1) << (SLOT_BITS * LEVELS);
+    if (delta >= horizon)
+        timer->expires = _tick + horizon - 1;
+
+    unsigned index = (timer->expires >> (SLOT_BITS * level)) & SLOT_MASK;
+    link(&_slots[level][index], timer);
+}
+
+void TimerWheel::arm(Timer* timer, uint64_t delay_ms) {
+    if (timer->isArmed())
+        cancel(timer);
+    uint64_t now = monotonicMs();
+    timer->expires = (now + delay_ms + TICK_MS - 1) / TICK_MS;
+    place(timer);
+    ++_count;
+}
+
+void TimerWheel::cancel(Timer* timer) {
+    if (!timer->isArmed())
+        return;
+    unlink(timer);
+    --_count;
+}
+
+void TimerWheel::cascade(unsigned level, unsigned index) {
+    Timer* head = &_slots[level][index];
+    while (head->next != head) {
+        Timer* timer = head->next;
+        unlink(timer);
+        place(timer);
+    }
+}
+
+void TimerWheel::advance(uint64_t now_ms) {
+    uint64_t now_tick = now_ms / TICK_MS;
+
+    while (_tick <= now_tick) {
+        if (_count == 0) {
+            // Nothing armed: jump straight to the present
+            _tick = now_tick + 1;
+            break;
+        }
+
+        unsigned index = _tick & SLOT_MASK;
+        for (unsigned level = 1; index == 0 && level < LEVELS; ++level) {
+            index = (_tick >> (SLOT_BITS * level)) & SLOT_MASK;
+            cascade(level, index);
+        }
+
+        Timer* head = &_slots[0][_tick & SLOT_MASK];
+        while (head->next != head) {
+            Timer* timer = head->next;
+            unlink(timer);
+            link(&_expired, timer);
+        }
+        ++_tick;
+    }
+}
+
+Timer* TimerWheel::popExpired() {
+    if (_expired.next == &_expired)
+        return NULL;
+    Timer* timer = _expired.next;
+    unlink(timer);
+    --_count;
+    return timer;
+}
+
+int TimerWheel::msUntilNext(uint64_t now_ms) const {
+    if (_expired.next != &_expired)
+        return 0;
+    if (_count == 0)
+        return -1;
+
+    // Nearest populated level-0 slot, or the next cascade point
+    uint64_t due = _tick + (SLOTS - (_tick & SLOT_MASK));
+    for (unsigned offset = 0; offset < SLOTS; ++offset) {
+        const Timer* head = &_slots[0][(_tick + offset) & SLOT_MASK];
+        if (head->next != head) {
+            due = _tick + offset;
+            break;
+        }
+    }
+
+    uint64_t due_ms = due * TICK_MS;
+    if (due_ms <= now_ms)
+        return 0;
+    return static_cast<int>(due_ms - now_ms);
+}
+
+size_t TimerWheel::size() const {
+    return _count;
+}
@@ -1,47 +1,212 @@
 #include "../include/common.hpp"
 #include "../include/Server.hpp"
 #include "../include/Logger.hpp"
+#include "../include/TextFilter.hpp"
+#include <climits>
 
 void signal_handler(int signum) {
     (void)signum;
-    Logger::info("Shutting down server...");
-    
-    // Get server instance and stop it
-    if (Server::getInstance()) {
-        Server::getInstance()->stop();
+    // Server::run returns at its next turn; the server stops as it goes out of scope
+    Server::requestShutdown();
+}
+
+void upgrade_handler(int signum) {
+    (void)signum;
+    // Picked up by Server::run between poll iterations
+    Server::requestUpgrade();
+}
+
+void reload_handler(int signum) {
+    (void)signum;
+    // Config file is read again by Server::run before its next turn
+    Server::requestReload();
+}
+
+// Path of the running binary, re-executed on upgrade so a freshly
+// installed build takes over the live connections
+static std::string executablePath() {
+    char path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len <= 0)
+        return "";
+    return std::string(path, len);
+}
+
+static bool parsePort(const std::string& value, int& port) {
+    port = std::atoi(value.c_str());
+    return port > 0 && port <= 65535;
+}
+
+// utf8only, scrub, or both comma separated
+static bool parseTextPolicy(const std::string& value, int& policy) {
+    policy = 0;
+    std::string::size_type start = 0;
+    while (start <= value.size()) {
+        std::string::size_type comma = value.find(',', start);
+        std::string name = value.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        if (name == "utf8only")
+            policy |= TEXT_UTF8ONLY;
+        else if (name == "scrub")
+            policy |= TEXT_SCRUB;
+        else
+            return false;
+        if (comma == std::string::npos)
+            break;
+        start = comma + 1;
     }
-    
-    exit(0);
+    return true;
+}
+
+static bool parseProfileMode(const std::string& value, CommandProfiler::Mode& mode) {
+    if (value == "off")
+        mode = CommandProfiler::PROFILE_OFF;
+    else if (value == "cycles")
+        mode = CommandProfiler::PROFILE_CYCLES;
+    else if (value == "counters")
+        mode = CommandProfiler::PROFILE_COUNTERS;
+    else
+        return false;
+    return true;
+}
+
+// Optional flags after <port> <password>:
+//   --config <file>         limits and listeners, read again on SIGHUP;
+//                           the other flags here take precedence at startup
+//   --name <server>         name announced to peers (default ft_irc)
+//   --link-port <port>      accept server links on this port
+//   --link <host>:<port>    connect to a peer at startup (repeatable)
+//   --link-password <pass>  sent to peers; defaults to <password> unless
+//                           that is a crypt hash, which never goes out
+//   --link-accept <pass>    what peers must send, plain or a crypt hash
+//                           (default: the link password)
+//   --text-policy <list>    utf8only and/or scrub for all message text
+//   --oper <name>:<pass>    credentials accepted by OPER (repeatable)
+//   --profile <mode>        per-command cost accounting: off, cycles, counters
+//   --fanout-threads <n>    sender threads for very large channels (0: off)
+//   --fanout-threshold <n>  local members before a channel uses them
+static bool parseOptions(Server& server, ServerConfig& config, int argc, char* argv[]) {
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (std::string(argv[i]) != "--config")
+            continue;
+        if (!config.load(argv[i + 1]))
+            return false;
+        server.setConfigPath(argv[i + 1]);
+    }
+
+    for (int i = 3; i < argc; i += 2) {
+        std::string option = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        std::string value = argv[i + 1];
+        int port;
+        if (option == "--config") {
+            continue;
+        } else if (option == "--name") {
+            server.setHostname(value);
+        } else if (option == "--link-port") {
+            if (!parsePort(value, port))
+                return false;
+            config.link_port = port;
+        } else if (option == "--link") {
+            std::string::size_type colon = value.rfind(':');
+            if (colon == std::string::npos || !parsePort(value.substr(colon + 1), port))
+                return false;
+            server.getLinks().addTarget(value.substr(0, colon), port);
+        } else if (option == "--link-password") {
+            server.getLinks().setPassword(value);
+        } else if (option == "--link-accept") {
+            server.getLinks().setAcceptPassword(value);
+        } else if (option == "--text-policy") {
+            int policy;
+            if (!parseTextPolicy(value, policy))
+                return false;
+            server.setTextPolicy(policy);
+        } else if (option == "--oper") {
+            std::string::size_type colon = value.find(':');
+            if (colon == std::string::npos || colon == 0)
+                return false;
+            server.addOper(value.substr(0, colon), value.substr(colon + 1));
+        } else if (option == "--profile") {
+            CommandProfiler::Mode mode;
+            if (!parseProfileMode(value, mode))
+                return false;
+            server.getProfiler().setMode(mode);
+        } else if (option == "--fanout-threads" || option == "--fanout-threshold") {
+            char* end;
+            long count = std::strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end || count < 0 || (option == "--fanout-threads" && count > FANOUT_MAX_THREADS))
+                return false;
+            if (option == "--fanout-threads")
+                config.fanout_threads = count;
+            else
+                config.fanout_threshold = count;
+        } else {
+            return false;
+        }
+    }
+    return true;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <port> <password>" << std::endl;
+    // Offline maintenance; refused while a server has the files open
+    if (argc == 2 && std::string(argv[1]) == "--compact-accounts")
+        return AccountStore::compact(ACCOUNT_STORE_PATH) ? 0 : 1;
+
+    bool resuming = argc == 3 && std::string(argv[1]) == "--resume";
+    if (argc < 3 || (argc - 3) % 2 != 0) {
+        std::cerr << "Usage: " << argv[0] << " <port> <password> [--config <file>] [--name <server>]"
+                  << " [--link-port <port>] [--link <host>:<port>]..."
+                  << " [--link-password <password>] [--link-accept <password>]"
+                  << " [--text-policy utf8only,scrub] [--oper <name>:<password>]..."
+                  << " [--profile off|cycles|counters]"
+                  << " [--fanout-threads <n>] [--fanout-threshold <members>]" << std::endl
+                  << "       " << argv[0] << " --compact-accounts" << std::endl;
         return 1;
     }
 
     // Set up signal handling
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGUSR2, upgrade_handler);
+    signal(SIGHUP, reload_handler);
+    signal(SIGPIPE, SIG_IGN);
 
     try {
-        int port = std::atoi(argv[1]);
-        if (port <= 0 || port > 65535) {
+        int port = 0;
+        if (!resuming && !parsePort(argv[1], port)) {
             Logger::error("Invalid port number");
             return 1;
         }
 
-        Server server(port, argv[2]);
+        Server server(port, resuming ? "" : argv[2]);
         Server::setInstance(&server);  // Set the static instance
-        
-        if (!server.start()) {
-            Logger::error("Failed to start server");
-            return 1;
+        server.setExecutable(executablePath());
+
+        if (resuming) {
+            if (!server.resume(std::atoi(argv[2]))) {
+                Logger::error("Failed to resume server");
+                return 1;
+            }
+        } else {
+            ServerConfig config = server.getConfig();
+            if (!parseOptions(server, config, argc, argv)) {
+                Logger::error("Invalid options");
+                return 1;
+            }
+            if (server.getLinks().getPassword().empty() && !CredentialPool::isHashed(argv[2]))
+                server.getLinks().setPassword(argv[2]);
+            config.port = port;
+            server.configure(config);
+            if (!server.start()) {
+                Logger::error("Failed to start server");
+                return 1;
+            }
+            server.getLinks().connectAll();
+            Logger::info("Server started on port " + std::string(argv[1]));
         }
 
-        Logger::info("Server started on port " + std::string(argv[1]));
         server.run();
-        
+
         // Clear the instance pointer before exiting
         Server::setInstance(NULL);
     }
@@ -52,4 +217,4 @@ int main(int argc, char *argv[]) {
     }
 
     return 0;
-} 
\ No newline at end of file
+}
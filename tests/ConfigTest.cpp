@@ -0,0 +1,149 @@
+#include "../include/ServerConfig.hpp"
+#include "../include/Logger.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+// Feeds ServerConfig::load small files and checks what it kept. Every
+// rejected file must leave the config exactly as it was.
+//
+//   make test
+
+namespace {
+
+size_t g_failures = 0;
+
+void expect(bool ok, const std::string& what) {
+    if (ok)
+        return;
+    std::cerr << "FAIL: " << what << std::endl;
+    ++g_failures;
+}
+
+// Writes text to a scratch file and loads it into config
+bool loadText(ServerConfig& config, const std::string& text) {
+    char path[] = "/tmp/config_test.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "Cannot create a scratch file" << std::endl;
+        std::exit(1);
+    }
+    close(fd);
+    {
+        std::ofstream file(path);
+        file << text;
+    }
+    bool loaded = config.load(path);
+    std::remove(path);
+    return loaded;
+}
+
+// Loads text into a default config and expects it rejected, unchanged
+void expectRejected(const std::string& text, const std::string& what) {
+    ServerConfig config;
+    config.port = 6667;
+    ServerConfig before = config;
+    expect(!loadText(config, text), what + ": accepted");
+    expect(config.changedKeys(before).empty(), what + ": changed " + config.changedKeys(before));
+}
+
+void testCommentsAndWhitespace() {
+    ServerConfig config;
+    ServerConfig before = config;
+    bool loaded = loadText(config,
+        "# full line comment\n"
+        "\n"
+        "   \t \n"
+        "port=7000\n"
+        "  nick_length   =\t12  # trailing comment\n"
+        "\tmax_targets = 8\r\n"
+        "#ping_interval = 1000\n");
+    expect(loaded, "comments and whitespace: rejected");
+    expect(config.port == 7000, "port = 7000 not applied");
+    expect(config.nick_length == 12, "nick_length with padding and comment not applied");
+    expect(config.max_targets == 8, "max_targets with CRLF not applied");
+    expect(config.ping_interval == before.ping_interval, "commented out ping_interval applied");
+    expect(config.changedKeys(before) == "port, nick_length, max_targets",
+           "changedKeys gave '" + config.changedKeys(before) + "'");
+    expect(config.changedKeys(config).empty(), "changedKeys of itself is not empty");
+
+    ServerConfig empty;
+    expect(loadText(empty, "# nothing here\n\n"), "file with only comments rejected");
+    expect(empty.changedKeys(ServerConfig()).empty(), "file with only comments changed something");
+}
+
+void testRanges() {
+    ServerConfig config;
+    expect(loadText(config, "nick_length = 64\nchannel_length = 2\nlink_port = 0\n"),
+           "values on the range bounds rejected");
+    expect(config.nick_length == 64 && config.channel_length == 2, "bound values not applied");
+
+    expectRejected("nick_length = 65\n", "nick_length above its maximum");
+    expectRejected("channel_length = 1\n", "channel_length below its minimum");
+    expectRejected("port = 0\n", "port 0");
+    expectRejected("port = 99999999999\n", "eleven digit value");
+    expectRejected("port = -1\n", "negative value");
+    expectRejected("port = 70 00\n", "value with a space inside");
+    expectRejected("port =\n", "empty value");
+    expectRejected("port\n", "key without '='");
+}
+
+void testUnknownKey() {
+    expectRejected("prot = 7000\n", "misspelt key");
+    expectRejected("Port = 7000\n", "key in the wrong case");
+    expectRejected("= 7000\n", "missing key");
+}
+
+void testBadLineMidway() {
+    expectRejected("port = 7000\nnick_length = abc\nmax_targets = 8\n", "bad value on line 2");
+    expectRejected("port = 7000\nmax_targets = 8\nno_such_key = 1\n", "unknown key on the last line");
+}
+
+void testLogLevel() {
+    const char* const names[] = { "debug", "info", "warning", "error" };
+    const Logger::Level levels[] = { Logger::DEBUG, Logger::INFO, Logger::WARNING, Logger::ERROR };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        ServerConfig config;
+        expect(loadText(config, std::string("log_level = ") + names[i] + "\n"),
+               std::string("log_level ") + names[i] + " rejected");
+        expect(config.log_level == static_cast<size_t>(levels[i]),
+               std::string("log_level ") + names[i] + " gave the wrong level");
+    }
+    expectRejected("log_level = 1\n", "numeric log_level");
+    expectRejected("log_level = WARNING\n", "log_level in upper case");
+    expectRejected("log_level = verbose\n", "unknown log_level name");
+}
+
+void testMissingFile() {
+    ServerConfig config;
+    ServerConfig before = config;
+    expect(!config.load("/nonexistent/ircserv.conf"), "missing file accepted");
+    expect(config.changedKeys(before).empty(), "missing file changed the config");
+}
+
+}  // namespace
+
+int main() {
+    // The rejected files log their reason to stdout; only failures should show
+    std::ostringstream logged;
+    std::streambuf* out = std::cout.rdbuf(logged.rdbuf());
+
+    testCommentsAndWhitespace();
+    testRanges();
+    testUnknownKey();
+    testBadLineMidway();
+    testLogLevel();
+    testMissingFile();
+    std::cout.rdbuf(out);
+
+    if (g_failures) {
+        std::cout << "ServerConfig: " << g_failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "ServerConfig: all checks passed" << std::endl;
+    return 0;
+}
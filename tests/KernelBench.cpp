@@ -0,0 +1,150 @@
+#include "../include/CaseMapping.hpp"
+#include "../include/TextFilter.hpp"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <time.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+// Throughput of each kernel the CPU supports on inputs from nickname to
+// long message size. Built with -O2 regardless of CXXFLAGS: make bench
+//
+// Cycles are TSC ticks (nanoseconds off x86), so bytes/cycle is against
+// the nominal clock, not the boosted one.
+
+namespace {
+
+const char* const KERNELS[] = { "avx2", "sse2", "scalar" };
+const size_t SIZES[] = { 9, 16, 31, 64, 512, 4096 };
+const uint64_t MIN_RUN_NS = 20000000;
+
+std::string g_text;
+std::string g_other;
+volatile size_t g_sink;
+
+uint64_t nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return nowNs();
+#endif
+}
+
+// Valid nickname characters, so the spans run to the end
+void nickInput(size_t size) {
+    g_text.assign(size, 'N');
+    for (size_t i = 0; i < g_text.size(); i += 3)
+        g_text[i] = 'a' + i % 26;
+    g_other = CaseMapping::fold(g_text);
+}
+
+void asciiInput(size_t size) {
+    g_text.assign(size, ' ');
+    for (size_t i = 0; i < g_text.size(); ++i)
+        g_text[i] = ' ' + i * 7 % 95;
+}
+
+// Mostly 2 and 3 byte sequences, so every block takes the full check
+void utf8Input(size_t size) {
+    static const char SAMPLE[] = "h\xC3\xA9llo w\xC3\xB6rld \xE2\x82\xAC\xE6\x97\xA5\xF0\x9F\x98\x80 ";
+    g_text.clear();
+    while (g_text.size() < size)
+        g_text += SAMPLE;
+    g_text.resize(size);
+}
+
+void foldOp() {
+    CaseMapping::foldInPlace(g_other);
+    g_sink = g_other[0];
+}
+
+void equalsOp() {
+    g_sink = CaseMapping::equals(g_text, g_other);
+}
+
+void nickSpanOp() {
+    g_sink = CaseMapping::spanNickname(g_text, 0);
+}
+
+void channelSpanOp() {
+    g_sink = CaseMapping::spanChannelName(g_text, 0);
+}
+
+void scanOp() {
+    TextFilter::Scan scan = TextFilter::scan(g_text);
+    g_sink = scan.utf8 + scan.controls;
+}
+
+struct Benchmark {
+    const char* name;
+    bool        (*use)(const std::string&);
+    void        (*input)(size_t);
+    void        (*run)();
+};
+
+struct Timing {
+    double  ns;
+    double  cycles;
+};
+
+// Doubles the iteration count until one timed run is long enough
+Timing perCall(void (*run)()) {
+    for (uint64_t iterations = 1024;; iterations *= 2) {
+        uint64_t start = nowNs();
+        uint64_t start_cycles = readCycles();
+        for (uint64_t i = 0; i < iterations; ++i)
+            run();
+        uint64_t cycles = readCycles() - start_cycles;
+        uint64_t elapsed = nowNs() - start;
+        if (elapsed >= MIN_RUN_NS) {
+            Timing timing;
+            timing.ns = static_cast<double>(elapsed) / iterations;
+            timing.cycles = static_cast<double>(cycles) / iterations;
+            return timing;
+        }
+    }
+}
+
+void report(const char* kernel, const Benchmark& bench, size_t size) {
+    Timing timing = perCall(bench.run);
+    std::cout << std::left << std::setw(8) << kernel << std::setw(14) << bench.name
+              << std::right << std::setw(6) << size
+              << std::fixed << std::setprecision(1) << std::setw(10) << timing.ns << " ns"
+              << std::setprecision(2) << std::setw(9) << size / timing.ns << " GB/s"
+              << std::setw(9) << size / timing.cycles << " B/cycle" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+    const Benchmark benches[] = {
+        { "fold", CaseMapping::useKernel, nickInput, foldOp },
+        { "equals", CaseMapping::useKernel, nickInput, equalsOp },
+        { "nick span", CaseMapping::useKernel, nickInput, nickSpanOp },
+        { "channel span", CaseMapping::useKernel, nickInput, channelSpanOp },
+        { "scan ascii", TextFilter::useKernel, asciiInput, scanOp },
+        { "scan utf8", TextFilter::useKernel, utf8Input, scanOp }
+    };
+
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); ++b) {
+        for (size_t k = 0; k < sizeof(KERNELS) / sizeof(KERNELS[0]); ++k) {
+            if (!benches[b].use(KERNELS[k]))
+                continue;
+            for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); ++s) {
+                benches[b].input(SIZES[s]);
+                report(KERNELS[k], benches[b], SIZES[s]);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+#include "../include/CaseMapping.hpp"
+#include "../include/TextFilter.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+
+// Runs the same inputs through every vector kernel the CPU supports and
+// through the scalar reference, and fails on the first difference.
+//
+//   make test                 fixed seed
+//   ./kernel_test <seed>      another one
+
+namespace {
+
+const char* const VECTOR_KERNELS[] = { "avx2", "sse2" };
+const size_t LENGTH_MAX = 64;
+const size_t RANDOM_CASES = 20000;
+
+uint64_t g_state;
+
+uint32_t next() {
+    g_state ^= g_state << 13;
+    g_state ^= g_state >> 7;
+    g_state ^= g_state << 17;
+    return static_cast<uint32_t>(g_state >> 11);
+}
+
+// Bytes that sit on a class or case boundary
+const unsigned char EDGES[] = {
+    0, 7, '\r', ' ', ',', ':', '-', '_', '0', '9', '@', 'A', 'Z', '[', '\\', ']', '^',
+    '`', 'a', 'z', '{', '|', '}', '~', 0x7F, 0x80, 0xBF, 0xC0, 0xC1, 0xC2, 0xDF, 0xE0,
+    0xED, 0xEF, 0xF0, 0xF4, 0xF5, 0xFF
+};
+
+std::string randomBytes(size_t length) {
+    std::string text(length, '\0');
+    for (size_t i = 0; i < length; ++i) {
+        switch (next() % 4) {
+        case 0:  text[i] = static_cast<char>(next()); break;
+        case 1:  text[i] = static_cast<char>(EDGES[next() % sizeof(EDGES)]); break;
+        default: text[i] = static_cast<char>('A' + next() % 58); break;
+        }
+    }
+    return text;
+}
+
+void appendCodePoint(std::string& text, uint32_t cp) {
+    if (cp < 0x80) {
+        text += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        text += static_cast<char>(0xC0 | (cp >> 6));
+        text += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        text += static_cast<char>(0xE0 | (cp >> 12));
+        text += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        text += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        text += static_cast<char>(0xF0 | (cp >> 18));
+        text += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        text += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        text += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// Valid UTF-8, then often broken in one place
+std::string randomUtf8(size_t length) {
+    static const uint32_t LIMITS[] = { 0x80, 0x800, 0x10000, 0x110000 };
+    std::string text;
+    while (text.size() < length) {
+        uint32_t cp = next() % LIMITS[next() % 4];
+        if (cp >= 0xD800 && cp <= 0xDFFF)
+            cp -= 0x800;
+        appendCodePoint(text, cp);
+    }
+    text.resize(length);  // May cut the last sequence short
+
+    if (!text.empty() && next() % 2) {
+        static const unsigned char BAD[] = { 0x80, 0xC0, 0xC1, 0xE0, 0xED, 0xF4, 0xF5, 0xFF, 0 };
+        size_t at = next() % text.size();
+        text[at] = static_cast<char>(BAD[next() % sizeof(BAD)]);
+        if (at + 1 < text.size() && next() % 2)
+            text[at + 1] = static_cast<char>(0xA0 + next() % 0x20);  // Surrogates, overlongs
+    }
+    return text;
+}
+
+std::string hex(const std::string& text) {
+    static const char DIGITS[] = "0123456789abcdef";
+    std::string out;
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        out += DIGITS[c >> 4];
+        out += DIGITS[c & 15];
+    }
+    return out;
+}
+
+// One line per result so a mismatch shows which call differed
+std::string caseMappingResults(const std::string& text, const std::string& other) {
+    std::ostringstream out;
+    std::string upper(text);
+    CaseMapping::upperAsciiInPlace(upper);
+    out << "fold " << hex(CaseMapping::fold(text)) << "\n"
+        << "upper " << hex(upper) << "\n"
+        << "equals " << CaseMapping::equals(text, other) << "\n";
+    for (size_t from = 0; from <= text.size() && from < 8; ++from) {
+        out << "span@" << from << " " << CaseMapping::spanNickname(text, from)
+            << " " << CaseMapping::spanChannelName(text, from) << "\n";
+    }
+    return out.str();
+}
+
+std::string textFilterResults(const std::string& text, const std::string&) {
+    TextFilter::Scan scan = TextFilter::scan(text);
+    std::ostringstream out;
+    out << "utf8 " << scan.utf8 << " controls " << scan.controls << "\n";
+    return out.str();
+}
+
+// A string equal to text under casefolding, with one byte changed half the time
+std::string foldedTwin(const std::string& text) {
+    std::string twin = CaseMapping::fold(text);
+    for (size_t i = 0; i < twin.size(); ++i) {
+        if (next() % 2)
+            twin[i] = text[i];
+    }
+    if (!twin.empty() && next() % 2)
+        twin[next() % twin.size()] ^= static_cast<char>(1 << (next() % 8));
+    return twin;
+}
+
+struct Suite {
+    const char*     name;
+    bool            (*use)(const std::string&);
+    std::string     (*results)(const std::string&, const std::string&);
+};
+
+bool check(const Suite& suite, const char* kernel, const std::string& text, const std::string& other) {
+    suite.use("scalar");
+    std::string expected = suite.results(text, other);
+    suite.use(kernel);
+    std::string actual = suite.results(text, other);
+    if (expected == actual)
+        return true;
+    std::cerr << suite.name << " " << kernel << " differs from scalar\n"
+              << "  input  " << hex(text) << "\n"
+              << "  other  " << hex(other) << "\n"
+              << "scalar:\n" << expected << kernel << ":\n" << actual;
+    return false;
+}
+
+bool runSuite(const Suite& suite, const char* kernel) {
+    size_t cases = 0;
+
+    // Every length up to two AVX2 blocks, each byte an edge value
+    for (size_t length = 0; length <= LENGTH_MAX; ++length) {
+        for (size_t e = 0; e < sizeof(EDGES); ++e) {
+            std::string text(length, static_cast<char>(EDGES[e]));
+            if (length > 0)
+                text[length - 1] = static_cast<char>(EDGES[(e + length) % sizeof(EDGES)]);
+            if (!check(suite, kernel, text, foldedTwin(text)))
+                return false;
+            ++cases;
+        }
+    }
+
+    for (size_t i = 0; i < RANDOM_CASES; ++i) {
+        size_t length = i % 8 == 0 ? next() % 1024 : next() % (LENGTH_MAX + 1);
+        std::string text = i % 2 ? randomUtf8(length) : randomBytes(length);
+        if (!check(suite, kernel, text, foldedTwin(text)))
+            return false;
+        ++cases;
+    }
+    std::cout << suite.name << " " << kernel << ": " << cases << " cases match scalar" << std::endl;
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    g_state = argc > 1 ? std::strtoull(argv[1], NULL, 10) : 0x9E3779B97F4A7C15ULL;
+    if (g_state == 0)
+        g_state = 1;
+
+    const Suite suites[] = {
+        { "CaseMapping", CaseMapping::useKernel, caseMappingResults },
+        { "TextFilter", TextFilter::useKernel, textFilterResults }
+    };
+    for (size_t s = 0; s < sizeof(suites) / sizeof(suites[0]); ++s) {
+        bool tested = false;
+        for (size_t k = 0; k < sizeof(VECTOR_KERNELS) / sizeof(VECTOR_KERNELS[0]); ++k) {
+            if (!suites[s].use(VECTOR_KERNELS[k]))
+                continue;
+            tested = true;
+            if (!runSuite(suites[s], VECTOR_KERNELS[k]))
+                return 1;
+        }
+        if (!tested)
+            std::cout << suites[s].name << ": no vector kernel on this CPU, nothing to compare" << std::endl;
+    }
+    return 0;
+}